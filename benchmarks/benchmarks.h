@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/** Benchmarks of the individual pipeline components.
+
+  Each benchmark prepares its own inputs in the given working directory, runs the measured code in all its variants and prints the timings to stdout. They are not part of the normal run, see main.cpp for how to invoke them.
+ */
+class Benchmark {
+public:
+
+    /** Compares the process based and native git readers on a locally generated repository with given number of commits.
+     */
+    static void GitReader(std::string const & workdir, unsigned commits = 2000);
+
+    /** Compares full clone against blobless clone with fetching only the blobs of javascript files.
+
+      The upstream is a local bare repository with uploadpack filtering enabled, served over file:// so that the partial clone protocol is used. Its files are mostly binary assets with a few javascript files.
+     */
+    static void PartialClone(std::string const & workdir, unsigned commits = 500);
+
+    /** Measures the latency of starting a trivial process as our heap grows up to the given size, single threaded and from given number of threads.
+
+      Compares plain fork and exec, posix_spawn from this process and launching through the ForkServer, which is started before the heap grows.
+     */
+    static void ProcessLaunch(unsigned launches = 200, unsigned maxHeapMB = 2048, unsigned threads = 8);
+
+    /** Measures throughput of the content hashes index from 1 to given number of threads, comparing the sharded ContentIndex, with and without its bloom filter, against a single map behind a single lock.
+     */
+    static void ContentHashes(size_t operations = 4000000, unsigned maxThreads = 64);
+
+    /** Measures how fast given number of generated contents are stored from given number of threads and how many inodes and bytes they take afterwards, comparing a file per content, with and without compressing full folders by tar, against the ContentStore, with and without sealing full segments.
+     */
+    static void ContentIngestion(std::string const & workdir, size_t contents = 100000, unsigned threads = 4);
+
+    /** Measures reading contents from sealed segments by random ids with different cache sizes, in a batch and by scanning the whole store in id order with up to given number of threads. Reading a content from a files.tar.xz folder is shown for comparison.
+     */
+    static void ContentRead(std::string const & workdir, size_t contents = 100000, unsigned threads = 4);
+
+    /** Stores given number of versions of given number of generated files, each version a few small edits of the previous one, and compares the size on disk and the read speed of full contents against delta chains of given depths.
+     */
+    static void ContentDeltas(std::string const & workdir, size_t files = 2000, unsigned versions = 20);
+
+    /** Stores up to given number of javascript files found in the sources directory and compares the size on disk and the speed of reading single contents without a cache when compressed in blocks of different sizes, one by one, and one by one with trained dictionaries of different sizes.
+     */
+    static void ContentDictionaries(std::string const & workdir, std::string const & sources, size_t contents = 20000);
+
+    /** Writes given number of snapshots for each of given number of projects as the csv files of the projects and as the global snapshots table, and compares the time and space taken and the time to read a single column of all projects.
+     */
+    static void Tables(std::string const & workdir, unsigned projects = 5000, unsigned snapshots = 1000);
+
+    /** Measures the heap taken by the commits and snapshots the analysis of a project keeps in memory, for a history of given number of commits, each changing three of given number of files, which is about the size of the largest projects.
+     */
+    static void ProjectMemory(unsigned commits = 1000000, unsigned files = 50000);
+
+    /** Measures the overhead of scheduling tasks to a Worker pool from 1 to given number of threads, with tiny tasks like the csv rows of the cleaner and with heavy tasks like the projects of the downloader, which carry filled sets and vectors.
+     */
+    static void Scheduler(size_t tinyTasks = 2000000, size_t heavyTasks = 20000, unsigned maxThreads = 8);
+
+    /** Simulates downloading given number of projects with heavy tailed durations and one huge project at the end of the input on given number of threads, and compares the wall clock time of the file order against the most expensive first order with exact, noisy and missing estimates. The projects sleep, so the result does not depend on the cpus of the machine.
+     */
+    static void CostOrder(unsigned projects = 400, unsigned threads = 8, double seconds = 4);
+
+};
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
+
+#include "include/utils.h"
+#include "include/hash.h"
+#include "include/contentindex.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    std::vector<SHA1> RandomHashes(size_t count, uint64_t seed) {
+        std::vector<SHA1> result;
+        result.reserve(count);
+        unsigned char raw[20];
+        for (size_t i = 0; i < count; ++i) {
+            for (unsigned j = 0; j < 20; ++j) {
+                // xorshift
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                raw[j] = static_cast<unsigned char>(seed);
+            }
+            result.push_back(SHA1::FromBytes(raw));
+        }
+        return result;
+    }
+
+    /** The index as it used to be, a single map behind a single lock.
+     */
+    class LockedMap {
+    public:
+        long find(SHA1 const & hash) {
+            std::lock_guard<std::mutex> g(guard_);
+            auto i = map_.find(hash);
+            return i == map_.end() ? -1 : i->second;
+        }
+
+        long assign(SHA1 const & hash, bool & created) {
+            std::lock_guard<std::mutex> g(guard_);
+            auto i = map_.find(hash);
+            created = i == map_.end();
+            if (not created)
+                return i->second;
+            long id = map_.size();
+            map_.insert(std::make_pair(hash, id));
+            return id;
+        }
+
+    private:
+        std::mutex guard_;
+        std::unordered_map<SHA1, long> map_;
+    };
+
+    /** Each thread assigns its share of the stream, where most hashes repeat like files shared by projects do, and looks up a hash that is not in the index after each assignment, like the blobless fetch does for new files.
+
+      Returns millions of operations per second.
+     */
+    template<typename INDEX>
+    double Run(INDEX & index, std::vector<SHA1> const & stream, std::vector<SHA1> const & missing, unsigned threads) {
+        std::atomic<long> found(0);
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([&, t] () {
+                long f = 0;
+                bool created;
+                for (size_t i = t; i < stream.size(); i += threads) {
+                    index.assign(stream[i], created);
+                    if (index.find(missing[i]) != -1)
+                        ++f;
+                }
+                found += f;
+            }));
+        }
+        for (std::thread & w : workers)
+            w.join();
+        double us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        if (found != 0)
+            std::cout << "MISSING HASHES FOUND" << std::endl;
+        return stream.size() * 2 / us;
+    }
+
+} // anonymous namespace
+
+void Benchmark::ContentHashes(size_t operations, unsigned maxThreads) {
+    std::cout << "Content hashes index benchmark, " << operations << " assignments and as many missing lookups, Mops/s, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+    // a third of the stream are unique hashes, the rest repeats them
+    std::vector<SHA1> unique = RandomHashes(operations / 3, 42);
+    std::vector<SHA1> stream;
+    stream.reserve(operations);
+    uint64_t x = 7;
+    for (size_t i = 0; i < operations; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        stream.push_back(unique[(x >> 33) % unique.size()]);
+    }
+    std::vector<SHA1> missing = RandomHashes(operations, 4242);
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        LockedMap locked;
+        ContentIndex sharded;
+        ContentIndex bloom;
+        bloom.enableBloomFilter(unique.size() * 10);
+        std::cout << "threads " << std::setw(3) << threads
+                  << "  map+mutex " << std::setw(8) << Run(locked, stream, missing, threads)
+                  << "  sharded " << std::setw(8) << Run(sharded, stream, missing, threads)
+                  << "  sharded+bloom " << std::setw(8) << Run(bloom, stream, missing, threads) << std::endl;
+    }
+}
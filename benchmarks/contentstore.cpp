@@ -0,0 +1,369 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+
+#include "include/utils.h"
+#include "include/exec.h"
+#include "include/filesystem.h"
+#include "include/contentstore.h"
+
+#include "ght/settings.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    /** Generates javascript-like contents of sizes between 100 bytes and 12kB, most of them small, like the files in real projects.
+     */
+    std::vector<std::string> GenerateContents(size_t count) {
+        char const * words[] = { "function", "return", "var", "this", "value", "callback", "if", "else", "length", "for", "require", "module", "exports", "null", "undefined", "options" };
+        std::vector<std::string> result;
+        result.reserve(count);
+        uint64_t x = 42;
+        for (size_t i = 0; i < count; ++i) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t size = 100 << ((x >> 33) % 7);
+            size += (x >> 40) % size;
+            std::string s;
+            s.reserve(size + 32);
+            while (s.size() < size) {
+                x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                s += words[(x >> 33) % 16];
+                s += ((x >> 50) % 8 == 0) ? STR("_" << ((x >> 20) % 1000) << ";\n") : std::string(" ");
+            }
+            result.push_back(std::move(s));
+        }
+        return result;
+    }
+
+    struct Usage {
+        size_t inodes = 0;
+        size_t bytes = 0;
+    };
+
+    Usage DiskUsage(std::string const & path) {
+        Usage result;
+        for (std::string const & name : listDirectory(path)) {
+            std::string p = STR(path << "/" << name);
+            ++result.inodes;
+            if (isDirectory(p)) {
+                Usage u = DiskUsage(p);
+                result.inodes += u.inodes;
+                result.bytes += u.bytes;
+            } else {
+                result.bytes += fileSize(p);
+            }
+        }
+        return result;
+    }
+
+    /** Collects the contents of up to given number of javascript files in the path and its subdirectories.
+     */
+    void CollectSources(std::string const & path, size_t count, std::vector<std::string> & into) {
+        for (std::string const & name : listDirectory(path)) {
+            if (into.size() >= count)
+                return;
+            std::string p = STR(path << "/" << name);
+            if (isDirectory(p))
+                CollectSources(p, count, into);
+            else if (name.size() > 3 and name.compare(name.size() - 3, 3, ".js") == 0 and isFile(p))
+                into.push_back(LoadEntireFile(p));
+        }
+    }
+
+    double Seconds(std::chrono::high_resolution_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - since).count() / 1000000.0;
+    }
+
+    /** Each thread stores its share of the contents. With compression the full folders are compressed, or the full segments sealed, by the thread that filled them, like the downloader does without extra compressor threads.
+     */
+    template<typename STORE>
+    double Run(std::vector<std::string> const & contents, unsigned threads, STORE store) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([&, t] () {
+                for (size_t i = t; i < contents.size(); i += threads)
+                    store(i, contents[i]);
+            }));
+        }
+        for (std::thread & w : workers)
+            w.join();
+        return Seconds(start);
+    }
+
+    void Report(std::string const & name, size_t bytes, double seconds, std::string const & path) {
+        Usage u = DiskUsage(path);
+        std::cout << std::left << std::setw(24) << name
+                  << std::setw(10) << seconds << "s "
+                  << std::setw(10) << (bytes / seconds / 1024 / 1024) << "MB/s "
+                  << std::setw(10) << u.inodes << "inodes "
+                  << Bytes(u.bytes) << " on disk" << std::endl;
+    }
+
+} // anonymous namespace
+
+void Benchmark::ContentIngestion(std::string const & workdir, size_t contents, unsigned threads) {
+    std::cout << "Content ingestion benchmark, " << contents << " contents, " << threads << " threads" << std::endl;
+    std::vector<std::string> data = GenerateContents(contents);
+    size_t bytes = 0;
+    for (std::string const & s : data)
+        bytes += s.size();
+    std::cout << "total size " << Bytes(bytes) << std::endl;
+    deletePath(workdir);
+    createPath(workdir);
+    for (bool compress : { false, true }) {
+        // a file per content, full folders compressed by tar
+        std::string files = STR(workdir << "/files" << compress);
+        double t = Run(data, threads, [&] (long id, std::string const & s) {
+            std::string dir = STR(files << IdToPath(id, "files_"));
+            createPathIfMissing(dir);
+            {
+                std::ofstream f = CheckedOpen(STR(dir << "/" << id << ".raw"));
+                f << s;
+            }
+            // the last id of a folder may not be the last one written to it with more threads, good enough for timing
+            if (compress and IdPathFull(id)) {
+                std::vector<std::string> args = { "tar", "cfJ", "files.tar.xz" };
+                for (std::string const & name : listDirectory(dir))
+                    if (name.size() > 4 and name.compare(name.size() - 4, 4, ".raw") == 0)
+                        args.push_back(name);
+                if (Process(args, dir).run().success())
+                    for (size_t i = 3; i < args.size(); ++i)
+                        std::remove(STR(dir << "/" << args[i]).c_str());
+            }
+        });
+        Report(compress ? "files + tar.xz" : "files", bytes, t, files);
+        // segments, sealed when full
+        std::string segments = STR(workdir << "/segments" << compress);
+        ContentStore store;
+        store.open(segments, Settings::Downloader::SegmentSize, Settings::Downloader::SegmentBlockSize);
+        auto start = std::chrono::high_resolution_clock::now();
+        Run(data, threads, [&] (long id, std::string const & s) {
+            long full = store.append(id, s);
+            if (full != -1 and compress)
+                store.seal(full);
+        });
+        long last = store.close();
+        if (last != -1 and compress)
+            store.seal(last);
+        Report(compress ? "segments + sealed" : "segments", bytes, Seconds(start), segments);
+    }
+}
+
+void Benchmark::ContentRead(std::string const & workdir, size_t contents, unsigned threads) {
+    std::cout << "Content read benchmark, " << contents << " contents" << std::endl;
+    std::vector<std::string> data = GenerateContents(contents);
+    size_t bytes = 0;
+    for (std::string const & s : data)
+        bytes += s.size();
+    deletePath(workdir);
+    createPath(workdir);
+    std::string segments = STR(workdir << "/segments");
+    {
+        ContentStore store;
+        store.open(segments, Settings::Downloader::SegmentSize, Settings::Downloader::SegmentBlockSize);
+        for (size_t i = 0; i < data.size(); ++i) {
+            long full = store.append(i, data[i]);
+            if (full != -1)
+                store.seal(full);
+        }
+        long last = store.close();
+        if (last != -1)
+            store.seal(last);
+    }
+    // random ids, the same for all variants
+    std::vector<long> ids;
+    uint64_t x = 7;
+    for (size_t i = 0; i < 10000; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        ids.push_back((x >> 33) % contents);
+    }
+    bool differ = false;
+    // what reading a single content used to take, extracting it from the files.tar.xz of its folder
+    {
+        std::string folder = STR(workdir << "/folder");
+        createPath(folder);
+        std::vector<std::string> args = { "tar", "cfJ", "files.tar.xz" };
+        for (size_t i = 0; i < Settings::General::FilesPerFolder and i < data.size(); ++i) {
+            std::ofstream f = CheckedOpen(STR(folder << "/" << i << ".raw"));
+            f << data[i];
+            args.push_back(STR(i << ".raw"));
+        }
+        Process(args, folder).run();
+        unsigned n = 20;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned i = 0; i < n; ++i) {
+            long id = ids[i] % Settings::General::FilesPerFolder;
+            Process::Result r = Process({ "tar", "xJOf", "files.tar.xz", STR(id << ".raw") }, folder).run();
+            differ = differ or r.out != data[id];
+        }
+        std::cout << std::left << std::setw(24) << "tar.xz extract" << std::setw(10) << (n / Seconds(start)) << "reads/s" << std::endl;
+    }
+    for (size_t cache : { size_t(0), size_t(64 * 1024 * 1024), size_t(1024) * 1024 * 1024 }) {
+        ContentStore store;
+        store.open(segments, 0, 0);
+        store.setCacheSize(cache);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long id : ids)
+            differ = differ or store.read(id) != data[id];
+        std::cout << std::left << std::setw(24) << STR("read, cache " << Bytes(cache)) << std::setw(10) << (ids.size() / Seconds(start)) << "reads/s" << std::endl;
+    }
+    {
+        ContentStore store;
+        store.open(segments, 0, 0);
+        store.setCacheSize(0);
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::string> result = store.read(ids);
+        std::cout << std::left << std::setw(24) << "batch read" << std::setw(10) << (ids.size() / Seconds(start)) << "reads/s" << std::endl;
+        for (size_t i = 0; i < ids.size(); ++i)
+            differ = differ or result[i] != data[ids[i]];
+    }
+    for (unsigned t = 1; t <= threads; t *= 2) {
+        ContentStore store;
+        store.open(segments, 0, 0);
+        long expected = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        store.scan([&] (long id, std::string const & s) {
+            differ = differ or id != expected++ or s != data[id];
+        }, t);
+        differ = differ or expected != static_cast<long>(contents);
+        double seconds = Seconds(start);
+        std::cout << std::left << std::setw(24) << STR("scan, " << t << " threads") << std::setw(10) << (bytes / seconds / 1024 / 1024) << "MB/s" << std::endl;
+    }
+    if (differ)
+        std::cout << "CONTENTS DIFFER" << std::endl;
+}
+
+void Benchmark::ContentDeltas(std::string const & workdir, size_t files, unsigned versions) {
+    std::cout << "Content deltas benchmark, " << files << " files, " << versions << " versions each" << std::endl;
+    // version v of file f has id v * files + f
+    std::vector<std::string> data = GenerateContents(files);
+    data.reserve(files * versions);
+    uint64_t x = 11;
+    for (size_t i = files; i < files * versions; ++i) {
+        std::string s = data[i - files];
+        // a few small edits, like most commits do
+        for (unsigned e = 0; e < 3; ++e) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t pos = (x >> 33) % (s.size() + 1);
+            size_t erase = std::min(static_cast<size_t>((x >> 20) % 8), s.size() - pos);
+            s.replace(pos, erase, STR(" edit_" << i << "_" << e << ";\n"));
+        }
+        data.push_back(std::move(s));
+    }
+    size_t bytes = 0;
+    for (std::string const & s : data)
+        bytes += s.size();
+    std::cout << "total size " << Bytes(bytes) << std::endl;
+    deletePath(workdir);
+    createPath(workdir);
+    std::vector<long> ids;
+    for (size_t i = 0; i < 10000; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        ids.push_back((x >> 33) % data.size());
+    }
+    bool differ = false;
+    for (unsigned depth : { 0, 4, 16 }) {
+        std::string segments = STR(workdir << "/depth" << depth);
+        double seconds;
+        {
+            ContentStore store;
+            store.open(segments, Settings::Downloader::SegmentSize, Settings::Downloader::SegmentBlockSize);
+            store.setMaxDeltaDepth(depth);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < data.size(); ++i) {
+                long full = i < files ? store.append(i, data[i]) : store.append(i, data[i], 0, i - files, [&] () {
+                    return data[i - files];
+                });
+                if (full != -1)
+                    store.seal(full);
+            }
+            long last = store.close();
+            if (last != -1)
+                store.seal(last);
+            seconds = Seconds(start);
+        }
+        size_t raw = DiskUsage(segments).bytes;
+        ContentStore store;
+        store.open(segments, 0, 0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long id : ids)
+            differ = differ or store.read(id) != data[id];
+        double readSeconds = Seconds(start);
+        std::cout << std::left << std::setw(24) << (depth == 0 ? std::string("full contents") : STR("deltas, depth " << depth))
+                  << std::setw(10) << (bytes / seconds / 1024 / 1024) << "MB/s "
+                  << std::setw(12) << Bytes(raw) << " on disk "
+                  << std::setw(10) << (ids.size() / readSeconds) << "reads/s" << std::endl;
+    }
+    if (differ)
+        std::cout << "CONTENTS DIFFER" << std::endl;
+}
+
+void Benchmark::ContentDictionaries(std::string const & workdir, std::string const & sources, size_t contents) {
+    std::vector<std::string> data;
+    CollectSources(sources, contents, data);
+    size_t bytes = 0;
+    size_t small = 0;
+    for (std::string const & s : data) {
+        bytes += s.size();
+        small += s.size() <= ContentStore::SmallContent ? 1 : 0;
+    }
+    std::cout << "Content dictionaries benchmark, " << data.size() << " files (" << small << " small), total size " << Bytes(bytes) << std::endl;
+    deletePath(workdir);
+    createPath(workdir);
+    std::vector<long> ids;
+    uint64_t x = 13;
+    for (size_t i = 0; i < 2000; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        ids.push_back((x >> 33) % data.size());
+    }
+    bool differ = false;
+    struct Variant {
+        std::string name;
+        uint32_t blockSize;
+        size_t dictionarySize;
+    };
+    // a block size of 1 compresses every content on its own
+    std::vector<Variant> variants = {
+        { "blocks 1MB", 1024 * 1024, 0 },
+        { "blocks 64kB", 64 * 1024, 0 },
+        { "one by one", 1, 0 },
+        { "dictionary 32kB", 1, 32 * 1024 },
+        { "dictionary 112kB", 1, 112 * 1024 },
+    };
+    for (Variant const & v : variants) {
+        std::string segments = STR(workdir << "/" << v.blockSize << "_" << v.dictionarySize);
+        double seconds;
+        {
+            ContentStore store;
+            store.open(segments, Settings::Downloader::SegmentSize, v.blockSize);
+            store.setDictionarySize(v.dictionarySize);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < data.size(); ++i) {
+                long full = store.append(i, data[i], 1);
+                if (full != -1)
+                    store.seal(full);
+            }
+            long last = store.close();
+            if (last != -1)
+                store.seal(last);
+            seconds = Seconds(start);
+        }
+        size_t size = DiskUsage(segments).bytes;
+        ContentStore store;
+        store.open(segments, 0, 0);
+        store.setCacheSize(0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (long id : ids)
+            differ = differ or store.read(id) != data[id];
+        double readSeconds = Seconds(start);
+        std::cout << std::left << std::setw(24) << v.name
+                  << std::setw(10) << (bytes / seconds / 1024 / 1024) << "MB/s "
+                  << std::setw(12) << Bytes(size) << " on disk "
+                  << std::setw(10) << (ids.size() / readSeconds) << "reads/s" << std::endl;
+    }
+    if (differ)
+        std::cout << "CONTENTS DIFFER" << std::endl;
+}
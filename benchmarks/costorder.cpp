@@ -0,0 +1,113 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#include "include/utils.h"
+#include "include/worker.h"
+#include "include/costqueue.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    /** A simulated project, taking given seconds and expected to take given estimate, NAN if unknown.
+     */
+    struct SimulatedProject {
+        double cost;
+        double estimate;
+
+        friend std::ostream & operator << (std::ostream & s, SimulatedProject const & p) {
+            return s << "project of " << p.cost << "s";
+        }
+    };
+
+    CostQueue<SimulatedProject> * Queue = nullptr;
+
+    /** Sleeps for the cost of the project, so that the simulation measures the schedule and not the cpus of the machine.
+     */
+    class SleepWorker : public Worker<SleepWorker, SimulatedProject> {
+    private:
+        void run(SimulatedProject & p) override {
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(p.cost * 1000000)));
+            if (Queue != nullptr)
+                Queue->measured(p.estimate, p.cost);
+        }
+    };
+
+    double Seconds(std::chrono::high_resolution_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - since).count() / 1000000.0;
+    }
+
+    /** Runs the projects on given number of threads, either in the given order, or from a cost queue, and returns the wall clock time. Like the downloader, the pool only has room for a project per thread.
+     */
+    double Simulate(std::vector<SimulatedProject> const & projects, unsigned threads, bool costOrder) {
+        SleepWorker::Pool pool(threads);
+        pool.spawn(threads);
+        CostQueue<SimulatedProject> queue;
+        Queue = costOrder ? & queue : nullptr;
+        auto start = std::chrono::high_resolution_clock::now();
+        pool.run();
+        if (costOrder) {
+            for (SimulatedProject const & p : projects)
+                queue.push(p, p.estimate);
+            while (not queue.empty())
+                pool.schedule(queue.pop());
+        } else {
+            for (SimulatedProject const & p : projects)
+                pool.schedule(p);
+        }
+        pool.wait();
+        Queue = nullptr;
+        return Seconds(start);
+    }
+
+} // anonymous namespace
+
+void Benchmark::CostOrder(unsigned projects, unsigned threads, double seconds) {
+    std::mt19937 rnd(42);
+    // project sizes have a heavy tail, a few projects take most of the time
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<double> costs;
+    for (unsigned i = 0; i < projects; ++i)
+        costs.push_back(1 / std::pow(1 - uniform(rnd), 1 / 1.2));
+    double sum = 0;
+    for (double c : costs)
+        sum += c;
+    // scale so that the whole corpus takes given seconds on all threads and put one huge project last
+    for (double & c : costs)
+        c *= seconds * threads / sum / 2;
+    costs.back() = seconds / 2;
+    sum = 0;
+    for (double c : costs)
+        sum += c;
+    double bound = std::max(sum / threads, * std::max_element(costs.begin(), costs.end()));
+    std::cout << "Cost order benchmark, " << projects << " projects, " << threads << " threads, " << sum << "s of work, at least " << bound << "s" << std::endl;
+    auto report = [bound](std::string const & what, double t) {
+        std::cout << std::left << std::setw(48) << what << std::setw(10) << STR(std::fixed << std::setprecision(2) << t << "s") << std::fixed << std::setprecision(2) << (t / bound) << "x the bound" << std::defaultfloat << std::endl;
+    };
+    std::vector<SimulatedProject> input;
+    // FIFO
+    for (double c : costs)
+        input.push_back(SimulatedProject{c, NAN});
+    report("file order", Simulate(input, threads, false));
+    // exact estimates from a previous run
+    input.clear();
+    for (double c : costs)
+        input.push_back(SimulatedProject{c, c});
+    report("cost order, exact estimates", Simulate(input, threads, true));
+    // previous runs took twice as long and were off by up to 2x either way, a third of the projects is new
+    std::lognormal_distribution<double> noise(0, 0.5);
+    input.clear();
+    for (double c : costs)
+        input.push_back(SimulatedProject{c, uniform(rnd) < 0.33 ? NAN : c * 2 * noise(rnd)});
+    input.back().estimate = costs.back() * 2;
+    report("cost order, noisy estimates, a third unknown", Simulate(input, threads, true));
+    // no estimates at all, the order of the file is kept
+    input.clear();
+    for (double c : costs)
+        input.push_back(SimulatedProject{c, NAN});
+    report("cost order, no estimates", Simulate(input, threads, true));
+}
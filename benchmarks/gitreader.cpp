@@ -0,0 +1,186 @@
+#include <iostream>
+#include <fstream>
+#include <unordered_set>
+#include <chrono>
+
+#include "include/utils.h"
+#include "include/exec.h"
+#include "include/filesystem.h"
+
+#include "ght/settings.h"
+
+#include "downloader/git.h"
+#include "downloader/gitrepo.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    /** Writes a git fast-import stream with given number of commits spread over few branches.
+
+      Each commit modifies a few files from a fixed set so that the packed repository contains reasonable delta chains.
+     */
+    void GenerateHistory(std::string const & filename, unsigned commits) {
+        unsigned const branches = 4;
+        unsigned const files = 200;
+        std::ofstream s = CheckedOpen(filename);
+        std::vector<std::string> contents(files);
+        unsigned mark = 1;
+        std::vector<unsigned> branchTips(branches, 0);
+        for (unsigned i = 0; i < commits; ++i) {
+            unsigned branch = i < commits / 2 ? 0 : i % branches;
+            std::vector<std::pair<unsigned, unsigned>> changed;
+            for (unsigned j = 0; j < 3; ++j) {
+                unsigned f = (i * 7 + j * 31) % files;
+                contents[f] += STR("function f" << i << "_" << j << "() { return " << (i * j) << "; }\n");
+                s << "blob\nmark :" << mark << "\ndata " << contents[f].size() << "\n" << contents[f] << "\n";
+                changed.push_back(std::make_pair(f, mark++));
+            }
+            std::string msg = STR("commit " << i);
+            s << "commit refs/heads/b" << branch << "\n"
+              << "mark :" << mark << "\n"
+              << "author Bench <bench@example.com> " << (1400000000 + i * 60) << " +0000\n"
+              << "committer Bench <bench@example.com> " << (1400000000 + i * 60) << " +0000\n"
+              << "data " << msg.size() << "\n" << msg << "\n";
+            // branches fork off the first branch
+            unsigned from = branchTips[branch] != 0 ? branchTips[branch] : branchTips[0];
+            if (from != 0)
+                s << "from :" << from << "\n";
+            // merge the other branches every now and then so that the history is not just a few parallel lines
+            if (branch == 0 and i % 50 == 0 and branchTips[1 + i % (branches - 1)] != 0)
+                s << "merge :" << branchTips[1 + i % (branches - 1)] << "\n";
+            for (auto c : changed)
+                s << "M 100644 :" << c.second << " src/d" << (c.first % 10) << "/file" << c.first << ".js\n";
+            s << "\n";
+            branchTips[branch] = mark++;
+        }
+    }
+
+    /** Returns seconds since the given time point and resets it to now.
+
+      Timer only has millisecond resolution, which is too coarse for measuring single git calls.
+     */
+    double Lap(std::chrono::high_resolution_clock::time_point & since) {
+        auto now = std::chrono::high_resolution_clock::now();
+        double result = std::chrono::duration_cast<std::chrono::microseconds>(now - since).count() / 1000000.0;
+        since = now;
+        return result;
+    }
+
+    struct Result {
+        double branches = 0;
+        double commits = 0;
+        double objects = 0;
+        double blobs = 0;
+        unsigned long numCommits = 0;
+        unsigned long numObjects = 0;
+        unsigned long numBytes = 0;
+    };
+
+    /** How the blob contents are obtained.
+     */
+    enum class Blobs {
+        Checkout,
+        CatFile,
+        Native,
+    };
+
+    /** Does what Project::analyze does, but only measures the git part.
+     */
+    Result Run(std::string const & repo, Blobs blobs) {
+        Settings::Downloader::NativeGit = blobs == Blobs::Native;
+        Git::Release(repo);
+        Result r;
+        auto t = std::chrono::high_resolution_clock::now();
+        std::unordered_set<std::string> branches = Git::GetBranches(repo);
+        r.branches = Lap(t);
+        for (std::string const & b : branches) {
+            Lap(t);
+            std::vector<Git::Commit> commits = Git::GetCommits(repo, b);
+            r.commits += Lap(t);
+            std::string parent = "";
+            for (auto i = commits.rbegin(), e = commits.rend(); i != e; ++i) {
+                std::vector<Git::Object> objects = Git::GetObjects(repo, i->hash, parent);
+                r.objects += Lap(t);
+                bool checked = false;
+                for (Git::Object const & o : objects) {
+                    if (o.type == Git::Object::Type::Deleted)
+                        continue;
+                    // the old path checks out the commit and reads the file, the new ones read the blob
+                    if (blobs != Blobs::Checkout) {
+                        r.numBytes += Git::GetBlob(repo, o.hash).size();
+                    } else {
+                        if (not checked) {
+                            Git::Checkout(repo, i->hash);
+                            checked = true;
+                        }
+                        r.numBytes += LoadEntireFile(STR(repo << "/" << o.relPath)).size();
+                    }
+                }
+                r.blobs += Lap(t);
+                r.numObjects += objects.size();
+                parent = i->hash;
+            }
+            r.numCommits += commits.size();
+        }
+        Git::Release(repo);
+        return r;
+    }
+
+    /** Single pass history walk, reported as if it were all spent on diffing the commits.
+     */
+    Result Walk(std::string const & repo, bool native) {
+        Settings::Downloader::NativeGit = native;
+        Git::Release(repo);
+        Result r;
+        auto t = std::chrono::high_resolution_clock::now();
+        Git::WalkHistory(repo, [&] (Git::LogEntry const & e) {
+            ++r.numCommits;
+            r.numObjects += e.objects.size();
+        });
+        r.objects = Lap(t);
+        return r;
+    }
+
+    void Report(std::string const & name, Result const & r) {
+        std::cout << std::left << std::setw(10) << name
+                  << "branches " << std::setw(10) << r.branches
+                  << "commits " << std::setw(10) << r.commits
+                  << "objects " << std::setw(10) << r.objects
+                  << "blobs " << std::setw(10) << r.blobs
+                  << "(" << r.numCommits << " commits, " << r.numObjects << " objects, " << Bytes(r.numBytes) << ")" << std::endl;
+    }
+
+} // anonymous namespace
+
+void Benchmark::GitReader(std::string const & workdir, unsigned commits) {
+    std::cout << "Git reader benchmark, " << commits << " commits" << std::endl;
+    deletePath(workdir);
+    createPath(workdir);
+    GenerateHistory(STR(workdir << "/history.fi"), commits);
+    if (not exec("git init -q --bare upstream && cd upstream && git fast-import --quiet < ../history.fi", workdir))
+        throw std::runtime_error("Unable to create the benchmark repository");
+    std::string repo = STR(workdir << "/repo");
+    if (not Git::Clone(STR(workdir << "/upstream"), repo))
+        throw std::runtime_error("Unable to clone the benchmark repository");
+    bool native = Settings::Downloader::NativeGit;
+    Result legacy = Run(repo, Blobs::Checkout);
+    Report("popen", legacy);
+    Report("cat-file", Run(repo, Blobs::CatFile));
+    Result inProcess = Run(repo, Blobs::Native);
+    Report("native", inProcess);
+    Result walk = Walk(repo, false);
+    Report("walk", walk);
+    Result walkNative = Walk(repo, true);
+    Report("walk nat.", walkNative);
+    // the same walk with parents and trees taken from git's commit-graph file
+    if (not exec("git commit-graph write --reachable", repo))
+        throw std::runtime_error("Unable to write the commit-graph file");
+    Result walkGraph = Walk(repo, true);
+    Report("walk cg", walkGraph);
+    Settings::Downloader::NativeGit = native;
+    if (legacy.numCommits != inProcess.numCommits or legacy.numObjects != inProcess.numObjects or legacy.numBytes != inProcess.numBytes)
+        std::cout << "RESULTS DIFFER" << std::endl;
+    if (walk.numCommits != walkNative.numCommits or walk.numObjects != walkNative.numObjects or walk.numCommits != walkGraph.numCommits or walk.numObjects != walkGraph.numObjects)
+        std::cout << "WALKS DIFFER" << std::endl;
+}
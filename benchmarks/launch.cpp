@@ -0,0 +1,93 @@
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <cstring>
+
+#include "include/utils.h"
+#include "include/exec.h"
+#include "include/forkserver.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    enum class Launcher {
+        Fork,
+        Spawn,
+        Server,
+    };
+
+    /** What popen and system did before they switched to posix_spawn, and what any fork from a large process does.
+     */
+    void ForkExec() {
+        pid_t pid = fork();
+        if (pid == 0) {
+            char const * argv[] = { "true", nullptr };
+            execvp(argv[0], const_cast<char * const *>(argv));
+            _exit(127);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    }
+
+    void Launch(Launcher l) {
+        if (l == Launcher::Fork) {
+            ForkExec();
+            return;
+        }
+        std::vector<std::string> args = { "true" };
+        std::vector<std::string> env;
+        Process::Result r;
+        if (l == Launcher::Spawn) {
+            // bypass the server even though it is running
+            pid_t pid = Process::SpawnDirect(args, "", env, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+            int status;
+            waitpid(pid, &status, 0);
+        } else {
+            Process::Wait(Process::Spawn(args, "", env, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO), r);
+        }
+    }
+
+    /** Returns average launch latency in microseconds when the launches are split among given number of threads.
+     */
+    double Measure(Launcher l, unsigned launches, unsigned threads) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; ++i)
+            workers.push_back(std::thread([l, launches, threads] () {
+                for (unsigned j = 0; j < launches / threads; ++j)
+                    Launch(l);
+            }));
+        for (std::thread & t : workers)
+            t.join();
+        double us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        return us / launches;
+    }
+
+} // anonymous namespace
+
+void Benchmark::ProcessLaunch(unsigned launches, unsigned maxHeapMB, unsigned threads) {
+    std::cout << "Process launch benchmark, " << launches << " launches, average latency in us" << std::endl;
+    // while we are still small
+    ForkServer::Start();
+    std::vector<std::unique_ptr<char[]>> heap;
+    unsigned heapMB = 0;
+    for (unsigned target = 0; target <= maxHeapMB; target = (target == 0) ? 256 : target * 2) {
+        // touch all the pages so that they are really mapped
+        for (; heapMB < target; heapMB += 64) {
+            heap.push_back(std::unique_ptr<char[]>(new char[64 * 1024 * 1024]));
+            std::memset(heap.back().get(), heapMB, 64 * 1024 * 1024);
+        }
+        std::cout << "heap " << std::setw(6) << heapMB << "M";
+        for (unsigned t : { 1u, threads }) {
+            std::cout << "  " << t << " thr: fork " << std::setw(8) << Measure(Launcher::Fork, launches, t)
+                      << " spawn " << std::setw(8) << Measure(Launcher::Spawn, launches, t)
+                      << " server " << std::setw(8) << Measure(Launcher::Server, launches, t);
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <iomanip>
+#include <malloc.h>
+
+#include "include/utils.h"
+
+#include "downloader/downloader.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    /** Bytes allocated on the heap, including the large blocks glibc maps on their own.
+     */
+    size_t HeapUsed() {
+        struct mallinfo2 m = mallinfo2();
+        return m.uordblks + m.hblkhd;
+    }
+
+    std::string RandomHash(uint64_t & x) {
+        static char const * hex = "0123456789abcdef";
+        std::string result;
+        for (unsigned i = 0; i < 40; ++i) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            result += hex[(x >> 33) & 15];
+        }
+        return result;
+    }
+
+} // anonymous namespace
+
+void Benchmark::ProjectMemory(unsigned commits, unsigned files) {
+    std::cout << "Project memory benchmark, " << commits << " commits, " << files << " files" << std::endl;
+    std::vector<std::string> paths;
+    for (unsigned i = 0; i < files; ++i)
+        paths.push_back(STR("src/components/module" << (i / 50) << "/file" << i << ".js"));
+    uint64_t x = 17;
+    size_t commitBytes = 0;
+    size_t snapshotBytes = 0;
+    Project::CommitSet commitSet;
+    PathPool pathPool;
+    std::vector<Project::Snapshot> snapshots;
+    for (unsigned i = 0; i < commits; ++i) {
+        // the commit is created the way the analysis does it, from the hex hash git gives us
+        Git::Commit gc(RandomHash(x), 1500000000 + i);
+        size_t before = HeapUsed();
+        uint32_t index = commitSet.insert(Project::Commit(gc)).first;
+        size_t afterCommit = HeapUsed();
+        commitBytes += afterCommit - before;
+        // three changed files per commit, their paths are interned the way the analysis does it
+        for (unsigned j = 0; j < 3; ++j) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            snapshots.push_back(Project::Snapshot(snapshots.size(), pathPool.intern(paths[(x >> 33) % paths.size()]), index));
+        }
+        snapshotBytes += HeapUsed() - afterCommit;
+    }
+    std::cout << std::left << std::setw(12) << "commits" << std::setw(12) << commitSet.size() << std::setw(12) << Bytes(commitBytes) << std::setprecision(4) << static_cast<double>(commitBytes) / commitSet.size() << " bytes each" << std::endl;
+    std::cout << std::left << std::setw(12) << "snapshots" << std::setw(12) << snapshots.size() << std::setw(12) << Bytes(snapshotBytes) << std::setprecision(4) << static_cast<double>(snapshotBytes) / snapshots.size() << " bytes each" << std::endl;
+    std::cout << std::left << std::setw(12) << "paths" << std::setw(12) << pathPool.size() << std::setw(12) << Bytes(pathPool.memory()) << "(included in the snapshots)" << std::endl;
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <unordered_set>
+
+#include "include/utils.h"
+#include "include/exec.h"
+#include "include/filesystem.h"
+#include "include/pattern_lists.h"
+#include "include/timer.h"
+
+#include "ght/settings.h"
+
+#include "downloader/git.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    /** Writes a fast-import stream where each commit changes one javascript file and few binary assets.
+     */
+    void GenerateHistory(std::string const & filename, unsigned commits) {
+        std::ofstream s = CheckedOpen(filename);
+        unsigned mark = 1;
+        uint32_t random = 42;
+        for (unsigned i = 0; i < commits; ++i) {
+            std::vector<std::string> paths;
+            std::vector<unsigned> marks;
+            std::string js = STR("module.exports = function() { return " << i << "; };\n");
+            s << "blob\nmark :" << mark << "\ndata " << js.size() << "\n" << js << "\n";
+            paths.push_back(STR("lib/module" << (i % 50) << ".js"));
+            marks.push_back(mark++);
+            for (unsigned j = 0; j < 4; ++j) {
+                // incompressible data, like images or fonts
+                std::string asset(16 * 1024, '\0');
+                for (char & c : asset) {
+                    random = random * 1103515245 + 12345;
+                    c = static_cast<char>(random >> 24);
+                }
+                s << "blob\nmark :" << mark << "\ndata " << asset.size() << "\n" << asset << "\n";
+                paths.push_back(STR("assets/image" << ((i * 4 + j) % 400) << ".png"));
+                marks.push_back(mark++);
+            }
+            std::string msg = STR("commit " << i);
+            s << "commit refs/heads/master\n"
+              << "author Bench <bench@example.com> " << (1400000000 + i * 60) << " +0000\n"
+              << "committer Bench <bench@example.com> " << (1400000000 + i * 60) << " +0000\n"
+              << "data " << msg.size() << "\n" << msg << "\n";
+            for (unsigned j = 0; j < paths.size(); ++j)
+                s << "M 100644 :" << marks[j] << " " << paths[j] << "\n";
+            s << "\n";
+        }
+    }
+
+    long DiskUsage(std::string const & path) {
+        std::string out = execAndCapture(STR("du -sb \"" << path << "\""), path);
+        return std::atol(out.c_str());
+    }
+
+} // anonymous namespace
+
+void Benchmark::PartialClone(std::string const & workdir, unsigned commits) {
+    std::cout << "Partial clone benchmark, " << commits << " commits" << std::endl;
+    deletePath(workdir);
+    createPath(workdir);
+    GenerateHistory(STR(workdir << "/history.fi"), commits);
+    if (not exec("git init -q --bare upstream && cd upstream && git fast-import --quiet < ../history.fi && git config uploadpack.allowFilter true", workdir))
+        throw std::runtime_error("Unable to create the benchmark repository");
+    std::string url = STR("file://" << workdir << "/upstream");
+    PatternList filter;
+    filter.allowSuffix(".js");
+    Timer t;
+    // full clone
+    std::string full = STR(workdir << "/full");
+    if (not Git::Clone(url, full, false))
+        throw std::runtime_error("Unable to clone the benchmark repository");
+    double fullTime = t.seconds(true);
+    long fullBytes = DiskUsage(full);
+    // blobless clone and fetch of the blobs that pass the filter, as Project::fetchBlobs does
+    std::string partial = STR(workdir << "/partial");
+    if (not Git::Clone(url, partial, false, true))
+        throw std::runtime_error("Unable to clone the benchmark repository");
+    double cloneTime = t.seconds(true);
+    std::unordered_set<std::string> wanted;
+    bool denied = false;
+    Git::WalkHistory(partial, [&] (Git::LogEntry const & e) {
+        for (auto const & obj : e.objects)
+            if (obj.type != Git::Object::Type::Deleted and filter.check(obj.relPath, denied))
+                wanted.insert(obj.hash);
+    });
+    Git::FetchBlobs(partial, std::vector<std::string>(wanted.begin(), wanted.end()));
+    double fetchTime = t.seconds(true);
+    long partialBytes = DiskUsage(partial);
+    // make sure we can read everything we need
+    for (std::string const & h : wanted)
+        Git::GetBlob(partial, h);
+    Git::Release(partial);
+    std::cout << "full      time " << std::left << std::setw(10) << fullTime << "size " << Bytes(fullBytes) << std::endl;
+    std::cout << "blobless  time " << std::left << std::setw(10) << (cloneTime + fetchTime) << "size " << Bytes(partialBytes)
+              << " (clone " << cloneTime << ", " << wanted.size() << " blobs fetched in " << fetchTime << ")" << std::endl;
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <type_traits>
+#include <unordered_set>
+
+#include "include/utils.h"
+#include "include/worker.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    double Seconds(std::chrono::high_resolution_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - since).count() / 1000000.0;
+    }
+
+    /** A task about as big as a project entering the downloader, with its sets and vectors already filled.
+     */
+    struct HeavyTask {
+        long id;
+        std::vector<std::string> paths;
+        std::unordered_set<std::string> seen;
+
+        HeavyTask(long id):
+            id(id) {
+            for (unsigned i = 0; i < 500; ++i)
+                paths.push_back(STR("src/components/module" << (i / 50) << "/file" << (id + i) << ".js"));
+            seen.insert(paths.begin(), paths.begin() + 100);
+        }
+
+        friend std::ostream & operator << (std::ostream & s, HeavyTask const & t) {
+            return s << "heavy task " << t.id;
+        }
+    };
+
+    std::atomic<uint64_t> Checksum(0);
+
+    /** Splits a csv row and sums its fields, the way the cleaner processes the rows of its input.
+     */
+    class TinyWorker : public Worker<TinyWorker, std::string> {
+    private:
+        void run(std::string & row) override {
+            uint64_t sum = 0;
+            size_t start = 0;
+            while (true) {
+                size_t end = row.find(',', start);
+                sum += std::strtoul(row.c_str() + start, nullptr, 10);
+                if (end == std::string::npos)
+                    break;
+                start = end + 1;
+            }
+            Checksum += sum;
+        }
+    };
+
+    /** Hashes all paths of the task a few times, a few hundred microseconds of work.
+     */
+    class HeavyWorker : public Worker<HeavyWorker, HeavyTask> {
+    private:
+        void run(HeavyTask & task) override {
+            uint64_t sum = 0;
+            for (unsigned i = 0; i < 10; ++i)
+                for (std::string const & p : task.paths)
+                    sum += std::hash<std::string>()(p) * (i + 1);
+            Checksum += sum + task.seen.size();
+        }
+    };
+
+    template<typename WORKER, typename CREATE>
+    double Run(unsigned threads, size_t tasks, CREATE create) {
+        auto start = std::chrono::high_resolution_clock::now();
+        WORKER::Spawn(threads);
+        WORKER::Run();
+        for (size_t i = 0; i < tasks; ++i)
+            WORKER::Schedule(create(i));
+        WORKER::Wait();
+        return Seconds(start);
+    }
+
+    /** Like Run, but schedules the tasks in batches of given size.
+     */
+    template<typename WORKER, typename CREATE>
+    double RunBatched(unsigned threads, size_t tasks, size_t batch, CREATE create) {
+        auto start = std::chrono::high_resolution_clock::now();
+        WORKER::Spawn(threads);
+        WORKER::Run();
+        std::vector<typename std::result_of<CREATE(size_t)>::type> b;
+        for (size_t i = 0; i < tasks; ++i) {
+            b.push_back(create(i));
+            if (b.size() == batch) {
+                WORKER::ScheduleMany(std::move(b));
+                b.clear();
+            }
+        }
+        WORKER::ScheduleMany(std::move(b));
+        WORKER::Wait();
+        return Seconds(start);
+    }
+
+    void Report(std::string const & what, unsigned threads, size_t tasks, double seconds) {
+        std::cout << std::left << std::setw(24) << what << std::setw(10) << threads << std::setw(12) << STR(seconds << "s") << static_cast<size_t>(tasks / seconds) << " tasks/s" << std::endl;
+    }
+
+} // anonymous namespace
+
+void Benchmark::Scheduler(size_t tinyTasks, size_t heavyTasks, unsigned maxThreads) {
+    std::cout << "Scheduler benchmark, " << tinyTasks << " tiny tasks, " << heavyTasks << " heavy tasks" << std::endl;
+    std::cout << std::left << std::setw(24) << "" << std::setw(10) << "threads" << std::setw(12) << "time" << "throughput" << std::endl;
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        double t = Run<TinyWorker>(threads, tinyTasks, [] (size_t i) {
+            return STR(i << "," << (i * 7) << ",javascript," << (i % 13) << "," << (i * 31));
+        });
+        Report("tiny, one by one", threads, tinyTasks, t);
+    }
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        double t = RunBatched<TinyWorker>(threads, tinyTasks, 1000, [] (size_t i) {
+            return STR(i << "," << (i * 7) << ",javascript," << (i % 13) << "," << (i * 31));
+        });
+        Report("tiny, batches of 1000", threads, tinyTasks, t);
+    }
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        double t = Run<HeavyWorker>(threads, heavyTasks, [] (size_t i) {
+            return HeavyTask(i);
+        });
+        Report("heavy, one by one", threads, heavyTasks, t);
+    }
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+
+#include "include/utils.h"
+#include "include/csv.h"
+#include "include/filesystem.h"
+#include "include/table.h"
+
+#include "ght/settings.h"
+
+#include "downloader/downloader.h"
+
+#include "benchmarks.h"
+
+namespace {
+
+    double Seconds(std::chrono::high_resolution_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - since).count() / 1000000.0;
+    }
+
+    size_t DiskUsage(std::string const & path) {
+        size_t result = 0;
+        for (std::string const & name : listDirectory(path)) {
+            std::string p = STR(path << "/" << name);
+            result += isDirectory(p) ? DiskUsage(p) : fileSize(p);
+        }
+        return result;
+    }
+
+    std::string RandomHash(uint64_t & x) {
+        static char const * hex = "0123456789abcdef";
+        std::string result;
+        for (unsigned i = 0; i < 40; ++i) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            result += hex[(x >> 33) & 15];
+        }
+        return result;
+    }
+
+} // anonymous namespace
+
+void Benchmark::Tables(std::string const & workdir, unsigned projects, unsigned snapshots) {
+    std::cout << "Tables benchmark, " << projects << " projects, " << snapshots << " snapshots each" << std::endl;
+    deletePath(workdir);
+    createPath(workdir);
+    std::string csvs = STR(workdir << "/projects");
+    std::string tables = STR(workdir << "/tables");
+    double csvWrite = 0;
+    double tableWrite = 0;
+    {
+        Table::Writer writer(tables, "snapshots", Project::Snapshot::Columns(), Settings::Downloader::TableShards);
+        uint64_t x = 17;
+        for (unsigned p = 0; p < projects; ++p) {
+            // a few hundred files changed by commits of about three files each, like a small project
+            std::vector<std::string> paths;
+            for (unsigned i = 0; i < 300; ++i)
+                paths.push_back(STR("src/module" << (i / 20) << "/file" << i << ".js"));
+            std::vector<Project::Snapshot> rows;
+            std::vector<Project::Commit> commits;
+            for (unsigned i = 0; i < snapshots; ++i) {
+                x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                if (i % 3 == 0)
+                    commits.push_back(Project::Commit(Git::Commit(RandomHash(x), 1500000000 + i)));
+                Project::Snapshot s(i, (x >> 33) % paths.size(), commits.size() - 1);
+                s.contentId = (x >> 20) % 10000000;
+                s.parentId = i > 0 ? i - 1 : -1;
+                rows.push_back(s);
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+            {
+                std::string dir = STR(csvs << IdToPath(p, "projects_") << "/" << p);
+                createPathIfMissing(dir);
+                std::ofstream f = CheckedOpen(STR(dir << "/snapshots.csv"));
+                for (Project::Snapshot const & s : rows) {
+                    s.write(f, commits[s.commit].commit, paths[s.path]);
+                    f << std::endl;
+                }
+            }
+            csvWrite += Seconds(start);
+            start = std::chrono::high_resolution_clock::now();
+            Table::RowGroup g(Project::Snapshot::Columns());
+            for (Project::Snapshot const & s : rows) {
+                g << static_cast<long>(p);
+                s.write(g, commits[s.commit].commit, paths[s.path]);
+            }
+            writer.write(p, g);
+            tableWrite += Seconds(start);
+        }
+    }
+    std::cout << std::left << std::setw(24) << "" << std::setw(14) << "write" << std::setw(14) << "on disk" << std::setw(14) << "contentId" << "path" << std::endl;
+    // reading a column from the csv files means parsing all of them
+    long sum = 0;
+    size_t lengths = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned p = 0; p < projects; ++p) {
+        CSVParser parser(STR(csvs << IdToPath(p, "projects_") << "/" << p << "/snapshots.csv"));
+        for (auto row : parser)
+            sum += std::stol(row[1]);
+    }
+    double csvColumn = Seconds(start);
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned p = 0; p < projects; ++p) {
+        CSVParser parser(STR(csvs << IdToPath(p, "projects_") << "/" << p << "/snapshots.csv"));
+        for (auto row : parser)
+            lengths += row[4].size();
+    }
+    double csvPath = Seconds(start);
+    std::cout << std::left << std::setw(24) << "csv per project" << std::setw(14) << STR(csvWrite << "s") << std::setw(14) << Bytes(DiskUsage(csvs)) << std::setw(14) << STR(csvColumn << "s") << csvPath << "s" << std::endl;
+    long tableSum = 0;
+    size_t tableLengths = 0;
+    Table::Reader reader(tables, "snapshots");
+    start = std::chrono::high_resolution_clock::now();
+    reader.scan("contentId", [&] (Table::Chunk const & c) {
+        for (size_t i = 0; i < c.size(); ++i)
+            tableSum += c.int64(i);
+    });
+    double tableColumn = Seconds(start);
+    start = std::chrono::high_resolution_clock::now();
+    reader.scan("path", [&] (Table::Chunk const & c) {
+        for (size_t i = 0; i < c.size(); ++i)
+            tableLengths += c.string(i).size();
+    });
+    double tablePath = Seconds(start);
+    std::cout << std::left << std::setw(24) << "columnar tables" << std::setw(14) << STR(tableWrite << "s") << std::setw(14) << Bytes(DiskUsage(tables)) << std::setw(14) << STR(tableColumn << "s") << tablePath << "s" << std::endl;
+    if (sum != tableSum or lengths != tableLengths)
+        std::cout << "TABLES DIFFER" << std::endl;
+}
@@ -6,3 +6,5 @@ long Cleaner::added_ = 0;
 long Cleaner::total_ = 0;
 
 std::unordered_set<std::string> Cleaner::projects_;
+
+std::function<void(std::string const &)> Cleaner::downstream_;
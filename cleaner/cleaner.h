@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <functional>
 #include <string>
 #include <unordered_set>
 
@@ -75,6 +76,12 @@ public:
         return STR(Settings::General::Target << "/input.csv");
     }
 
+    /** Sets where the urls of new projects are sent as soon as they are found, in addition to the output file, such as to the pool of the downloader, so that projects are downloaded while the cleaner is still going through its inputs.
+     */
+    static void SetDownstream(std::function<void(std::string const & url)> const & downstream) {
+        downstream_ = downstream;
+    }
+
 private:
 
 
@@ -121,6 +128,8 @@ private:
                         if (projects_.insert(url).second) {
                             outFile << url << std::endl;
                             ++added_;
+                            if (downstream_)
+                                downstream_(url);
                         } else {
                             ++skipped_;
                         }
@@ -137,6 +146,8 @@ private:
 
     static std::unordered_set<std::string> projects_;
 
+    static std::function<void(std::string const &)> downstream_;
+
 };
 
 
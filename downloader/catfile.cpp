@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "include/utils.h"
+#include "include/exec.h"
+#include "include/watchdog.h"
+
+#include "catfile.h"
+
+namespace {
+
+    size_t const BufferSize = 1024 * 1024;
+
+} // anonymous namespace
+
+std::mutex GitCatFile::openGuard_;
+std::unordered_map<std::string, std::shared_ptr<GitCatFile>> GitCatFile::open_;
+
+std::shared_ptr<GitCatFile> GitCatFile::Open(std::string const & repoPath) {
+    std::lock_guard<std::mutex> g(openGuard_);
+    auto i = open_.find(repoPath);
+    if (i != open_.end())
+        return i->second;
+    std::shared_ptr<GitCatFile> result(new GitCatFile(repoPath));
+    open_[repoPath] = result;
+    return result;
+}
+
+void GitCatFile::Release(std::string const & repoPath) {
+    std::shared_ptr<GitCatFile> x;
+    {
+        std::lock_guard<std::mutex> g(openGuard_);
+        auto i = open_.find(repoPath);
+        if (i == open_.end())
+            return;
+        x = i->second;
+        open_.erase(i);
+    }
+    // the coprocess is terminated outside of the lock when the last reference goes away
+}
+
+GitCatFile::GitCatFile(std::string const & repoPath):
+    repoPath_(repoPath),
+    pid_(-1),
+    buffer_(new char[BufferSize]),
+    bufferStart_(0),
+    bufferEnd_(0) {
+    // none of the pipe ends may leak to other processes, or they would keep the coprocess alive
+    int toChild[2];
+    int fromChild[2];
+    if (pipe2(toChild, O_CLOEXEC) != 0)
+        throw std::ios_base::failure("Unable to create pipe for git cat-file");
+    if (pipe2(fromChild, O_CLOEXEC) != 0) {
+        close(toChild[0]);
+        close(toChild[1]);
+        throw std::ios_base::failure("Unable to create pipe for git cat-file");
+    }
+    try {
+        // errors of the coprocess go where ours go
+        pid_ = Process::Spawn({ "git", "cat-file", "--batch" }, repoPath_, std::vector<std::string>(), toChild[0], fromChild[1], STDERR_FILENO);
+        Watchdog::Register(pid_);
+    } catch (...) {
+        for (int fd : { toChild[0], toChild[1], fromChild[0], fromChild[1] })
+            close(fd);
+        throw;
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+    in_ = toChild[1];
+    out_ = fromChild[0];
+}
+
+GitCatFile::~GitCatFile() {
+    close(in_);
+    close(out_);
+    Process::Result status;
+    Process::Wait(pid_, status);
+}
+
+std::string GitCatFile::read(std::string const & hash) {
+    std::lock_guard<std::mutex> g(guard_);
+    try {
+        return request(hash);
+    } catch (...) {
+        // the coprocess may be out of step with its requests, or gone
+        evict();
+        throw;
+    }
+}
+
+void GitCatFile::evict() {
+    std::lock_guard<std::mutex> g(openGuard_);
+    auto i = open_.find(repoPath_);
+    // the reader still holds a reference, so the coprocess is not terminated here
+    if (i != open_.end() and i->second.get() == this)
+        open_.erase(i);
+}
+
+std::string GitCatFile::request(std::string const & hash) {
+    std::string line = hash + "\n";
+    char const * x = line.data();
+    size_t left = line.size();
+    while (left > 0) {
+        ssize_t written = write(in_, x, left);
+        if (written <= 0)
+            throw std::ios_base::failure(STR("git cat-file in " << repoPath_ << " terminated unexpectedly"));
+        x += written;
+        left -= written;
+    }
+    // the header is hash type size, or hash missing
+    std::string header = readLine();
+    std::size_t space = header.rfind(' ');
+    if (space == std::string::npos or header.compare(space + 1, std::string::npos, "missing") == 0)
+        throw std::ios_base::failure(STR("Object " << hash << " not found in " << repoPath_));
+    size_t size = std::stoul(header.substr(space + 1));
+    std::string result(size, '\0');
+    if (size > 0)
+        readExact(&result[0], size);
+    // contents are followed by a new line
+    char nl;
+    readExact(&nl, 1);
+    return result;
+}
+
+std::string GitCatFile::readLine() {
+    std::string result;
+    while (true) {
+        if (bufferStart_ == bufferEnd_ and not fill())
+            throw std::ios_base::failure(STR("git cat-file in " << repoPath_ << " terminated unexpectedly"));
+        char * start = buffer_.get() + bufferStart_;
+        char * nl = static_cast<char *>(std::memchr(start, '\n', bufferEnd_ - bufferStart_));
+        if (nl != nullptr) {
+            result.append(start, nl - start);
+            bufferStart_ += nl - start + 1;
+            return result;
+        }
+        result.append(start, bufferEnd_ - bufferStart_);
+        bufferStart_ = bufferEnd_;
+    }
+}
+
+void GitCatFile::readExact(char * into, size_t bytes) {
+    while (bytes > 0) {
+        if (bufferStart_ == bufferEnd_) {
+            // large objects bypass the buffer
+            if (bytes >= BufferSize) {
+                ssize_t r = ::read(out_, into, bytes);
+                if (r <= 0)
+                    throw std::ios_base::failure(STR("git cat-file in " << repoPath_ << " terminated unexpectedly"));
+                into += r;
+                bytes -= r;
+                continue;
+            }
+            if (not fill())
+                throw std::ios_base::failure(STR("git cat-file in " << repoPath_ << " terminated unexpectedly"));
+        }
+        size_t n = std::min(bytes, bufferEnd_ - bufferStart_);
+        std::memcpy(into, buffer_.get() + bufferStart_, n);
+        bufferStart_ += n;
+        into += n;
+        bytes -= n;
+    }
+}
+
+bool GitCatFile::fill() {
+    ssize_t r = ::read(out_, buffer_.get(), BufferSize);
+    if (r <= 0)
+        return false;
+    bufferStart_ = 0;
+    bufferEnd_ = r;
+    return true;
+}
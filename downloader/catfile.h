@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+/** Long lived git cat-file --batch coprocess.
+
+  Reads objects of a single repository by their hashes without checking anything out, paying for the process launch only once per repository instead of once per object or commit. Like GitRepository, the coprocesses are opened per repository path and must be released when the repository is deleted.
+ */
+class GitCatFile {
+public:
+
+    static std::shared_ptr<GitCatFile> Open(std::string const & repoPath);
+
+    static void Release(std::string const & repoPath);
+
+    GitCatFile(std::string const & repoPath);
+
+    /** Closes the input of the coprocess and waits for it to terminate.
+     */
+    ~GitCatFile();
+
+    GitCatFile(GitCatFile const &) = delete;
+    GitCatFile & operator = (GitCatFile const &) = delete;
+
+    /** Returns contents of the object with given hash. Throws if the object does not exist.
+
+      Reads from several threads are serialized. If a read fails, the coprocess is no longer handed out by Open(), so that the next read of the repository starts a fresh one.
+     */
+    std::string read(std::string const & hash);
+
+private:
+
+    /** Sends the request for the object and reads the response, the caller holds the guard.
+     */
+    std::string request(std::string const & hash);
+
+    /** Removes the coprocess from the open ones, unless it has been replaced already.
+     */
+    void evict();
+
+    /** Reads till the end of line, which is not part of the result.
+     */
+    std::string readLine();
+
+    /** Reads exactly the given number of bytes.
+     */
+    void readExact(char * into, size_t bytes);
+
+    /** Refills the buffer, returns false when the coprocess closed its output.
+     */
+    bool fill();
+
+    std::string repoPath_;
+    /** Guards the pipes and the buffer, a request and its response must not interleave with others. */
+    std::mutex guard_;
+    pid_t pid_;
+    int in_;
+    int out_;
+
+    std::unique_ptr<char[]> buffer_;
+    size_t bufferStart_;
+    size_t bufferEnd_;
+
+    static std::mutex openGuard_;
+    static std::unordered_map<std::string, std::shared_ptr<GitCatFile>> open_;
+};
@@ -0,0 +1,208 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "include/utils.h"
+
+#include "commitgraph.h"
+
+
+namespace {
+
+    /** Parent position marking no parent in the commit data chunk.
+     */
+    uint32_t const GraphNoParent = 0x70000000;
+
+    /** Set on the second parent position when the commit has more than two parents, in which case the rest of the position indexes the extra edges chunk. Also marks the last of the extra edges.
+     */
+    uint32_t const GraphExtraEdges = 0x80000000;
+
+    uint32_t BigEndian32(unsigned char const * x) {
+        return (static_cast<uint32_t>(x[0]) << 24) | (static_cast<uint32_t>(x[1]) << 16) | (static_cast<uint32_t>(x[2]) << 8) | x[3];
+    }
+
+    uint64_t BigEndian64(unsigned char const * x) {
+        return (static_cast<uint64_t>(BigEndian32(x)) << 32) | BigEndian32(x + 4);
+    }
+
+} // anonymous namespace
+
+
+// CommitGraph::GraphFile -------------------------------------------------------------------------
+
+CommitGraph::GraphFile::GraphFile(std::string const & path):
+    file_(path),
+    count_(0),
+    fanout_(nullptr),
+    oids_(nullptr),
+    data_(nullptr),
+    edges_(nullptr) {
+    unsigned char const * x = file_.data();
+    // signature, version 1, hash version 1 (SHA1), number of chunks and number of base graphs, which only split graphs have
+    if (file_.size() < 8 or std::memcmp(x, "CGPH", 4) != 0 or x[4] != 1 or x[5] != 1 or x[7] != 0)
+        throw std::runtime_error(STR("Unsupported commit-graph file " << path));
+    unsigned chunks = x[6];
+    if (file_.size() < 8 + (chunks + 1) * 12)
+        throw std::runtime_error(STR("Truncated commit-graph file " << path));
+    for (unsigned i = 0; i < chunks; ++i) {
+        unsigned char const * c = x + 8 + i * 12;
+        uint64_t offset = BigEndian64(c + 4);
+        if (offset >= file_.size())
+            throw std::runtime_error(STR("Invalid chunk offset in commit-graph file " << path));
+        if (std::memcmp(c, "OIDF", 4) == 0)
+            fanout_ = x + offset;
+        else if (std::memcmp(c, "OIDL", 4) == 0)
+            oids_ = x + offset;
+        else if (std::memcmp(c, "CDAT", 4) == 0)
+            data_ = x + offset;
+        else if (std::memcmp(c, "EDGE", 4) == 0)
+            edges_ = x + offset;
+    }
+    if (fanout_ == nullptr or oids_ == nullptr or data_ == nullptr)
+        throw std::runtime_error(STR("Missing required chunks in commit-graph file " << path));
+    count_ = BigEndian32(fanout_ + 255 * 4);
+}
+
+uint32_t CommitGraph::GraphFile::find(SHA1 const & hash) const {
+    unsigned char first = hash.data()[0];
+    uint32_t lo = first == 0 ? 0 : BigEndian32(fanout_ + (first - 1) * 4);
+    uint32_t hi = BigEndian32(fanout_ + first * 4);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(oids_ + mid * 20, hash.data(), 20);
+        if (cmp == 0)
+            return mid;
+        else if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return None;
+}
+
+void CommitGraph::GraphFile::parents(uint32_t pos, std::vector<uint32_t> & into) const {
+    unsigned char const * x = data_ + pos * 36 + 20;
+    uint32_t first = BigEndian32(x);
+    if (first == GraphNoParent)
+        return;
+    into.push_back(first);
+    uint32_t second = BigEndian32(x + 4);
+    if (second == GraphNoParent)
+        return;
+    if (not (second & GraphExtraEdges)) {
+        into.push_back(second);
+        return;
+    }
+    if (edges_ == nullptr)
+        throw std::runtime_error("Octopus merge without extra edges in commit-graph file");
+    unsigned char const * e = edges_ + (second & ~GraphExtraEdges) * 4;
+    while (true) {
+        uint32_t p = BigEndian32(e);
+        into.push_back(p & ~GraphExtraEdges);
+        if (p & GraphExtraEdges)
+            break;
+        e += 4;
+    }
+}
+
+
+// CommitGraph ------------------------------------------------------------------------------------
+
+uint32_t const CommitGraph::None;
+
+CommitGraph::CommitGraph(GitRepository & repo):
+    repo_(repo) {
+    std::string path = repo.objectsPath() + "/info/commit-graph";
+    if (isFile(path)) {
+        // a broken or unsupported graph file only means we have to read all commits ourselves
+        try {
+            file_.reset(new GraphFile(path));
+        } catch (std::exception const &) {
+            file_.reset();
+        }
+    }
+}
+
+void CommitGraph::load(std::vector<SHA1> const & tips, std::vector<SHA1> const & exclude) {
+    bool created;
+    for (SHA1 const & x : exclude) {
+        uint32_t i = node(x, created);
+        if (created) {
+            nodes_[i].boundary = true;
+            expand(i);
+        }
+    }
+    // 0 = not visited, 1 = parents being visited, 2 = done
+    std::vector<unsigned char> state(nodes_.size(), 0);
+    std::vector<std::pair<uint32_t, bool>> stack;
+    for (SHA1 const & tip : tips)
+        stack.push_back(std::make_pair(node(tip, created), false));
+    while (not stack.empty()) {
+        std::pair<uint32_t, bool> top = stack.back();
+        stack.pop_back();
+        if (top.second) {
+            state[top.first] = 2;
+            order_.push_back(top.first);
+            continue;
+        }
+        if (state.size() < nodes_.size())
+            state.resize(nodes_.size(), 0);
+        if (state[top.first] != 0 or nodes_[top.first].boundary)
+            continue;
+        state[top.first] = 1;
+        stack.push_back(std::make_pair(top.first, true));
+        expand(top.first);
+        if (state.size() < nodes_.size())
+            state.resize(nodes_.size(), 0);
+        // pushed in reverse so that the first parent's history is visited first
+        Node const & n = nodes_[top.first];
+        for (uint32_t i = n.parentsCount; i > 0; --i) {
+            uint32_t p = parents_[n.parentsStart + i - 1];
+            if (state[p] == 0)
+                stack.push_back(std::make_pair(p, false));
+        }
+    }
+}
+
+uint32_t CommitGraph::node(SHA1 const & hash, bool & created) {
+    auto i = index_.find(hash);
+    if (i != index_.end()) {
+        created = false;
+        return i->second;
+    }
+    created = true;
+    uint32_t result = nodes_.size();
+    Node n;
+    n.hash = hash;
+    n.parentsStart = 0;
+    n.parentsCount = 0;
+    n.boundary = false;
+    nodes_.push_back(n);
+    index_.insert(std::make_pair(hash, result));
+    return result;
+}
+
+void CommitGraph::expand(uint32_t index) {
+    bool created;
+    std::vector<SHA1> parents;
+    uint32_t pos = file_ == nullptr ? None : file_->find(nodes_[index].hash);
+    if (pos != None) {
+        nodes_[index].tree = file_->tree(pos);
+        if (not nodes_[index].boundary) {
+            std::vector<uint32_t> positions;
+            file_->parents(pos, positions);
+            for (uint32_t p : positions)
+                parents.push_back(file_->hash(p));
+        }
+    } else {
+        GitRepository::CommitInfo c = repo_.readCommit(nodes_[index].hash);
+        nodes_[index].tree = c.tree;
+        if (not nodes_[index].boundary)
+            parents = std::move(c.parents);
+    }
+    // the parents are stored after all existing edges, creating their nodes may reallocate nodes_ so the node is only accessed by its index
+    uint32_t start = parents_.size();
+    for (SHA1 const & p : parents)
+        parents_.push_back(node(p, created));
+    nodes_[index].parentsStart = start;
+    nodes_[index].parentsCount = parents.size();
+}
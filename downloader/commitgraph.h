@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "include/hash.h"
+#include "include/filesystem.h"
+
+#include "gitrepo.h"
+
+/** In-memory DAG of the commits reachable from a set of tips.
+
+  Each commit is loaded exactly once, no matter how many branches share it, and is stored as a compact node with its tree and indices of its parents. Parents and trees are taken from git's commit-graph file (objects/info/commit-graph) when the repository has one, so the walk itself does not have to inflate any commits. Commits missing from the file, such as those fetched after it was written, are read from the object database.
+
+  The walk does not go past the excluded commits, which prunes the history analyzed by a previous run. The excluded commits themselves are kept as boundary nodes so that the commits built on top of them still know their parents' trees.
+ */
+class CommitGraph {
+public:
+
+    static uint32_t const None = 0xffffffff;
+
+    struct Node {
+        SHA1 hash;
+        SHA1 tree;
+        /** Index of the first parent in parents_. */
+        uint32_t parentsStart;
+        uint32_t parentsCount;
+        /** Boundary nodes are the excluded commits, they are parents of loaded commits, but are not part of the graph themselves. */
+        bool boundary;
+    };
+
+    CommitGraph(GitRepository & repo);
+
+    CommitGraph(CommitGraph const &) = delete;
+    CommitGraph & operator = (CommitGraph const &) = delete;
+
+    /** Loads all commits reachable from the given tips. The walk stops at the excluded commits.
+     */
+    void load(std::vector<SHA1> const & tips, std::vector<SHA1> const & exclude);
+
+    /** Returns true if the repository's commit-graph file is used.
+     */
+    bool hasGraphFile() const {
+        return file_ != nullptr;
+    }
+
+    size_t size() const {
+        return nodes_.size();
+    }
+
+    Node const & operator [] (uint32_t index) const {
+        return nodes_[index];
+    }
+
+    /** Returns index of the given parent of the node, or None if the node has no such parent.
+     */
+    uint32_t parent(uint32_t index, uint32_t which = 0) const {
+        Node const & n = nodes_[index];
+        return which < n.parentsCount ? parents_[n.parentsStart + which] : None;
+    }
+
+    /** Returns index of the node of the given commit, or None if the commit is not in the graph.
+     */
+    uint32_t find(SHA1 const & hash) const {
+        auto i = index_.find(hash);
+        return i == index_.end() ? None : i->second;
+    }
+
+    /** Returns indices of all non-boundary nodes ordered so that parents always precede their children.
+
+      The order is the post-order of a depth first walk from the tips, so that commits of a single branch stay together as much as possible.
+     */
+    std::vector<uint32_t> const & order() const {
+        return order_;
+    }
+
+private:
+
+    /** Read-only view of the commit-graph file, see git's Documentation/gitformat-commit-graph.txt for details.
+     */
+    class GraphFile {
+    public:
+        GraphFile(std::string const & path);
+
+        /** Returns the position of the commit in the file, or None if not present.
+         */
+        uint32_t find(SHA1 const & hash) const;
+
+        SHA1 hash(uint32_t pos) const {
+            return SHA1::FromBytes(oids_ + pos * 20);
+        }
+
+        SHA1 tree(uint32_t pos) const {
+            return SHA1::FromBytes(data_ + pos * 36);
+        }
+
+        /** Appends positions of the commit's parents to the given vector.
+         */
+        void parents(uint32_t pos, std::vector<uint32_t> & into) const;
+
+    private:
+        MappedFile file_;
+        uint32_t count_;
+        unsigned char const * fanout_;
+        unsigned char const * oids_;
+        unsigned char const * data_;
+        unsigned char const * edges_;
+    };
+
+    /** Returns the index of the node for given commit, creating it with unknown parents if it does not exist yet.
+     */
+    uint32_t node(SHA1 const & hash, bool & created);
+
+    /** Fills in the tree and parents of the given node.
+     */
+    void expand(uint32_t index);
+
+    GitRepository & repo_;
+    std::unique_ptr<GraphFile> file_;
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> parents_;
+    std::unordered_map<SHA1, uint32_t> index_;
+    std::vector<uint32_t> order_;
+};
@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "include/utils.h"
+#include "include/filesystem.h"
+
+#include "ght/settings.h"
+
+#include "compressor.h"
+
+
+std::ostream & operator << (std::ostream & s, CompressionJob const & job) {
+    if (job.store != nullptr)
+        s << "seal segment " << job.segment << " in " << job.store->path();
+    else
+        s << "compress folder " << job.folder;
+    return s;
+}
+
+
+unsigned Compressor::threads_ = 0;
+
+std::atomic<uint64_t> Compressor::bytes_(0);
+
+void Compressor::Start(unsigned threads, size_t queueSize) {
+    threads_ = threads;
+    DefaultPool().setBlockingTaskQueueSize(queueSize);
+    if (threads_ == 0)
+        return;
+    Spawn(threads_);
+    Run();
+}
+
+void Compressor::Compress(CompressionJob const & job) {
+    if (threads_ > 0) {
+        Schedule(job);
+        return;
+    }
+    try {
+        Execute(job);
+    } catch (std::exception const & e) {
+        Error(STR(e.what() << " while executing task " << job));
+    }
+}
+
+void Compressor::Finish() {
+    if (threads_ > 0)
+        Wait();
+}
+
+void Compressor::Report(std::ostream & s) {
+    // only the reporter thread calls this
+    static uint64_t lastBytes = 0;
+    static auto lastTime = std::chrono::high_resolution_clock::now();
+    auto now = std::chrono::high_resolution_clock::now();
+    uint64_t bytes = bytes_;
+    double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastTime).count() / 1000.0;
+    double mbps = seconds > 0 ? (bytes - lastBytes) / seconds / 1024 / 1024 : 0;
+    lastBytes = bytes;
+    lastTime = now;
+    s << "compression queue " << std::setw(6) << std::left << QueueSize()
+      << "compressed " << std::setw(10) << std::left << Bytes(bytes)
+      << std::fixed << std::setprecision(1) << mbps << " MB/s" << std::defaultfloat << std::endl;
+}
+
+void Compressor::Execute(CompressionJob const & job) {
+    if (job.store != nullptr) {
+        bytes_ += job.store->seal(job.segment);
+        return;
+    }
+    // the folder becomes a content store of its own with a single sealed segment, which unlike a tar.xz archive can be read one content at a time
+    std::vector<long> ids;
+    for (std::string const & name : listDirectory(job.folder))
+        if (name.size() > 4 and name.compare(name.size() - 4, 4, ".raw") == 0)
+            ids.push_back(std::stol(name.substr(0, name.size() - 4)));
+    std::sort(ids.begin(), ids.end());
+    ContentStore store;
+    store.open(job.folder, UINT64_MAX, Settings::Downloader::SegmentBlockSize);
+    for (long id : ids)
+        store.append(id, LoadEntireFile(STR(job.folder << "/" << id << ".raw")));
+    long segment = store.close();
+    if (segment == -1)
+        return;
+    bytes_ += store.seal(segment);
+    for (long id : ids)
+        std::remove(STR(job.folder << "/" << id << ".raw").c_str());
+}
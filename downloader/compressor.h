@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <string>
+
+#include "include/worker.h"
+#include "include/contentstore.h"
+
+/** A full segment of a content store to seal, or a full folder of raw files to pack into a content store in the folder.
+ */
+class CompressionJob {
+public:
+    CompressionJob(ContentStore & store, unsigned segment):
+        store(& store),
+        segment(segment) {
+    }
+
+    CompressionJob(std::string const & folder):
+        store(nullptr),
+        segment(0),
+        folder(folder) {
+    }
+
+    ContentStore * store;
+    unsigned segment;
+    std::string folder;
+};
+
+std::ostream & operator << (std::ostream & s, CompressionJob const & job);
+
+/** Pool of threads compressing the downloaded contents in the background.
+
+  The queue of the pool is bounded, so when the compressors fall behind, the downloaders scheduling new jobs block until there is room, instead of piling up uncompressed data. Without any threads the jobs are executed by the threads that schedule them.
+ */
+class Compressor : public Worker<Compressor, CompressionJob> {
+public:
+
+    /** Starts given number of compressor threads, which accept up to given number of waiting jobs.
+     */
+    static void Start(unsigned threads, size_t queueSize);
+
+    /** Schedules the job to the pool, blocking while the queue is full, or executes it if the pool has no threads.
+     */
+    static void Compress(CompressionJob const & job);
+
+    /** Blocks until all scheduled jobs are done and stops the threads.
+     */
+    static void Finish();
+
+    /** Prints the queue depth and throughput in uncompressed MB/s since the previous report.
+     */
+    static void Report(std::ostream & s);
+
+private:
+
+    static void Execute(CompressionJob const & job);
+
+    void run(CompressionJob & job) override {
+        Execute(job);
+    }
+
+    static unsigned threads_;
+
+    /** Uncompressed bytes of all finished jobs.
+     */
+    static std::atomic<uint64_t> bytes_;
+};
@@ -1,16 +1,70 @@
 #include "downloader.h"
 
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+
+#include <unistd.h>
+
 #include "include/csv.h"
 #include "include/exec.h"
+#include "include/watchdog.h"
+#include "include/forkserver.h"
+
+#include "compressor.h"
 
 
 #include "git.h"
 
 std::atomic<long> Project::idCounter_(0);
 
+size_t const Project::MaxTableRows;
+size_t const Project::MaxPathVersions;
+
 
 std::atomic<long> Downloader::snapshots_(0);
 
+uint32_t const Project::CommitSet::NotFound;
+
+std::pair<uint32_t, bool> Project::CommitSet::insert(Commit const & c) {
+    // the table is kept at most three quarters full
+    if ((commits_.size() + 1) * 4 > slots_.size() * 3)
+        grow();
+    size_t mask = slots_.size() - 1;
+    for (size_t i = std::hash<SHA1>()(c.commit) & mask; ; i = (i + 1) & mask) {
+        if (slots_[i] == 0) {
+            commits_.push_back(c);
+            slots_[i] = static_cast<uint32_t>(commits_.size());
+            return std::make_pair(slots_[i] - 1, true);
+        }
+        if (commits_[slots_[i] - 1].commit == c.commit)
+            return std::make_pair(slots_[i] - 1, false);
+    }
+}
+
+uint32_t Project::CommitSet::find(SHA1 const & hash) const {
+    if (slots_.empty())
+        return NotFound;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = std::hash<SHA1>()(hash) & mask; slots_[i] != 0; i = (i + 1) & mask)
+        if (commits_[slots_[i] - 1].commit == hash)
+            return slots_[i] - 1;
+    return NotFound;
+}
+
+void Project::CommitSet::grow() {
+    std::vector<uint32_t> slots(std::max<size_t>(16, slots_.size() * 2), 0);
+    size_t mask = slots.size() - 1;
+    for (uint32_t index = 0; index < commits_.size(); ++index) {
+        size_t i = std::hash<SHA1>()(commits_[index].commit) & mask;
+        while (slots[i] != 0)
+            i = (i + 1) & mask;
+        slots[i] = index + 1;
+    }
+    slots_.swap(slots);
+}
+
 
 
 void Project::initialize() {
@@ -19,20 +73,64 @@ void Project::initialize() {
 }
 
 void Project::loadPreviousRun() {
-    // TODO actually load the previous run, for now, we just
+    if (isFile(fileBranches())) {
+        CSVParser p(fileBranches());
+        for (auto row : p)
+            branches_.insert(Branch(row[0], row[1]));
+    }
+    if (isFile(fileCommits())) {
+        CSVParser p(fileCommits());
+        for (auto row : p)
+            commits_.insert(Commit(Git::Commit(row[0], std::stoi(row[1]))));
+    }
+    if (isFile(fileSnapshots())) {
+        // snapshots are in the order they were created, so the last one for each path and contents is its latest version
+        CSVParser p(fileSnapshots());
+        for (auto row : p) {
+            long id = std::stol(row[0]);
+            long contentId = std::stol(row[1]);
+            if (contentId != -1)
+                setLastId(internPath(row[4]), contentId, id);
+            if (id >= nextSnapshotId_)
+                nextSnapshotId_ = id + 1;
+        }
+    }
+}
+
+void Project::rollback() {
+    if (csvSizes_.empty())
+        return;
+    removeSpills();
+    std::string files[] = { fileBranches(), fileCommits(), fileSnapshots() };
+    for (size_t i = 0; i < 3; ++i)
+        if (fileSize(files[i]) > csvSizes_[i] and truncate(files[i].c_str(), csvSizes_[i]) != 0)
+            throw std::ios_base::failure(STR("Unable to roll back " << files[i] << " to " << csvSizes_[i] << " bytes"));
 }
 
 void Project::clone(bool force) {
     if (isDirectory(repoPath_)) {
-        if (force) {
-            deletePath(repoPath_);
-        } else {
-            // TODO pull instead of clone
-            return;
+        if (not force) {
+            // the remote branches still point where the previous analysis ended, remember them as the frontier, but only if they were really analyzed
+            frontier_.clear();
+            for (std::string const & tip : Git::GetRemoteTips(repoPath_))
+                if (commits_.find(SHA1(tip)) != CommitSet::NotFound)
+                    frontier_.push_back(tip);
+            if (Git::Fetch(repoPath_))
+                return;
+            // the repository is broken, get a fresh one
+            frontier_.clear();
         }
+        Git::Release(repoPath_);
+        deletePath(repoPath_);
+    }
+    // the working tree is never used, all blobs are read from the object database
+    std::string error;
+    if (not Git::Clone(gitUrl(), repoPath_, false, Settings::Downloader::BloblessClone, & error)) {
+        // the reason tells whether to try again, see Failure
+        while (not error.empty() and std::isspace(error.back()))
+            error.pop_back();
+        throw Failure::Error(STR("Unable to download project " << gitUrl() << ", id " << id_ << ": " << error), error);
     }
-    if (not Git::Clone(gitUrl(), repoPath_))
-        throw std::runtime_error(STR("Unable to download project " << gitUrl() << ", id " << id_));
 
 }
 
@@ -42,91 +140,327 @@ void Project::loadMetadata() {
         return;
     // get the current API token (remember we are rotating them)
     std::string const & token = Settings::General::GetNextApiToken();
-    // construct the API request
-    std::string req = STR("curl -i -s " << apiUrl() << " -H \"Authorization: token " << token << "\"");
+    // construct the API request, run directly so that the watchdog can kill it
+    Process curl({ "curl", "-i", "-sS", apiUrl(), "-H", STR("Authorization: token " << token) }, path_);
     // exec, the captured string is the result
-    req = execAndCapture(req, path_);
+    Process::Result r = curl.run();
+    // failures of curl and the rate limit are worth trying again, see Failure
+    if (not r.success())
+        throw Failure::Error(STR("Unable to get metadata of " << apiUrl() << ": " << r.err), r.err);
+    std::string status = r.out.substr(0, r.out.find('\n'));
+    if (status.find(" 429") != std::string::npos or (status.find(" 403") != std::string::npos and r.out.find("rate limit") != std::string::npos))
+        throw std::runtime_error(STR("API rate limit exceeded for " << apiUrl() << ": " << status));
     // TODO analyze the results somehow
 
     std::ofstream m = CheckedOpen(STR(path_ << "/metadata.json"));
-    m << req;
+    m << r.out;
 }
 
 void Project::deleteRepo() {
+    Git::Release(repoPath_);
     deletePath(repoPath_);
 }
 
 void Project::finalize() {
+    // the tables are written before the log, which marks the project as done
+    writeRows(Downloader::branchesTable_.get(), branchRows_);
+    writeRows(Downloader::commitsTable_.get(), commitRows_);
+    writeRows(Downloader::snapshotsTable_.get(), snapshotRows_);
+    if (Downloader::projectsTable_ != nullptr) {
+        Table::RowGroup rows(Columns());
+        rows << *this;
+        Downloader::projectsTable_->write(id_, rows);
+    }
     std::ofstream fLog = CheckedOpen(fileLog(), Settings::General::Incremental);
     fLog << *this << std::endl;
+    // the log marks the csvs as complete, there is nothing to roll back even if deleting the repository fails
+    csvSizes_.clear();
 }
 
 void Project::analyze(PatternList const & filter) {
+    // remember where the attempt starts, so that its output can be dropped if it fails, see rollback()
+    csvSizes_ = { Settings::General::Incremental ? fileSize(fileBranches()) : 0, Settings::General::Incremental ? fileSize(fileCommits()) : 0, Settings::General::Incremental ? fileSize(fileSnapshots()) : 0 };
+    // a killed run may have left its spilled rows behind
+    removeSpills();
     // open the output streams
     std::ofstream fBranches = CheckedOpen(fileBranches(), Settings::General::Incremental);
     std::ofstream fCommits = CheckedOpen(fileCommits(), Settings::General::Incremental);
     std::ofstream fSnapshots = CheckedOpen(fileSnapshots(), Settings::General::Incremental);
+    // blobless clones must first get the blobs we are going to need
+    if (Settings::Downloader::BloblessClone)
+        fetchBlobs(filter);
+    if (Settings::Downloader::StreamingHistory)
+        analyzeHistory(filter, fBranches, fCommits, fSnapshots);
+    else
+        analyzeBranches(filter, fBranches, fCommits, fSnapshots);
+    // we are done reading the repository
+    Git::Release(repoPath_);
+}
+
+void Project::analyzeBranches(PatternList const & filter, std::ostream & fBranches, std::ostream & fCommits, std::ostream & fSnapshots) {
     // for all branches
     for (std::string const & b: Git::GetBranches(repoPath_)) {
-        // clear the last id's buffer
-        lastIds_.clear();
         // get all commits for the branch
         std::vector<Git::Commit> commits = Git::GetCommits(repoPath_,b);
         Branch branch(b, commits.back().hash);
         // append the branch to list of branches if we haven't seen it yet
-        if (branches_.insert(branch).second)
+        if (branches_.insert(branch).second) {
             fBranches << branch << std::endl;
+            branchRows_ << id_ << branch;
+        }
         std::string parent = "";
         for (auto i = commits.rbegin(), e = commits.rend(); i != e; ++i) {
             Commit c(*i);
-            if (not commits_.insert(c).second)
+            // commits seen in other branches or previous runs are not analyzed again, but they are still parents of the new ones
+            auto added = commits_.insert(c);
+            if (not added.second) {
+                parent = i->hash;
                 continue;
+            }
             // we haven't seen the commit yet, store it and analyze
             fCommits << c << std::endl;
-            analyzeCommit(filter, *i, parent, fSnapshots);
-            parent = c.commit;
+            commitRows_ << id_ << c;
+            analyzeCommit(filter, added.first, parent, fSnapshots);
+            checkMemory();
+            Watchdog::Check();
+            parent = i->hash;
+        }
+    }
+}
+
+void Project::analyzeHistory(PatternList const & filter, std::ostream & fBranches, std::ostream & fCommits, std::ostream & fSnapshots) {
+    // the first commits of the branches are found by the walk itself, instead of following the first parents of each branch again
+    std::unordered_map<std::string, std::string> firstCommits;
+    // the last id's are shared by all branches as the walk goes through them all at once, they may also come from the previous run
+    Git::WalkHistory(repoPath_, [&] (Git::LogEntry const & e) {
+        Commit c(e.commit);
+        auto added = commits_.insert(c);
+        if (not added.second)
+            return;
+        // the commit is written after its snapshots so that a commit in the output is always complete
+        analyzeObjects(filter, added.first, e.objects, fSnapshots);
+        fCommits << c << std::endl;
+        commitRows_ << id_ << c;
+        checkMemory();
+        Watchdog::Check();
+    }, frontier_, & firstCommits);
+    // branches leading into the history of the previous run keep their first commits, only new ones have to be followed to their roots
+    std::unordered_set<std::string> known;
+    for (Branch const & b : branches_)
+        known.insert(b.name);
+    for (std::string const & b : Git::GetBranches(repoPath_)) {
+        auto i = firstCommits.find(b);
+        if (i == firstCommits.end() and known.find(b) != known.end())
+            continue;
+        Branch branch(b, i != firstCommits.end() ? i->second : Git::GetFirstCommit(repoPath_, b));
+        if (branches_.insert(branch).second) {
+            fBranches << branch << std::endl;
+            branchRows_ << id_ << branch;
+        }
+    }
+}
+
+void Project::fetchBlobs(PatternList const & filter) {
+    // the walk only needs commits and trees, which the blobless clone has
+    std::unordered_set<std::string> wanted;
+    bool denied = false;
+    Git::WalkHistory(repoPath_, [&] (Git::LogEntry const & e) {
+        if (commits_.find(SHA1(e.commit.hash)) != CommitSet::NotFound)
+            return;
+        for (auto const & obj : e.objects) {
+            if (obj.type == Git::Object::Type::Deleted or not checkPath(filter, internPath(obj.relPath), denied))
+                continue;
+            if (not Downloader::HasContentId(SHA1(obj.hash))) {
+                wanted.insert(obj.hash);
+                // the previous version may be needed as the base of a delta
+                if (Settings::Downloader::ContentDeltaDepth > 0 and not obj.oldHash.empty())
+                    wanted.insert(obj.oldHash);
+            }
+        }
+    }, frontier_);
+    Git::FetchBlobs(repoPath_, std::vector<std::string>(wanted.begin(), wanted.end()));
+}
+
+uint32_t Project::internPath(std::string const & relPath) {
+    uint32_t result = paths_.intern(relPath);
+    if (result == lastIds_.size()) {
+        lastIds_.emplace_back();
+        pathFilter_.push_back(PathFilter::Unchecked);
+    }
+    return result;
+}
+
+bool Project::checkPath(PatternList const & filter, uint32_t path, bool & denied) {
+    PathFilter & result = pathFilter_[path];
+    if (result == PathFilter::Unchecked) {
+        bool pathDenied = false;
+        if (filter.check(paths_.path(path), pathDenied))
+            result = PathFilter::Allowed;
+        else
+            result = pathDenied ? PathFilter::Denied : PathFilter::Ignored;
+    }
+    if (result == PathFilter::Denied)
+        denied = true;
+    return result == PathFilter::Allowed;
+}
+
+size_t Project::memory() const {
+    size_t result = commits_.memory() + paths_.memory() + pathFilter_.capacity() * sizeof(PathFilter);
+    // a node of the set with the name and its bucket
+    for (Branch const & b : branches_)
+        result += sizeof(Branch) + b.name.capacity() + 24;
+    // a vector of versions for each path
+    result += lastIds_.capacity() * sizeof(std::vector<std::pair<long, long>>) + versions_ * sizeof(std::pair<long, long>);
+    return result + branchRows_.memory() + commitRows_.memory() + snapshotRows_.memory();
+}
+
+long Project::lastId(uint32_t path, long contentId) {
+    std::vector<std::pair<long, long>> & versions = lastIds_[path];
+    // the most recently used are at the end
+    for (auto i = versions.rbegin(), e = versions.rend(); i != e; ++i) {
+        if (i->first == contentId) {
+            long result = i->second;
+            std::rotate(i.base() - 1, i.base(), versions.end());
+            return result;
+        }
+    }
+    return -1;
+}
+
+void Project::setLastId(uint32_t path, long contentId, long id) {
+    std::vector<std::pair<long, long>> & versions = lastIds_[path];
+    size_t before = versions.capacity();
+    auto i = std::find_if(versions.begin(), versions.end(), [contentId](std::pair<long, long> const & v) { return v.first == contentId; });
+    if (i != versions.end())
+        versions.erase(i);
+    else if (versions.size() == MaxPathVersions)
+        versions.erase(versions.begin());
+    versions.emplace_back(contentId, id);
+    versions_ += versions.capacity() - before;
+}
+
+void Project::checkMemory() {
+    if (commitRows_.rows() >= MaxTableRows)
+        spillRows(Downloader::commitsTable_.get(), commitRows_);
+    size_t current = memory();
+    if (current > peakMemory_)
+        peakMemory_ = current;
+    if (Settings::Downloader::ProjectMemoryBudget > 0 and current > Settings::Downloader::ProjectMemoryBudget)
+        throw std::runtime_error(STR("Project " << id_ << " takes " << Bytes(current) << ", over the memory budget of " << Bytes(Settings::Downloader::ProjectMemoryBudget) << " after " << commits_.size() << " commits"));
+}
+
+void Project::spillRows(Table::Writer * table, Table::RowGroup & rows) {
+    if (table != nullptr) {
+        std::string data = rows.encode();
+        std::ofstream f = CheckedOpen(fileSpill(table), true);
+        f.write(data.data(), data.size());
+        if (not f.good())
+            throw std::ios_base::failure(STR("Unable to write to " << fileSpill(table)));
+    }
+    rows.clear();
+}
+
+void Project::removeSpills() {
+    for (Table::Writer * table : { Downloader::commitsTable_.get(), Downloader::snapshotsTable_.get() })
+        if (table != nullptr)
+            std::remove(fileSpill(table).c_str());
+}
+
+void Project::writeRows(Table::Writer * table, Table::RowGroup & rows) {
+    if (table != nullptr) {
+        std::string spill = fileSpill(table);
+        if (isFile(spill)) {
+            std::ifstream f = CheckedRead(spill);
+            table->append(id_, f);
+            f.close();
+            std::remove(spill.c_str());
         }
+        table->write(id_, rows);
     }
+    rows.clear();
 }
 
-void Project::analyzeCommit(PatternList const & filter, Commit const & c, std::string const & parent, std::ostream & fSnapshots) {
-    bool checked = false;
-    for (auto obj : Git::GetObjects(repoPath_, c.commit, parent)) {
+void Project::analyzeCommit(PatternList const & filter, uint32_t commit, std::string const & parent, std::ostream & fSnapshots) {
+    analyzeObjects(filter, commit, Git::GetObjects(repoPath_, STR(commits_[commit].commit), parent), fSnapshots);
+}
+
+void Project::analyzeObjects(PatternList const & filter, uint32_t commit, std::vector<Git::Object> const & objects, std::ostream & fSnapshots) {
+    SHA1 const & commitHash = commits_[commit].commit;
+    for (auto const & obj : objects) {
         // check if it is a language file
-        if (not filter.check(obj.relPath, hasDeniedFiles_))
+        uint32_t path = internPath(obj.relPath);
+        if (not checkPath(filter, path, hasDeniedFiles_))
             continue;
-        Snapshot s(snapshots_.size(), obj.relPath, c);
-        // set the parent id if we have one, keep -1 if not
-        auto i = lastIds_.find(s.relPath);
-        if (i != lastIds_.end())
-            s.parentId = i->second;
+        Snapshot s(nextSnapshotId_++, path, commit);
         if (obj.type == Git::Object::Type::Deleted) {
             s.contentId = -1;
-            lastIds_[s.relPath] = -1;
         } else {
-            if (not checked) {
-                Git::Checkout(repoPath_, c.commit);
-                checked = true;
-            }
-            s.contentId = Downloader::AssignContentId(SHA1(obj.hash), obj.relPath, repoPath_);
-            lastIds_[s.relPath] = s.id;
+            // the blob is read straight from the object database only if we have not seen it yet, no need to checkout the commit, the previous version is only read if the contents are to be stored as a delta against it
+            std::string const & hash = obj.hash;
+            std::string const & oldHash = obj.oldHash;
+            s.contentId = Downloader::AssignContentId(SHA1(hash), [this, & hash] () {
+                return Git::GetBlob(repoPath_, hash);
+            }, Downloader::ContentCategory(obj.relPath), oldHash.empty() ? -1 : Downloader::GetContentId(SHA1(oldHash)), [this, & oldHash] () {
+                return Git::GetBlob(repoPath_, oldHash);
+            });
         }
-        snapshots_.push_back(s);
-        fSnapshots << s << std::endl;
+        // set the parent id if we have one, keep -1 if not, added files take the version with the same contents, such as the one merged in from another branch
+        long parentContent = obj.oldHash.empty() ? s.contentId : Downloader::GetContentId(SHA1(obj.oldHash));
+        s.parentId = lastId(path, parentContent);
+        if (s.contentId != -1)
+            setLastId(path, s.contentId, s.id);
+        s.write(fSnapshots, commitHash, obj.relPath);
+        fSnapshots << std::endl;
+        snapshotRows_ << id_;
+        s.write(snapshotRows_, commitHash, obj.relPath);
+        if (snapshotRows_.rows() >= MaxTableRows)
+            spillRows(Downloader::snapshotsTable_.get(), snapshotRows_);
         ++Downloader::snapshots_;
     }
 }
 
 Project::Project(std::string const & relativeUrl):
     id_(idCounter_++),
-    url_(relativeUrl) {
+    url_(relativeUrl),
+    hasDeniedFiles_(false),
+    stage_(Stage::Clone),
+    resumeTime_(0),
+    cloneTime_(0),
+    metadataTime_(0),
+    snapshotsTime_(0),
+    deleteTime_(0),
+    peakMemory_(0),
+    expectedCost_(NAN),
+    timeouts_(0),
+    attempts_(0),
+    branchRows_(Branch::Columns()),
+    commitRows_(Commit::Columns()),
+    snapshotRows_(Snapshot::Columns()),
+    versions_(0),
+    nextSnapshotId_(0) {
     path_ = STR(Settings::General::Target << "/projects" << IdToPath(id_, "projects_") << "/" << id_);
     repoPath_ = STR(path_ << "/repo");
 }
 
 Project::Project(std::string const & relativeUrl, long id):
     id_(id),
-    url_(relativeUrl) {
+    url_(relativeUrl),
+    hasDeniedFiles_(false),
+    stage_(Stage::Clone),
+    resumeTime_(0),
+    cloneTime_(0),
+    metadataTime_(0),
+    snapshotsTime_(0),
+    deleteTime_(0),
+    peakMemory_(0),
+    expectedCost_(NAN),
+    timeouts_(0),
+    attempts_(0),
+    branchRows_(Branch::Columns()),
+    commitRows_(Commit::Columns()),
+    snapshotRows_(Snapshot::Columns()),
+    versions_(0),
+    nextSnapshotId_(0) {
     ++id;
     while (idCounter_ < id) {
         long old = idCounter_;
@@ -142,21 +476,47 @@ std::ofstream Downloader::failedProjectsFile_;
 
 std::ofstream Downloader::contentHashesFile_;
 
-std::unordered_map<SHA1,long> Downloader::contentHashes_;
+std::unique_ptr<Table::Writer> Downloader::projectsTable_;
+std::unique_ptr<Table::Writer> Downloader::branchesTable_;
+std::unique_ptr<Table::Writer> Downloader::commitsTable_;
+std::unique_ptr<Table::Writer> Downloader::snapshotsTable_;
+
+ContentIndex Downloader::contentHashes_;
+
+ContentStore Downloader::contents_;
+
+std::unordered_map<std::string, std::unique_ptr<ContentStore>> Downloader::folders_;
+std::mutex Downloader::foldersGuard_;
 
-std::mutex Downloader::contentGuard_;
 std::mutex Downloader::failedProjectsGuard_;
 std::mutex Downloader::contentFileGuard_;
+std::mutex Downloader::compactionGuard_;
 
 PatternList Downloader::language_;
 
 std::atomic<long> Downloader::bytes_(0);
-std::atomic<int> Downloader::compressors_(0);
+
+Downloader::Pool Downloader::stagePools_[Downloader::NumStages];
+std::atomic<uint64_t> Downloader::stageMicros_[Downloader::NumStages];
+std::atomic<unsigned long> Downloader::finishedProjects_(0);
+CostQueue<Downloader::PendingProject> Downloader::pending_;
+std::vector<Project> Downloader::timeoutLane_;
+std::multimap<std::chrono::steady_clock::time_point, Project> Downloader::retries_;
+std::mutex Downloader::retriesGuard_;
+std::unordered_map<std::string, unsigned> Downloader::previousAttempts_;
+std::unordered_set<std::string> Downloader::deadProjects_;
+std::ofstream Downloader::deadProjectsFile_;
+std::atomic<bool> Downloader::retrying_(false);
 
 
 // Downloader -------------------------------------------------------------------------------------
 
 void Downloader::Initialize() {
+    // the fork server must be started while our heap is still small, i.e. before the content hashes are loaded
+    if (Settings::Downloader::ForkServer)
+        ForkServer::Start();
+    // writing to a coprocess that died must not kill us, the write error is handled instead
+    signal(SIGPIPE, SIG_IGN);
     // fill in the language filter object
     for (auto i : Settings::Downloader::AllowPrefix)
         language_.allowPrefix(i);
@@ -170,35 +530,342 @@ void Downloader::Initialize() {
         language_.denySuffix(i);
     for (auto i : Settings::Downloader::DenyContents)
         language_.deny(i);
-
+    if (Settings::Downloader::ContentBloomFilterBits > 0)
+        contentHashes_.enableBloomFilter(Settings::Downloader::ContentBloomFilterBits);
+    Compressor::Start(Settings::Downloader::CompressInExtraThread ? Settings::Downloader::MaxCompressorThreads : 0, Settings::Downloader::CompressionQueueSize);
 }
 
 void Downloader::LoadPreviousRun() {
+    // dead projects stay dead in all runs
+    std::string dead = STR(Settings::General::Target << "/dead_projects.csv");
+    if (Settings::Downloader::SkipDeadProjects and isFile(dead)) {
+        CSVParser p(dead);
+        for (auto x : p)
+            if (not x.empty())
+                deadProjects_.insert(x[0]);
+        std::cout << "Skipping " << deadProjects_.size() << " dead projects" << std::endl;
+    }
     // load the file contents
     if (not Settings::General::Incremental)
         return;
     std::string content_hashes = STR(Settings::General::Target << "/content_hashes.csv");
     std::cout << "Loading content hashes from previous runs" << std::flush;
-
-    CSVParser p(content_hashes);
-    for (auto i : p) {
-        SHA1 hash(i[0]);
-        long id = std::stol(i[1]);
-        contentHashes_.insert(std::make_pair(hash, id));
-        if (contentHashes_.size() % 10000000 == 0)
+    // the index file maps the hashes in the beginning of the csv, only those appended after it was written have to be parsed
+    uint64_t covered = contentHashes_.open(STR(Settings::General::Target << "/content_hashes.idx"));
+    if (covered > fileSize(content_hashes))
+        throw std::ios_base::failure(STR("Content index covers more than " << content_hashes << ", delete the index to rebuild it"));
+    std::cout << std::endl << "    " << contentHashes_.size() << " ids mapped from index" << std::flush;
+    std::ifstream f(content_hashes);
+    f.seekg(covered);
+    std::string line;
+    size_t parsed = 0;
+    while (std::getline(f, line)) {
+        size_t comma = line.find(',');
+        if (comma == std::string::npos)
+            continue;
+        SHA1 hash(line.substr(0, comma));
+        long id = std::stol(line.substr(comma + 1));
+        contentHashes_.insert(hash, id);
+        if (++parsed % 10000000 == 0)
             std::cout << "." << std::flush;
     }
-    std::cout << std::endl << "    " << contentHashes_.size() << " ids loaded" << std::endl;
+    std::cout << std::endl << "    " << parsed << " ids loaded" << std::endl;
+    // attempts of failed projects accumulate over the runs, the last line of a project has its total
+    std::string failed = STR(Settings::General::Target << "/failed_projects.csv");
+    if (isFile(failed)) {
+        CSVParser p(failed);
+        for (auto x : p) {
+            if (x.size() < 2)
+                continue;
+            try {
+                previousAttempts_[x[0]] = x.size() >= 4 ? std::stoul(x[3]) : 1;
+            } catch (...) {
+                // ignore malformed lines
+            }
+        }
+    }
 }
 
 void Downloader::OpenOutputFiles() {
     // open the streams
-    // TODO should the failed projects be suffixed with run id?
-    failedProjectsFile_ = CheckedOpen(STR(Settings::General::Target << "/failed_projects.csv"));
+    // failed projects are appended to in incremental runs, so that their attempts add up
+    failedProjectsFile_ = CheckedOpen(STR(Settings::General::Target << "/failed_projects.csv"), Settings::General::Incremental);
+    deadProjectsFile_ = CheckedOpen(STR(Settings::General::Target << "/dead_projects.csv"), true);
     contentHashesFile_ = CheckedOpen(STR(Settings::General::Target << "/content_hashes.csv"), Settings::General::Incremental);
+    // the index of a previous run would map the hashes of the truncated csv
+    if (not Settings::General::Incremental)
+        deletePath(STR(Settings::General::Target << "/content_hashes.idx"));
+    if (Settings::Downloader::ContentSegments) {
+        std::string contents = STR(Settings::General::Target << "/contents");
+        // content ids start from 0 again, so the old contents are useless
+        if (not Settings::General::Incremental)
+            deletePath(contents);
+        // segments left over by an interrupted run
+        for (unsigned s : contents_.open(contents, Settings::Downloader::SegmentSize, Settings::Downloader::SegmentBlockSize))
+            if (Settings::Downloader::CompressFileContents)
+                Compressor::Compress(CompressionJob(contents_, s));
+        contents_.setMaxDeltaDepth(Settings::Downloader::ContentDeltaDepth);
+        contents_.setDictionarySize(Settings::Downloader::ContentDictionarySize);
+    }
+    if (Settings::Downloader::TableShards > 0) {
+        std::string tables = STR(Settings::General::Target << "/tables");
+        // the tables of a previous run describe projects whose ids are now reused
+        if (not Settings::General::Incremental)
+            deletePath(tables);
+        unsigned shards = Settings::Downloader::TableShards;
+        projectsTable_.reset(new Table::Writer(tables, "projects", Project::Columns(), shards));
+        branchesTable_.reset(new Table::Writer(tables, "branches", Project::Branch::Columns(), shards));
+        commitsTable_.reset(new Table::Writer(tables, "commits", Project::Commit::Columns(), shards));
+        snapshotsTable_.reset(new Table::Writer(tables, "snapshots", Project::Snapshot::Columns(), shards));
+    }
+}
+
+void Downloader::Feed(Project p) {
+    if (IsDead(p))
+        return;
+    if (Settings::Downloader::Refresh or not isFile(p.fileLog()))
+        StagePool(Project::Stage::Clone).schedule(std::move(p));
+}
+
+void Downloader::Start() {
+    Watchdog::Start();
+    if (not Settings::Downloader::Pipeline) {
+        if (Settings::Downloader::CostOrder)
+            DefaultPool().setBlockingTaskQueueSize(Settings::General::NumThreads);
+        DefaultPool().spawn(Settings::General::NumThreads);
+        DefaultPool().run();
+        return;
+    }
+    unsigned threads[] = {
+        Settings::Downloader::CloneThreads,
+        Settings::Downloader::MetadataThreads,
+        Settings::General::NumThreads,
+        Settings::Downloader::WriteThreads,
+        Settings::Downloader::DeleteThreads,
+    };
+    for (unsigned i = 0; i < NumStages; ++i) {
+        if (threads[i] == 0)
+            throw std::runtime_error(STR("Each stage of the downloader pipeline needs at least one thread"));
+        // the other stages are bounded so that the clones do not get too far ahead, the clone only gets a project per thread when the input is ordered by cost
+        if (i > 0)
+            stagePools_[i].setBlockingTaskQueueSize(Settings::Downloader::StageQueueSize);
+        else if (Settings::Downloader::CostOrder)
+            stagePools_[i].setBlockingTaskQueueSize(threads[i]);
+        stagePools_[i].spawn(threads[i]);
+    }
+    for (Pool & pool : stagePools_)
+        pool.run();
+}
+
+void Downloader::Finish() {
+    while (true) {
+        if (not Settings::Downloader::Pipeline) {
+            DefaultPool().wait();
+        } else {
+            // once a stage is done, no more projects can come to the next one
+            for (Pool & pool : stagePools_)
+                pool.wait();
+        }
+        std::vector<Project> next;
+        {
+            std::unique_lock<std::mutex> g(retriesGuard_);
+            if (timeoutLane_.empty() and retries_.empty())
+                break;
+            retrying_ = true;
+            if (not retries_.empty()) {
+                // nothing else to do but wait for the earliest retry
+                auto when = retries_.begin()->first;
+                g.unlock();
+                std::this_thread::sleep_until(when);
+                g.lock();
+                auto now = std::chrono::steady_clock::now();
+                while (not retries_.empty() and retries_.begin()->first <= now) {
+                    next.push_back(std::move(retries_.begin()->second));
+                    retries_.erase(retries_.begin());
+                }
+            } else {
+                // projects that ran out of time go last, so that they do not hold up the others
+                next.swap(timeoutLane_);
+            }
+        }
+        Start();
+        for (Project & p : next)
+            StagePool(Project::Stage::Clone).schedule(std::move(p));
+        retrying_ = false;
+    }
+    Watchdog::Stop();
+}
+
+Downloader::Pool & Downloader::StagePool(Project::Stage stage) {
+    if (not Settings::Downloader::Pipeline)
+        return DefaultPool();
+    assert(stage != Project::Stage::Done);
+    return stagePools_[static_cast<unsigned>(stage)];
+}
+
+unsigned long Downloader::FailedProjects() {
+    if (not Settings::Downloader::Pipeline)
+        return DefaultPool().errorTasks();
+    unsigned long result = 0;
+    for (Pool & pool : stagePools_)
+        result += pool.errorTasks();
+    return result;
+}
+
+void Downloader::fail(Project & p, std::string const & reason, Failure::Kind kind) {
+    currentJob_ = 'E';
+    std::lock_guard<std::mutex> g(failedProjectsGuard_);
+    // attempts of previous runs count too
+    unsigned attempts = (previousAttempts_[p.gitUrl()] += p.attempts_ + 1);
+    failedProjectsFile_ << escape(p.gitUrl()) << "," << p.id_ << "," << escape(reason) << "," << attempts << std::endl;
+    if (kind == Failure::Kind::NotFound or (Settings::Downloader::DeadAfterAttempts > 0 and attempts >= Settings::Downloader::DeadAfterAttempts)) {
+        deadProjects_.insert(p.gitUrl());
+        deadProjectsFile_ << escape(p.gitUrl()) << "," << escape(Failure::Name(kind)) << "," << attempts << std::endl;
+    }
+    // the next run must not take the commits of the failed attempt as analyzed
+    try {
+        p.rollback();
+    } catch (...) {
+        // do nothing
+    }
+    try {
+        p.deleteRepo();
+    } catch (...) {
+        // do nothing
+    }
+    ++finishedProjects_;
+}
+
+bool Downloader::retry(Project & p, std::string const & reason, Failure::Kind kind) {
+    if (not Failure::IsRetryable(kind) or p.attempts_ >= Settings::Downloader::RetryAttempts)
+        return false;
+    double delay = (kind == Failure::Kind::RateLimited ? Settings::Downloader::RateLimitBackoff : Settings::Downloader::RetryBackoff) * std::pow(2, p.attempts_);
+    Error(STR(reason << ", " << Failure::Name(kind) << " failure, trying again in " << delay << "s"));
+    currentJob_ = 'E';
+    try {
+        p.deleteRepo();
+    } catch (...) {
+        // do nothing
+    }
+    Project again(p.url_, p.id_);
+    again.expectedCost_ = p.expectedCost_;
+    again.timeouts_ = p.timeouts_;
+    again.attempts_ = p.attempts_ + 1;
+    again.csvSizes_ = p.csvSizes_;
+    auto when = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<long>(delay * 1000));
+    std::lock_guard<std::mutex> g(retriesGuard_);
+    retries_.emplace(when, std::move(again));
+    return true;
+}
+
+void Downloader::ScheduleDueRetries() {
+    std::vector<Project> due;
+    {
+        std::lock_guard<std::mutex> g(retriesGuard_);
+        auto now = std::chrono::steady_clock::now();
+        while (not retries_.empty() and retries_.begin()->first <= now) {
+            due.push_back(std::move(retries_.begin()->second));
+            retries_.erase(retries_.begin());
+        }
+    }
+    // threads of the pool must not block on its own queue
+    for (Project & p : due)
+        StagePool(Project::Stage::Clone).schedule(std::move(p), false);
+}
+
+bool Downloader::IsDead(Project const & p) {
+    if (not Settings::Downloader::SkipDeadProjects)
+        return false;
+    std::lock_guard<std::mutex> g(failedProjectsGuard_);
+    return deadProjects_.find(p.gitUrl()) != deadProjects_.end();
+}
+
+void Downloader::runStage(Project & p) {
+    auto start = std::chrono::high_resolution_clock::now();
+    Timer t;
+    Project::Stage stage = p.stage_;
+    static char const * names[] = { "clone", "metadata", "snapshots", "write", "delete" };
+    double budgets[] = { Settings::Downloader::CloneTimeout, Settings::Downloader::MetadataTimeout, Settings::Downloader::SnapshotsTimeout, 0, 0 };
+    double seconds = budgets[static_cast<unsigned>(stage)] * std::pow(Settings::Downloader::TimeoutBudgetFactor, p.timeouts_);
+    Watchdog::Budget budget(seconds, STR(names[static_cast<unsigned>(stage)] << " of " << p.gitUrl()));
+    try {
+        switch (stage) {
+            case Project::Stage::Clone:
+                currentJob_ = 'I'; // initialize
+                p.initialize();
+                // a failed attempt may have appended to the csvs, drop that first
+                p.rollback();
+                // resume
+                // update the project according to the previous run
+                if (Settings::General::Incremental) {
+                    currentJob_ = 'R';
+                    p.loadPreviousRun();
+                }
+                p.resumeTime_ = t.seconds(true);
+                // clone
+                currentJob_ = 'C';
+                p.clone(not Settings::General::Incremental);
+                p.cloneTime_= t.seconds();
+                p.stage_ = Project::Stage::Metadata;
+                break;
+            case Project::Stage::Metadata:
+                currentJob_ = 'M';
+                p.loadMetadata();
+                p.metadataTime_ = t.seconds();
+                p.stage_ = Project::Stage::Snapshots;
+                break;
+            case Project::Stage::Snapshots:
+                // look into all branches and download all file snapshots
+                currentJob_ = 'S';
+                p.analyze(language_);
+                p.snapshotsTime_ = t.seconds();
+                pending_.measured(p.expectedCost_, p.cloneTime_ + p.metadataTime_ + p.snapshotsTime_);
+                p.stage_ = Project::Stage::Write;
+                break;
+            case Project::Stage::Write:
+                currentJob_ = 'W';
+                {
+                    // make sure we flush the actual files mapping before writing the project to be sure we always end up in consistent state
+                    contents_.flush();
+                    std::lock_guard<std::mutex> g(contentFileGuard_);
+                    contentHashesFile_.flush();
+                }
+                p.finalize();
+                p.stage_ = Settings::Downloader::KeepRepos ? Project::Stage::Done : Project::Stage::Delete;
+                break;
+            case Project::Stage::Delete:
+                currentJob_ = 'D';
+                p.deleteRepo();
+                p.deleteTime_ = t.seconds();
+                p.stage_ = Project::Stage::Done;
+                break;
+            default:
+                assert(false && "Project already went through all stages");
+        }
+    } catch (...) {
+        // whatever failed, it was because the watchdog killed it
+        if (budget.expired())
+            throw budget.error();
+        throw;
+    }
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    stageMicros_[static_cast<unsigned>(stage)] += micros;
 }
 
 void Downloader::FeedFrom(std::string const & filename) {
+    // only refreshed projects have logs of previous runs to tell their costs, others are downloaded in the order of the file as soon as they are read
+    bool costOrder = Settings::Downloader::CostOrder and Settings::Downloader::Refresh;
+    auto feed = [costOrder](Project p) {
+        if (not costOrder)
+            return Feed(std::move(p));
+        if (IsDead(p))
+            return;
+        double cost = PreviousCost(p);
+        pending_.push(PendingProject{p.url_, p.id_, cost}, cost);
+        // the threads do not wait for the whole file, whenever the clone stage has room it gets the most expensive project read so far
+        if (StagePool(Project::Stage::Clone).hasRoom())
+            SchedulePending();
+    };
     CSVParser p(filename);
     long line = 1;
     long i = 0;
@@ -213,16 +880,12 @@ void Downloader::FeedFrom(std::string const & filename) {
             break;
         ++i;
         if (x.size() == 1) {
-            Project p(x[0]);
-            if (not isFile(p.fileLog()))
-                Schedule(p);
+            feed(Project(x[0]));
             continue;
-        } else if (x.size() == 2) {
+        } else if (x.size() >= 2 and x.size() <= 4) {
+            // the failed projects file with its reasons and attempts can be used as input too
             try {
-                char ** c;
-                Project p(x[0], std::strtol(x[1].c_str(), c, 10));
-                if (not isFile(p.fileLog()))
-                    Schedule(p);
+                feed(Project(x[0], std::stol(x[1])));
                 continue;
             } catch (...) {
                 // the code below outputs the error too
@@ -230,86 +893,151 @@ void Downloader::FeedFrom(std::string const & filename) {
         }
         Error(STR(filename << ", line " << line << ": Invalid format of the project url input, skipping."));
     }
+    // the pool only has room for a project per thread, so each one is picked when a thread is about to need it
+    while (not pending_.empty())
+        SchedulePending();
+}
+
+void Downloader::SchedulePending() {
+    PendingProject next = pending_.pop();
+    Project p(next.url, next.id);
+    p.expectedCost_ = next.expectedCost;
+    StagePool(Project::Stage::Clone).schedule(std::move(p));
+}
+
+double Downloader::PreviousCost(Project const & p) {
+    if (not isFile(p.fileLog()))
+        return NAN;
+    double result = NAN;
+    CSVParser log(p.fileLog());
+    // incremental runs append to the log, the last line is the latest run
+    for (auto x : log) {
+        if (x.size() < 7)
+            continue;
+        try {
+            result = std::stod(x[4]) + std::stod(x[5]) + std::stod(x[6]);
+        } catch (...) {
+            // ignore malformed lines
+        }
+    }
+    return result;
 }
 
 void Downloader::Finalize() {
     failedProjectsFile_.close();
+    deadProjectsFile_.close();
+    long last = contents_.close();
+    if (last != -1 and Settings::Downloader::CompressFileContents)
+        Compressor::Compress(CompressionJob(contents_, last));
     contentHashesFile_.close();
+    for (Table::Writer * t : { projectsTable_.get(), branchesTable_.get(), commitsTable_.get(), snapshotsTable_.get() })
+        if (t != nullptr)
+            t->flush();
+    {
+        std::lock_guard<std::mutex> g(compactionGuard_);
+        std::string content_hashes = STR(Settings::General::Target << "/content_hashes.csv");
+        contentHashes_.compact(STR(Settings::General::Target << "/content_hashes.idx"), fileSize(content_hashes));
+    }
     std::ofstream stamp = CheckedOpen(STR(Settings::General::Target << "/runs_downloader.csv"), Settings::General::Incremental);
     stamp << Timer::SecondsSinceEpoch() << ","
           << Project::idCounter_ << ","
-          << ErrorTasks() << ","
+          << FailedProjects() << ","
           << contentHashes_.size() << ","
           << snapshots_ << ","
-          << TotalTime() << std::endl;
-    // a silly busy wait
-    while (compressors_ > 0) {
-    }
+          << StagePool(Project::Stage::Clone).totalTime() << std::endl;
+    Compressor::Finish();
 }
 
 
 ProgressReporter::Feeder Downloader::GetReporterFeeder() {
     return [](ProgressReporter & p, std::ostream & s) {
-        p.done = CompletedTasks();
-        p.errors = ErrorTasks();
-        if (AllDone())
+        p.done = finishedProjects_;
+        p.errors = FailedProjects();
+        std::vector<Pool *> pools;
+        if (Settings::Downloader::Pipeline)
+            for (Pool & pool : stagePools_)
+                pools.push_back(& pool);
+        else
+            pools.push_back(& DefaultPool());
+        bool laneEmpty;
+        {
+            std::lock_guard<std::mutex> g(retriesGuard_);
+            laneEmpty = timeoutLane_.empty() and retries_.empty();
+        }
+        if (laneEmpty and not retrying_ and std::all_of(pools.begin(), pools.end(), [](Pool * pool) { return pool->allDone(); }))
             p.allDone = true;
         int i = 0;
         int j = 0;
-        for (Downloader * d : threads_) {
-            if (d != nullptr) {
-                s << "[" << std::right << std::setw(2) << i << "]" << std::left << std::setw(16) << d->status() << " ";
-                if (++j == 4) {
-                    j = 0;
-                    s << std::endl;
+        for (Pool * pool : pools) {
+            for (Downloader * d : pool->threads()) {
+                if (d != nullptr) {
+                    s << "[" << std::right << std::setw(2) << i << "]" << std::left << std::setw(16) << d->status() << " ";
+                    if (++j == 4) {
+                        j = 0;
+                        s << std::endl;
+                    }
                 }
+                ++i;
             }
-            ++i;
         }
         if (j != 0)
             s << std::endl;
+        ReportStages(s, pools);
         s << "total bytes: " << std::setw(10) << std::left << Bytes(bytes_);
         s << "unique files: " << std::setw(16) << std::left << contentHashes_.size();
-        s << "snapshots: " << std::setw(16) << std::left << snapshots_;
-        s << "active compressors " << compressors_ << std::endl;
+        s << "snapshots: " << std::setw(16) << std::left << snapshots_ << std::endl;
+        Compressor::Report(s);
     };
 }
 
+void Downloader::ReportStages(std::ostream & s, std::vector<Pool *> const & pools) {
+    // only the reporter thread calls this
+    static uint64_t lastMicros[NumStages] = {};
+    static auto lastTime = std::chrono::high_resolution_clock::now();
+    auto now = std::chrono::high_resolution_clock::now();
+    double micros = std::chrono::duration_cast<std::chrono::microseconds>(now - lastTime).count();
+    lastTime = now;
+    s << "stages";
+    for (unsigned i = 0; i < NumStages; ++i) {
+        Pool & pool = * pools[pools.size() == 1 ? 0 : i];
+        size_t threads = pool.threads().size();
+        uint64_t busy = stageMicros_[i];
+        double utilization = (micros > 0 and threads > 0) ? (busy - lastMicros[i]) / micros / threads * 100 : 0;
+        lastMicros[i] = busy;
+        s << "  " << "CMSWD"[i] << " " << threads << "t " << std::fixed << std::setprecision(0) << std::setw(3) << std::right << utilization << "%" << std::defaultfloat << std::left;
+        if (pools.size() > 1)
+            s << " q " << pool.queueSize();
+    }
+    s << std::endl;
+}
+
 long Downloader::AssignContentId(SHA1 const & hash, std::string const & relPath, std::string const & root) {
-    long id;
-    {
-        std::lock_guard<std::mutex> g(contentGuard_);
-        auto i = contentHashes_.find(hash);
-        if (i != contentHashes_.end())
-            return i->second;
-        id = contentHashes_.size();
-        contentHashes_.insert(std::make_pair(hash, id));
-    }
-    std::string contents = LoadEntireFile(STR(root << "/" << relPath));
+    return AssignContentId(hash, [& relPath, & root] () {
+        return LoadEntireFile(STR(root << "/" << relPath));
+    }, ContentCategory(relPath), -1, nullptr);
+}
+
+long Downloader::AssignContentId(SHA1 const & hash, std::function<std::string()> const & loader) {
+    return AssignContentId(hash, loader, 0, -1, nullptr);
+}
+
+long Downloader::AssignContentId(SHA1 const & hash, std::function<std::string()> const & loader, uint8_t category, long baseId, std::function<std::string()> const & baseLoader) {
+    bool created;
+    long id = contentHashes_.assign(hash, created);
+    if (not created)
+        return id;
+    std::string contents = loader();
     bytes_ += contents.size();
     // we have a new hash now, the file contents must be stored and the contents hash file appended
-    std::string targetDir = STR(Settings::General::Target << "/files" << IdToPath(id, "files_"));
-    createPathIfMissing(targetDir);
-    {
-        std::ofstream f = CheckedOpen(STR(targetDir << "/" << id << ".raw"));
-        f << contents;
-    }
+    StoreContents(id, contents, category, baseId, baseLoader);
     // output the mapping
     {
         std::lock_guard<std::mutex> g(contentFileGuard_);
         contentHashesFile_ << hash << "," << id << std::endl;
+        contentHashes_.persisted(hash);
     }
-    // compress the folder if it is full
-    if (Settings::Downloader::CompressFileContents and IdPathFull(id)) {
-        if (Settings::Downloader::CompressInExtraThread and compressors_ < Settings::Downloader::MaxCompressorThreads) {
-            std::thread t([targetDir] () {
-                CompressFiles(targetDir);
-            });
-            t.detach();
-        } else {
-            CompressFiles(targetDir);
-        }
-    }
+    if (Settings::Downloader::ContentIndexCompaction > 0 and contentHashes_.added() >= Settings::Downloader::ContentIndexCompaction)
+        CompactContentHashes();
     return id;
 }
 
@@ -318,56 +1046,110 @@ long Downloader::AssignContentId(SHA1 const & hash, std::string const & relPath,
 
 
 
+void Downloader::CompactContentHashes() {
+    std::unique_lock<std::mutex> c(compactionGuard_, std::try_to_lock);
+    if (not c.owns_lock())
+        return;
+    std::string content_hashes = STR(Settings::General::Target << "/content_hashes.csv");
+    // hashes are persisted in the index while their line is written under the same lock, so every hash in the csv up to its current size will be in the index, while hashes whose contents are still being stored are left out
+    uint64_t covered;
+    {
+        std::lock_guard<std::mutex> g(contentFileGuard_);
+        contentHashesFile_.flush();
+        covered = fileSize(content_hashes);
+    }
+    contentHashes_.compact(STR(Settings::General::Target << "/content_hashes.idx"), covered);
+}
+
+uint8_t Downloader::ContentCategory(std::string const & relPath) {
+    std::vector<std::string> const & suffixes = Settings::Downloader::AllowSuffix;
+    for (size_t i = 0; i < suffixes.size() and i < 255; ++i)
+        if (relPath.size() >= suffixes[i].size() and relPath.compare(relPath.size() - suffixes[i].size(), suffixes[i].size(), suffixes[i]) == 0)
+            return i + 1;
+    return 0;
+}
+
+bool Downloader::HasContentId(SHA1 const & hash) {
+    return contentHashes_.find(hash) != -1;
+}
+
+long Downloader::GetContentId(SHA1 const & hash) {
+    return contentHashes_.find(hash);
+}
+
 long Downloader::AssignContentsId(std::string const & contents) {
     bytes_ += contents.size();
     SHA1 h;
     //Hash h = Hash::Calculate(contents);
-    long id;
-    {
-        std::lock_guard<std::mutex> g(contentGuard_);
-        auto i = contentHashes_.find(h);
-        if (i != contentHashes_.end())
-            return i->second;
-        id = contentHashes_.size();
-        contentHashes_.insert(std::make_pair(h, id));
-    }
+    bool created;
+    long id = contentHashes_.assign(h, created);
+    if (not created)
+        return id;
     // we have a new hash now, the file contents must be stored and the contents hash file appended
-    std::string targetDir = STR(Settings::General::Target << "/files" << IdToPath(id, "files_"));
-    createPathIfMissing(targetDir);
-    {
-        std::ofstream f = CheckedOpen(STR(targetDir << "/" << id << ".raw"));
-        f << contents;
-    }
+    StoreContents(id, contents);
     // output the mapping
     {
         std::lock_guard<std::mutex> g(contentFileGuard_);
         contentHashesFile_ << h << "," << id << std::endl;
+        contentHashes_.persisted(h);
     }
-    // compress the folder if it is full
-    if (Settings::Downloader::CompressFileContents and IdPathFull(id)) {
-        if (Settings::Downloader::CompressInExtraThread and compressors_ < Settings::Downloader::MaxCompressorThreads) {
-            std::thread t([targetDir] () {
-                CompressFiles(targetDir);
-            });
-            t.detach();
-        } else {
-            CompressFiles(targetDir);
+    return id;
+}
+
+std::string Downloader::ReadContents(long id) {
+    if (Settings::Downloader::ContentSegments) {
+        // tools reading the contents after the download do not open the output files
+        static std::once_flag opened;
+        std::call_once(opened, [] () {
+            if (contents_.path().empty())
+                contents_.open(STR(Settings::General::Target << "/contents"), Settings::Downloader::SegmentSize, Settings::Downloader::SegmentBlockSize);
+        });
+        // contents downloaded by incremental runs before the segments were enabled are still in the files folder
+        if (contents_.contains(id))
+            return contents_.read(id);
+    }
+    std::string folder = STR(Settings::General::Target << "/files" << IdToPath(id, "files_"));
+    std::string raw = STR(folder << "/" << id << ".raw");
+    if (isFile(raw))
+        return LoadEntireFile(raw);
+    // folders archived by earlier runs, only the single member is extracted
+    if (isFile(STR(folder << "/files.tar.xz"))) {
+        Process::Result r = Process({ "tar", "xJOf", "files.tar.xz", STR(id << ".raw") }, folder).run();
+        if (not r.success())
+            throw std::ios_base::failure(STR("Unable to extract content " << id << " from " << folder << "/files.tar.xz: " << r.err));
+        return r.out;
+    }
+    ContentStore * store;
+    {
+        std::lock_guard<std::mutex> g(foldersGuard_);
+        std::unique_ptr<ContentStore> & s = folders_[folder];
+        if (s == nullptr) {
+            s.reset(new ContentStore());
+            s->open(folder, Settings::Downloader::SegmentSize, Settings::Downloader::SegmentBlockSize);
         }
+        store = s.get();
     }
-    return id;
+    return store->read(id);
 }
 
-void Downloader::CompressFiles(std::string const & targetDir) {
-    try {
-        ++compressors_;
-        bool ok = true;
-        ok = exec("tar cfJ files.tar.xz *.raw", targetDir);
-        ok = exec("rm -f *.raw", targetDir);
-        if (not ok)
-            std::cerr << "Unable to compress files in " << targetDir << std::endl;
-    } catch (...) {
+void Downloader::StoreContents(long id, std::string const & contents, uint8_t category, long baseId, std::function<std::string()> const & baseLoader) {
+    if (Settings::Downloader::ContentSegments) {
+        long full = baseId == -1 ? contents_.append(id, contents, category) : contents_.append(id, contents, category, baseId, baseLoader);
+        // the contents must be in the segment before the hash is written to the csv, like the raw files are, or a killed run would leave ids without contents that later runs never store again
+        contents_.flush();
+        if (full != -1 and Settings::Downloader::CompressFileContents)
+            Compressor::Compress(CompressionJob(contents_, full));
+        return;
     }
-    --compressors_;
+    std::string targetDir = STR(Settings::General::Target << "/files" << IdToPath(id, "files_"));
+    createPathIfMissing(targetDir);
+    {
+        std::ofstream f = CheckedOpen(STR(targetDir << "/" << id << ".raw"));
+        f << contents;
+    }
+    // compress the folder if it is full
+    if (Settings::Downloader::CompressFileContents and IdPathFull(id))
+        Compressor::Compress(CompressionJob(targetDir));
 }
 
 
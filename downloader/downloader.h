@@ -4,6 +4,8 @@
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <map>
+#include <functional>
 
 #include "include/utils.h"
 #include "include/worker.h"
@@ -11,10 +13,17 @@
 #include "include/filesystem.h"
 #include "include/pattern_lists.h"
 #include "include/hash.h"
+#include "include/contentindex.h"
+#include "include/contentstore.h"
+#include "include/pathpool.h"
+#include "include/table.h"
+#include "include/costqueue.h"
+#include "include/watchdog.h"
 
 #include "ght/settings.h"
 
 #include "git.h"
+#include "failure.h"
 
 //namespace xx  {
 
@@ -55,10 +64,10 @@ public:
         std::string name;
 
         /** First commit made to the branch. */
-        std::string firstCommit;
+        SHA1 firstCommit;
 
 
-        Branch(std::string name, std::string firstCommit):
+        Branch(std::string name, SHA1 const & firstCommit):
             name(name),
             firstCommit(firstCommit) {
         }
@@ -69,7 +78,7 @@ public:
 
         struct Hash {
             std::size_t operator()(Branch const & x) const {
-                return std::hash<std::string>()(x.name) + std::hash<std::string>()(x.firstCommit);
+                return std::hash<std::string>()(x.name) + std::hash<SHA1>()(x.firstCommit);
             }
         };
 
@@ -79,13 +88,23 @@ public:
             return s;
         }
 
+        /** Columns of the branches table, the project id followed by the columns of the csv.
+         */
+        static Table::Schema Columns() {
+            return { { "project", Table::Type::Int64 }, { "name", Table::Type::String }, { "firstCommit", Table::Type::Hash } };
+        }
+
+        friend Table::RowGroup & operator << (Table::RowGroup & rows, Branch const & b) {
+            return rows << b.name << b.firstCommit;
+        }
+
     };
 
 
     class Commit {
     public:
         /** Commit's hash. */
-        std::string commit;
+        SHA1 commit;
         /** Time of the commit */
         int time;
 
@@ -98,18 +117,63 @@ public:
             return commit == other.commit;
         }
 
-        struct Hash {
-            std::size_t operator()(Commit const & x) const {
-                return std::hash<std::string>()(x.commit);
-            }
-        };
-
         friend std::ostream & operator << (std::ostream & s, Commit const & c) {
             s << c.commit << ","
               << c.time;
             return s;
         }
 
+        static Table::Schema Columns() {
+            return { { "project", Table::Type::Int64 }, { "commit", Table::Type::Hash }, { "time", Table::Type::Int32 } };
+        }
+
+        friend Table::RowGroup & operator << (Table::RowGroup & rows, Commit const & c) {
+            return rows << c.commit << c.time;
+        }
+
+    };
+
+
+    /** Commits of a project, each with a dense index in the order the commits were added.
+
+      The commits are stored in a vector and looked up by an open addressing table of their indices with linear probing, so that a commit takes its 24 bytes and a few bytes of the table, instead of a node of std::unordered_set holding a heap allocated string.
+     */
+    class CommitSet {
+    public:
+        static uint32_t const NotFound = 0xffffffff;
+
+        /** Adds the commit unless a commit with the same hash is already present. Returns the index of the commit and whether it was added.
+         */
+        std::pair<uint32_t, bool> insert(Commit const & c);
+
+        /** Returns the index of the commit with given hash, or NotFound.
+         */
+        uint32_t find(SHA1 const & hash) const;
+
+        Commit const & operator [] (uint32_t index) const {
+            return commits_[index];
+        }
+
+        size_t size() const {
+            return commits_.size();
+        }
+
+        /** Bytes taken by the commits and the table.
+         */
+        size_t memory() const {
+            return commits_.capacity() * sizeof(Commit) + slots_.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+
+        /** Doubles the table and reinserts all commits.
+         */
+        void grow();
+
+        std::vector<Commit> commits_;
+        /** Index of the commit plus one for each slot, 0 for empty slots. The size is a power of two.
+         */
+        std::vector<uint32_t> slots_;
     };
 
 
@@ -121,42 +185,54 @@ public:
         long contentId;
         /** Id of the parent for this snapshot, not tracking name changes. */
         long parentId;
-        /** Commit hash */
-        std::string commit;
-        /** Relative path */
-        std::string relPath;
+        /** Index of the commit in the commits of the project. */
+        uint32_t commit;
+        /** Id of the relative path in the paths of the project. */
+        uint32_t path;
 
 
-        Snapshot(long id, std::string relPath, Commit const & c):
+        Snapshot(long id, uint32_t path, uint32_t commit):
             id(id),
             contentId(-1),
             parentId(-1),
-            commit(c.commit),
-            relPath(relPath) {
+            commit(commit),
+            path(path) {
 
         }
 
         bool operator == (Snapshot const & other) const {
-            return commit == other.commit and relPath == other.relPath;
+            return commit == other.commit and path == other.path;
         }
 
         struct Hash {
             std::size_t operator()(Snapshot const & x) const {
-                return std::hash<std::string>()(x.commit) + std::hash<std::string>()(x.relPath);
+                return std::hash<uint32_t>()(x.commit) * 31 + std::hash<uint32_t>()(x.path);
             }
         };
 
-        friend std::ostream & operator << (std::ostream & s, Snapshot const & x) {
-            s << x.id << ","
-              << x.contentId << ","
-              << x.parentId << ","
-              << x.commit << ","
-              << escape(x.relPath);
-            return s;
+        /** Writes the snapshot as a csv row. The snapshot only knows the index of its commit and the id of its path, so the hash of the commit and the path must be given.
+         */
+        void write(std::ostream & s, SHA1 const & commitHash, std::string const & relPath) const {
+            s << id << ","
+              << contentId << ","
+              << parentId << ","
+              << commitHash << ","
+              << escape(relPath);
+        }
+
+        static Table::Schema Columns() {
+            return { { "project", Table::Type::Int64 }, { "id", Table::Type::Int64 }, { "contentId", Table::Type::Int64 }, { "parentId", Table::Type::Int64 }, { "commit", Table::Type::Hash }, { "path", Table::Type::String } };
+        }
+
+        void write(Table::RowGroup & rows, SHA1 const & commitHash, std::string const & relPath) const {
+            rows << id << contentId << parentId << commitHash << relPath;
         }
     };
 
     std::string gitUrl() const {
+        // absolute urls, such as file:// urls of local mirrors, are used as they are
+        if (url_.find("://") != std::string::npos)
+            return url_;
         return STR("https://github.com/" << url_ << ".git");
     }
 
@@ -170,8 +246,16 @@ public:
 
     void initialize();
 
+    /** Loads the branches, commits and last snapshot ids from the output of the previous run, if any, so that only new commits are analyzed.
+     */
     void loadPreviousRun();
 
+    /** Truncates the branches, commits and snapshots csvs to their sizes before the analysis of a failed attempt appended to them, so that trying the project again does not load them as a previous run. The rows the attempt has spilled are deleted too.
+     */
+    void rollback();
+
+    /** Clones the project. If the repository already exists from previous run, it is only updated by a fetch, unless force is true.
+     */
     void clone(bool force = false);
 
     void loadMetadata();
@@ -204,6 +288,12 @@ public:
         return STR(path_ << "/snapshots.csv");
     }
 
+    /** Rows of given table spilled during the analysis, see spillRows().
+     */
+    std::string fileSpill(Table::Writer const * table) const {
+        return STR(path_ << "/" << table->name() << ".spill");
+    }
+
 private:
     friend class Downloader;
 
@@ -215,10 +305,32 @@ private:
           << p.cloneTime_ << ","
           << p.metadataTime_ << ","
           << p.snapshotsTime_ << ","
-          << p.deleteTime_;
+          << p.deleteTime_ << ","
+          << p.peakMemory_;
         return s;
     }
 
+    /** Columns of the projects table, the same as of the log.csv of the project.
+     */
+    static Table::Schema Columns() {
+        return { { "id", Table::Type::Int64 }, { "url", Table::Type::String }, { "hasDeniedFiles", Table::Type::Int32 }, { "resumeTime", Table::Type::Double }, { "cloneTime", Table::Type::Double }, { "metadataTime", Table::Type::Double }, { "snapshotsTime", Table::Type::Double }, { "deleteTime", Table::Type::Double }, { "peakMemory", Table::Type::Int64 } };
+    }
+
+    /** Stages of downloading a project, in the order the project goes through them, see Settings::Downloader::Pipeline.
+     */
+    enum class Stage : unsigned {
+        Clone,
+        Metadata,
+        Snapshots,
+        Write,
+        Delete,
+        Done,
+    };
+
+    friend Table::RowGroup & operator << (Table::RowGroup & rows, Project const & p) {
+        return rows << p.id_ << p.url_ << (p.hasDeniedFiles_ ? 1 : 0) << p.resumeTime_ << p.cloneTime_ << p.metadataTime_ << p.snapshotsTime_ << p.deleteTime_ << static_cast<long>(p.peakMemory_);
+    }
+
 
     /* TODO The thing is how to know last id's, we can traverse the existing snapshots
 
@@ -227,13 +339,93 @@ private:
       ! but how to store them?
       */
 
-    void analyzeCommit(PatternList const & filter, Commit const & c, std::string const & parent, std::ostream & fSnapshots);
+    /** Analyzes the commit of given index, diffing it against the given parent commit.
+     */
+    void analyzeCommit(PatternList const & filter, uint32_t commit, std::string const & parent, std::ostream & fSnapshots);
+
+    /** Analyzes each branch separately, diffing each commit against the previous one in git log order.
+     */
+    void analyzeBranches(PatternList const & filter, std::ostream & fBranches, std::ostream & fCommits, std::ostream & fSnapshots);
+
+    /** Analyzes all commits of all branches in a single history walk.
+
+      Unlike the per branch analysis, the commits are diffed against their first parents and are processed as they are read from git.
+     */
+    void analyzeHistory(PatternList const & filter, std::ostream & fBranches, std::ostream & fCommits, std::ostream & fSnapshots);
+
+    /** Fetches the blobs of all files that pass the filter into a blobless clone.
+
+      Blobs whose contents we already have from other projects are not fetched at all.
+     */
+    void fetchBlobs(PatternList const & filter);
+
+    enum class PathFilter : uint8_t {
+        Unchecked,
+        Allowed,
+        Ignored,
+        Denied,
+    };
+
+    /** Returns the id of given path in the paths of the project, adding it if it is new.
+     */
+    uint32_t internPath(std::string const & relPath);
+
+    /** Returns true if the path of given id passes the filter, setting denied to true if the path is denied.
+
+      A project is always analyzed with the same filter, so each path is checked only once and the result is remembered by its id.
+     */
+    bool checkPath(PatternList const & filter, uint32_t path, bool & denied);
+
+    /** Approximate number of bytes taken by what the analysis keeps for the whole project, i.e. the commits, branches, paths, the last snapshot ids and the rows not yet spilled.
+
+      Snapshots themselves are written as soon as they are created and are not kept.
+     */
+    size_t memory() const;
+
+    /** Updates the peak memory of the project and throws if it is over the budget, see Settings::Downloader::ProjectMemoryBudget. Called after each commit.
+     */
+    void checkMemory();
+
+    /** Appends the rows as a row group to the spill file of the table, if the tables are enabled, and clears them. The spilled rows are written to the table by finalize(), so that a project which fails leaves no rows in the tables.
+     */
+    void spillRows(Table::Writer * table, Table::RowGroup & rows);
+
+    /** Deletes the rows spilled by an analysis that did not finish.
+     */
+    void removeSpills();
+
+    /** Writes the spilled row groups and then the rows to the table, if the tables are enabled, and clears them.
+     */
+    void writeRows(Table::Writer * table, Table::RowGroup & rows);
+
+    /** Number of rows after which the rows of the project are spilled as a row group, so that they do not grow with the history.
+     */
+    static size_t const MaxTableRows = 65536;
+
+    /** Number of contents of each path whose latest snapshots are remembered as parents, see lastIds_. A version of the file older than that is only the parent in a branch that forked long ago and has not touched the file since, whose next snapshot of the file then has no parent.
+     */
+    static size_t const MaxPathVersions = 16;
+
+    /** Returns the latest snapshot of given path with given contents and marks the contents as recently used, or returns -1 if there is none.
+     */
+    long lastId(uint32_t path, long contentId);
+
+    /** Records given snapshot as the latest of given path with given contents, forgetting the least recently used contents of the path if it has too many, see MaxPathVersions.
+     */
+    void setLastId(uint32_t path, long contentId, long id);
+
+    /** Creates snapshots for the objects changed by the commit of given index.
+     */
+    void analyzeObjects(PatternList const & filter, uint32_t commit, std::vector<Git::Object> const & objects, std::ostream & fSnapshots);
 
 
     long id_;
     std::string url_;
     bool hasDeniedFiles_;
 
+    /** The stage the project goes through next. */
+    Stage stage_;
+
     bool shouldSkip_;
 
 
@@ -246,10 +438,53 @@ private:
     double snapshotsTime_;
     double deleteTime_;
 
+    /** Largest memory() seen during the analysis, reported in the log. */
+    size_t peakMemory_;
+
+    /** Seconds the clone and analysis are expected to take, NAN if unknown, see Settings::Downloader::CostOrder. */
+    double expectedCost_;
+
+    /** Number of times the project ran out of time, its budgets grow with each, see Settings::Downloader::TimeoutRetries. */
+    unsigned timeouts_;
+
+    /** Number of times the project failed in this run and was tried again, see Settings::Downloader::RetryAttempts. */
+    unsigned attempts_;
+
+    /** Sizes of the branches, commits and snapshots csvs when the analysis started, empty if it has not, see rollback(). */
+    std::vector<uint64_t> csvSizes_;
+
     std::unordered_set<Branch, Branch::Hash> branches_;
-    std::unordered_set<Commit, Commit::Hash> commits_;
-    std::vector<Snapshot> snapshots_;
-    std::unordered_map<std::string, long> lastIds_;
+    CommitSet commits_;
+    /** Paths of all files seen in the project, snapshots and last ids refer to them by their ids.
+     */
+    PathPool paths_;
+
+    /** Result of the filter for each path id, see checkPath().
+     */
+    std::vector<PathFilter> pathFilter_;
+
+    /** Rows of the branches, commits and snapshots found by this run, written to the global tables when the project is finalized, see Settings::Downloader::TableShards.
+     */
+    Table::RowGroup branchRows_;
+    Table::RowGroup commitRows_;
+    Table::RowGroup snapshotRows_;
+
+    /** Latest snapshot id for the most recently used content ids of each path, as content id and snapshot id pairs, the most recently used last, indexed by the path id.
+
+      The parent of a snapshot is the snapshot of the same path with the contents the file had in the commit's first parent. Keying by the contents as well as the path keeps the parents right even when the walk interleaves commits of different branches.
+     */
+    std::vector<std::vector<std::pair<long, long>>> lastIds_;
+
+    /** Total capacity of the vectors of lastIds_, for memory(). */
+    size_t versions_;
+
+    /** Id of the next snapshot, continues after the snapshots of previous runs.
+     */
+    long nextSnapshotId_;
+
+    /** Commits analyzed by the previous run which the new history walk does not have to go past.
+     */
+    std::vector<std::string> frontier_;
 
 
     static std::atomic<long> idCounter_;
@@ -278,19 +513,59 @@ public:
 
     /** Reads the given file, and schedules each project in it for the download.
 
-      The file should contain a git url per line.
+      The file should contain a git url per line. With Settings::Downloader::CostOrder, the whole file is read first and the projects are scheduled most expensive first, as the threads have room for them.
      */
     static void FeedFrom(std::string const & filename);
 
+    /** Schedules the project for the download, unless a previous run already downloaded it and Settings::Downloader::Refresh is off.
+     */
+    static void Feed(Project p);
+
+    /** Spawns and runs the threads, either a pool for each stage of the pipeline, or NumThreads threads each taking projects through all stages, see Settings::Downloader::Pipeline.
+     */
+    static void Start();
+
+    /** Blocks until all scheduled projects went through all stages and stops the threads. Projects that ran out of time and may be retried are then downloaded again, see Settings::Downloader::TimeoutRetries.
+     */
+    static void Finish();
+
     static void Finalize();
 
+    /** Reports the threads of each stage and how busy they were since the last report, and in the pipeline also the projects waiting for each stage.
+     */
     static ProgressReporter::Feeder GetReporterFeeder();
 
 
     static long AssignContentId(SHA1 const & hash, std::string const & relPath, std::string const & root);
 
+    /** Assigns content id to given hash. If the hash has not been seen yet, the contents are obtained from the loader and stored.
+     */
+    static long AssignContentId(SHA1 const & hash, std::function<std::string()> const & loader);
+
+    /** Assigns content id to given hash, whose contents are a new version of the contents with given base id. If the hash has not been seen yet, the contents may be stored as a delta against the base, whose contents are then obtained from the base loader, see Settings::Downloader::ContentDeltaDepth. The category selects the compression dictionary, see ContentCategory().
+     */
+    static long AssignContentId(SHA1 const & hash, std::function<std::string()> const & loader, uint8_t category, long baseId, std::function<std::string()> const & baseLoader);
+
+    /** Returns the category of contents of given file for the content store, which is 1 + the index of the first suffix in Settings::Downloader::AllowSuffix the file has, or 0 if none.
+     */
+    static uint8_t ContentCategory(std::string const & relPath);
+
     static long AssignContentsId(std::string const & contets);
 
+    /** Returns true if the given hash already has its content id, i.e. its contents have already been stored.
+     */
+    static bool HasContentId(SHA1 const & hash);
+
+    /** Returns the content id of the given hash, or -1 if the hash has not been seen yet.
+     */
+    static long GetContentId(SHA1 const & hash);
+
+    /** Returns the contents of given id stored by this or a previous run.
+
+      Reads from the content segments, or from the files folder of the id, where the contents are either a raw file, in the content store the folder was packed into, or in the files.tar.xz archive of folders compressed by earlier runs.
+     */
+    static std::string ReadContents(long id);
+
     std::string status() {
         if (currentJob_ == ' ')
             return "IDLE";
@@ -302,60 +577,110 @@ private:
 
     friend class Project;
 
-    static void CompressFiles(std::string const & targetDir);
+    /** Stores contents of a new content id, either in the content store, or as a file in the files folder.
+
+      If the base id is not -1, the content store may store the contents as a delta against the base.
+     */
+    static void StoreContents(long id, std::string const & contents, uint8_t category = 0, long baseId = -1, std::function<std::string()> const & baseLoader = nullptr);
+
+
+    /** Rewrites the content index file so that it contains all hashes assigned so far. Does nothing if another thread is already compacting.
+     */
+    static void CompactContentHashes();
+
+    static unsigned const NumStages = static_cast<unsigned>(Project::Stage::Done);
+
+    /** Returns the pool of given stage, or the default pool if the stages are not pipelined.
+     */
+    static Pool & StagePool(Project::Stage stage);
+
+    /** Returns the number of projects that failed in any stage.
+     */
+    static unsigned long FailedProjects();
+
+    /** Returns the seconds the clone and analysis of the project took in its last run according to its log, NAN if it has not been downloaded yet.
+     */
+    static double PreviousCost(Project const & p);
+
+    /** Schedules the most expensive of the pending projects, blocks while the clone stage is full.
+     */
+    static void SchedulePending();
+
+    /** Outputs a line with the threads, utilization since the last report and queue sizes of the stages of given pools, a single pool runs all stages.
+     */
+    static void ReportStages(std::ostream & s, std::vector<Pool *> const & pools);
+
+    /** Runs the stage the project is at and moves the project to the next one.
+
+      The stage runs with its time budget, if it runs out, Watchdog::Timeout is thrown.
+     */
+    void runStage(Project & p);
+
+    /** Records the project as failed for given reason of given kind and deletes what was downloaded. Projects that do not exist, or failed too many times, are added to the dead projects.
+     */
+    void fail(Project & p, std::string const & reason, Failure::Kind kind);
+
+    /** If the project failed for a reason of a kind that may go away, deletes what was downloaded and schedules it to be tried again after a delay, returning true. Returns false if the project should fail.
+     */
+    bool retry(Project & p, std::string const & reason, Failure::Kind kind);
+
+    /** Schedules the projects whose retry delays are over.
+
+      Must only be called from a thread of the clone stage, whose pool cannot stop while the thread runs. Retries due when no such thread runs are left to Finish().
+     */
+    static void ScheduleDueRetries();
+
+    /** Returns true if the project is known to be dead, see Settings::Downloader::SkipDeadProjects.
+     */
+    static bool IsDead(Project const & p);
 
     void run(Project & p) override {
+        // threads of the clone stage can also pick up the retries that are due, see ScheduleDueRetries()
+        if (p.stage_ == Project::Stage::Clone)
+            ScheduleDueRetries();
         try {
-            Timer t;
             currentProject_ = p.id_;
-            currentJob_ = 'I'; // initialize
-            p.initialize();
-            // resume
-            // update the project according to the previous run
-            if (Settings::General::Incremental) {
-                currentJob_ = 'R';
-                p.loadPreviousRun();
-            }
-            p.resumeTime_ = t.seconds(true);
-            // clone
-            currentJob_ = 'C';
-            p.clone(true);
-            p.cloneTime_= t.seconds(true);
-            // metadata
-            currentJob_ = 'M';
-            p.loadMetadata();
-            p.metadataTime_ = t.seconds(true);
-            // snapshots
-            // look into all branches and download all file snapshots
-            currentJob_ = 'S';
-            p.analyze(language_);
-            p.snapshotsTime_ = t.seconds(true);
-            // writeback
-            currentJob_ = 'W';
-            {
-                // make sure we flush the actual files mapping before writing the project to be sure we always end up in consistent state
-                std::lock_guard<std::mutex> g(contentFileGuard_);
-                contentHashesFile_.flush();
-            }
-            p.finalize();
-            // delete
-            if (not Settings::Downloader::KeepRepos) {
-                currentJob_ = 'D';
-                p.deleteRepo();
-            }
-            p.deleteTime_ = t.seconds();
+            do {
+                runStage(p);
+            } while (not Settings::Downloader::Pipeline and p.stage_ != Project::Stage::Done);
+            if (p.stage_ == Project::Stage::Done)
+                ++finishedProjects_;
+            else
+                StagePool(p.stage_).schedule(std::move(p));
             // nothing to do
             currentProject_ = -1;
             currentJob_ = ' '; // idle
-        } catch (...) {
-            currentJob_ = 'E';
-            std::lock_guard<std::mutex> g(failedProjectsGuard_);
-            failedProjectsFile_ << escape(p.gitUrl()) << "," << p.id_ << std::endl;
+        } catch (Watchdog::Timeout const & e) {
+            if (p.timeouts_ >= Settings::Downloader::TimeoutRetries) {
+                fail(p, e.what(), Failure::Classify(e));
+                throw;
+            }
+            // start over later with a larger budget, the worker is free for the next project now
+            Error(STR(e.what() << ", will retry with a larger budget once other projects are done"));
             try {
                 p.deleteRepo();
             } catch (...) {
                 // do nothing
             }
+            Project again(p.url_, p.id_);
+            again.expectedCost_ = p.expectedCost_;
+            again.timeouts_ = p.timeouts_ + 1;
+            again.attempts_ = p.attempts_;
+            again.csvSizes_ = p.csvSizes_;
+            std::lock_guard<std::mutex> g(retriesGuard_);
+            timeoutLane_.push_back(std::move(again));
+            currentProject_ = -1;
+            currentJob_ = ' ';
+        } catch (std::exception const & e) {
+            Failure::Kind kind = Failure::Classify(e);
+            if (not retry(p, e.what(), kind)) {
+                fail(p, e.what(), kind);
+                throw;
+            }
+            currentProject_ = -1;
+            currentJob_ = ' ';
+        } catch (...) {
+            fail(p, "unknown error", Failure::Kind::Other);
             throw;
         }
     }
@@ -375,11 +700,29 @@ private:
 
     static std::ofstream contentHashesFile_;
 
-    static std::unordered_map<SHA1,long> contentHashes_;
+    /** Global columnar tables of all projects, if enabled.
+     */
+    static std::unique_ptr<Table::Writer> projectsTable_;
+    static std::unique_ptr<Table::Writer> branchesTable_;
+    static std::unique_ptr<Table::Writer> commitsTable_;
+    static std::unique_ptr<Table::Writer> snapshotsTable_;
+
+    /** Content ids of all hashes seen so far, shared by all threads.
+     */
+    static ContentIndex contentHashes_;
+
+    /** Contents of all content ids, unless they are stored in the files folder.
+     */
+    static ContentStore contents_;
+
+    /** Content stores of packed folders of the files layout opened for reading.
+     */
+    static std::unordered_map<std::string, std::unique_ptr<ContentStore>> folders_;
+    static std::mutex foldersGuard_;
 
-    static std::mutex contentGuard_;
     static std::mutex failedProjectsGuard_;
     static std::mutex contentFileGuard_;
+    static std::mutex compactionGuard_;
 
 
     static PatternList language_;
@@ -387,7 +730,53 @@ private:
     static std::atomic<long> bytes_;
     static std::atomic<long> snapshots_;
 
-    static std::atomic<int> compressors_;
+    /** Pools of the stages of the pipeline, see Settings::Downloader::Pipeline.
+     */
+    static Pool stagePools_[NumStages];
+
+    /** Time the threads spent in each stage, in microseconds, for the utilization of the stages in the reports.
+     */
+    static std::atomic<uint64_t> stageMicros_[NumStages];
+
+    /** Projects that went through all stages or failed.
+     */
+    static std::atomic<unsigned long> finishedProjects_;
+
+    /** Project read from the input file, waiting to be scheduled.
+     */
+    struct PendingProject {
+        std::string url;
+        long id;
+        double expectedCost;
+    };
+
+    /** Projects read by FeedFrom, ordered by their expected costs, which the analysis corrects by the times it measures.
+     */
+    static CostQueue<PendingProject> pending_;
+
+    /** Projects that ran out of time, to be downloaded again once all others are done.
+     */
+    static std::vector<Project> timeoutLane_;
+
+    /** Projects that failed for a transient reason, by the time they may be tried again.
+     */
+    static std::multimap<std::chrono::steady_clock::time_point, Project> retries_;
+
+    /** Guards the timeout lane and the retries. */
+    static std::mutex retriesGuard_;
+
+    /** Failed attempts of projects in previous runs, by their git urls, guarded by failedProjectsGuard_.
+     */
+    static std::unordered_map<std::string, unsigned> previousAttempts_;
+
+    /** Git urls of projects that are not worth trying, guarded by failedProjectsGuard_.
+     */
+    static std::unordered_set<std::string> deadProjects_;
+    static std::ofstream deadProjectsFile_;
+
+    /** True while Finish() reschedules the timeout lane, so that the reporter does not take the stopped pools for the end.
+     */
+    static std::atomic<bool> retrying_;
 
 };
 
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <cctype>
+
+#include "failure.h"
+
+namespace {
+
+    bool Contains(std::string const & haystack, std::initializer_list<char const *> needles) {
+        for (char const * n : needles)
+            if (haystack.find(n) != std::string::npos)
+                return true;
+        return false;
+    }
+
+    /** Returns true for the "fatal: repository '<url>' not found" git prints when the server does not know the repository.
+     */
+    bool IsMissingRepository(std::string const & m) {
+        size_t start = m.find("fatal: repository '");
+        if (start == std::string::npos)
+            return false;
+        size_t end = m.find('\'', start + 19);
+        return end != std::string::npos and m.compare(end, 11, "' not found") == 0;
+    }
+
+} // anonymous namespace
+
+Failure::Kind Failure::Classify(std::string const & message) {
+    std::string m = message;
+    std::transform(m.begin(), m.end(), m.begin(), [](unsigned char c) { return std::tolower(c); });
+    // the rate limit first, github reports it as 403 or 429 together with other messages
+    if (Contains(m, { "rate limit", "too many requests", "error: 429", " 429 " }))
+        return Kind::RateLimited;
+    // only what the remote says, our own readers report missing objects and files too, private and deleted repositories make git ask for credentials, which it may not
+    if (Contains(m, { "repository not found", "remote: not found", "does not appear to be a git repository", "returned error: 404", "http 404", "terminal prompts disabled", "authentication failed", "could not read username" }) or IsMissingRepository(m))
+        return Kind::NotFound;
+    // objects and paths missing in the repository we read, usually a blobless clone that did not get everything
+    if (Contains(m, { "corrupt", "bad object", "invalid object", "index-pack failed", "unpack-objects failed", "did not send all necessary objects", "fsck error", "loose object", "not found in tree" }) or (Contains(m, { "object " }) and Contains(m, { " not found in " })))
+        return Kind::Corrupt;
+    if (Contains(m, { "could not resolve host", "connection timed out", "operation timed out", "timed out", "connection reset", "connection refused", "early eof", "rpc failed", "remote end hung up", "unexpected disconnect", "transfer closed", "gnutls", "ssl", "temporary failure", "error: 500", "error: 502", "error: 503", "error: 504", "curl: (6)", "curl: (7)", "curl: (28)", "curl: (52)", "curl: (56)" }))
+        return Kind::Transient;
+    return Kind::Other;
+}
+
+Failure::Kind Failure::Classify(std::exception const & e) {
+    if (Error const * error = dynamic_cast<Error const *>(& e))
+        return Classify(error->output());
+    return Classify(e.what());
+}
+
+char const * Failure::Name(Kind kind) {
+    switch (kind) {
+        case Kind::Transient:
+            return "transient";
+        case Kind::RateLimited:
+            return "rate limited";
+        case Kind::NotFound:
+            return "not found";
+        case Kind::Corrupt:
+            return "corrupt";
+        default:
+            return "other";
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+/** Kinds of failures of projects, told apart by the messages of git and curl, which decide whether a failed project is tried again.
+ */
+class Failure {
+public:
+    enum class Kind {
+        /** Network errors and server hiccups, likely to go away. */
+        Transient,
+        /** The API or the server asks us to slow down, goes away after a while. */
+        RateLimited,
+        /** The repository does not exist, or is no longer public, never goes away. */
+        NotFound,
+        /** The download is broken, a fresh clone usually fixes it. */
+        Corrupt,
+        /** Anything else, not tried again. */
+        Other,
+    };
+
+    /** Error of git or curl, whose output is kept apart from the rest of the message, so that the url or paths we put around it cannot be mistaken for the reason.
+     */
+    class Error : public std::runtime_error {
+    public:
+        Error(std::string const & what, std::string const & output):
+            std::runtime_error(what),
+            output_(output) {
+        }
+
+        std::string const & output() const {
+            return output_;
+        }
+
+    private:
+        std::string output_;
+    };
+
+    /** Returns the kind of failure given error message describes.
+     */
+    static Kind Classify(std::string const & message);
+
+    /** Returns the kind of failure given exception describes, only the output of the tool if it is a Failure::Error.
+     */
+    static Kind Classify(std::exception const & e);
+
+    /** Returns true if projects failing for given kind of reason should be tried again.
+     */
+    static bool IsRetryable(Kind kind) {
+        return kind == Kind::Transient or kind == Kind::RateLimited or kind == Kind::Corrupt;
+    }
+
+    static char const * Name(Kind kind);
+};
@@ -1,22 +1,135 @@
 #include "include/utils.h"
 #include "include/exec.h"
+#include "include/filesystem.h"
+
+#include "ght/settings.h"
 
 #include "git.h"
+#include "gitrepo.h"
+#include "catfile.h"
+#include "commitgraph.h"
 
 
 #include <iostream>
+#include <queue>
+#include <algorithm>
+
+namespace {
+
+    Git::Object::Type ObjectType(char c) {
+        switch (c) {
+        case 'A':
+            return Git::Object::Type::Added;
+        case 'M':
+            return Git::Object::Type::Modified;
+        case 'D':
+            return Git::Object::Type::Deleted;
+        default:
+            return Git::Object::Type::Unknown;
+        }
+    }
+
+    /** Runs git with the given arguments in the repository and returns its output. Throws if git fails.
+     */
+    std::string RunGit(std::string const & repoPath, std::vector<std::string> const & args) {
+        Process p(args, repoPath);
+        Process::Result r = p.run();
+        if (not r.success())
+            throw std::ios_base::failure(STR("Command " << p.command() << " failed in " << repoPath << " with message: " << r.err));
+        return std::move(r.out);
+    }
+
+    /** Runs git in the repository and returns its output, or throws with given message if git fails.
+     */
+    std::string RunGit(std::string const & repoPath, std::vector<std::string> const & args, std::string const & error) {
+        Process::Result r = Process(args, repoPath).run();
+        if (not r.success())
+            throw std::ios_base::failure(error);
+        return std::move(r.out);
+    }
+
+} // anonymous namespace
+
+bool Git::Clone(std::string const & url, std::string const & into, bool checkout, bool blobless, std::string * error) {
+    std::vector<std::string> args = { "git", "clone" };
+    if (not checkout)
+        args.push_back("--no-checkout");
+    if (blobless)
+        args.push_back("--filter=blob:none");
+    args.push_back(url);
+    args.push_back(into);
+    Process p(args);
+    p.env.push_back("GIT_TERMINAL_PROMPT=0");
+    // make sure we do not keep reading any previous repository at the same path
+    Release(into);
+    Process::Result r = p.run();
+    if (error != nullptr)
+        *error = std::move(r.err);
+    return r.success();
+}
+
+void Git::FetchBlobs(std::string const & repoPath, std::vector<std::string> const & hashes) {
+    // do not ask for what we already have, i.e. when the server ignored the filter
+    std::vector<std::string> missing;
+    {
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        for (std::string const & h : hashes)
+            if (not repo->contains(SHA1(h)))
+                missing.push_back(h);
+    }
+    if (missing.empty())
+        return;
+    // the hashes are passed on stdin, in chunks so that a single failure does not need to refetch everything
+    size_t const chunk = 50000;
+    Process p({ "git", "-c", "fetch.negotiationAlgorithm=noop", "fetch", "origin", "--no-tags", "--no-write-fetch-head", "--recurse-submodules=no", "--filter=blob:none", "--stdin" }, repoPath);
+    p.env.push_back("GIT_TERMINAL_PROMPT=0");
+    for (size_t i = 0; i < missing.size(); i += chunk) {
+        p.input.clear();
+        for (size_t j = i, e = std::min(i + chunk, missing.size()); j < e; ++j)
+            p.input += missing[j] + "\n";
+        Process::Result r = p.run();
+        if (not r.success())
+            throw std::ios_base::failure(STR("Command " << p.command() << " failed in " << repoPath << " with message: " << r.err));
+    }
+    // new packs have arrived
+    Release(repoPath);
+}
+
+bool Git::Fetch(std::string const & repoPath) {
+    // blobless clones remember their filter, so the fetch does not download any blobs either
+    Process p({ "git", "fetch", "--prune", "--no-tags", "origin" }, repoPath);
+    p.env.push_back("GIT_TERMINAL_PROMPT=0");
+    bool ok = p.run().success();
+    // new packs and refs
+    Release(repoPath);
+    return ok;
+}
 
-bool Git::Clone(std::string const & url, std::string const & into) {
-    std::string cmd = STR("GIT_TERMINAL_PROMPT=0 git clone " << url << " " << into);
-    std::string out = execAndCapture(cmd, "");
-    return (out.find("fatal:") == std::string::npos);
+std::vector<std::string> Git::GetRemoteTips(std::string const & repoPath) {
+    std::vector<std::string> result;
+    if (Settings::Downloader::NativeGit) {
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        for (std::string const & b : repo->remoteBranches())
+            result.push_back(STR(repo->resolve(b)));
+        return result;
+    }
+    std::string output = RunGit(repoPath, { "git", "for-each-ref", "--format=%(objectname)", "refs/remotes" });
+    for (std::size_t i = 0; i + 40 <= output.size(); i += 41)
+        result.push_back(output.substr(i, 40));
+    return result;
+}
+
+void Git::Release(std::string const & repoPath) {
+    GitRepository::Release(repoPath);
+    GitCatFile::Release(repoPath);
 }
 
 /** Returns list of all branches in the given repository.
  */
 std::unordered_set<std::string> Git::GetBranches(std::string const & repoPath) {
-    std::string cmd = "git branch -r";
-    std::string branches = execAndCapture(cmd, repoPath);
+    if (Settings::Downloader::NativeGit)
+        return GitRepository::Open(repoPath)->remoteBranches();
+    std::string branches = RunGit(repoPath, { "git", "branch", "-r" });
     // now analyze the result for the branch names
     std::unordered_set<std::string> result;
     std::size_t i = 0;
@@ -42,45 +155,30 @@ std::unordered_set<std::string> Git::GetBranches(std::string const & repoPath) {
 
 
 std::string Git::GetCurrentBranch(std::string const & repoPath) {
-    std::string cmd = "git rev-parse --abbrev-ref HEAD";
-    std::string result;
-    if (execAndCapture(cmd,repoPath, result))
-        return result.substr(0, result.size() - 1); // ignore the new line at the end of the output
-    else
-        throw std::ios_base::failure(STR("Unable to get current branch in " << repoPath));
+    std::string result = RunGit(repoPath, { "git", "rev-parse", "--abbrev-ref", "HEAD" }, STR("Unable to get current branch in " << repoPath));
+    return result.substr(0, result.size() - 1); // ignore the new line at the end of the output
 }
 
 std::string Git::GetLatestCommit(std::string const & repoPath) {
-    std::string cmd = "git rev-parse HEAD";
-    std::string result;
-    if (execAndCapture(cmd,repoPath, result))
-        return result.substr(0, result.size() - 1); // ignore the new line at the end of the output
-    else
-        throw std::ios_base::failure(STR("Unable to get latest commit in " << repoPath));
+    std::string result = RunGit(repoPath, { "git", "rev-parse", "HEAD" }, STR("Unable to get latest commit in " << repoPath));
+    return result.substr(0, result.size() - 1); // ignore the new line at the end of the output
 }
 
 void Git::SetBranch(std::string const & repoPath, std::string const branch) {
-    std::string cmd = STR("git checkout --force \"" << branch << "\"");
-    std::string output; // silenc the console output of git
-    if (not execAndCapture(cmd, repoPath, output))
-        throw std::ios_base::failure(STR("Unable to checkout branch " << branch << " in " << repoPath));
+    // the console output of git is captured, and thus silenced
+    RunGit(repoPath, { "git", "checkout", "--force", branch }, STR("Unable to checkout branch " << branch << " in " << repoPath));
 }
 
 Git::BranchInfo Git::GetBranchInfo(std::string const & repoPath) {
     std::string name = GetCurrentBranch(repoPath);
     std::string commit = GetLatestCommit(repoPath);
-    std::string cmd = STR("git show -s --format=%at " << commit);
-    std::string result;
-    if (execAndCapture(cmd,repoPath, result))
-        return BranchInfo(name, commit, std::stoi(result));
-    else
-        throw std::ios_base::failure(STR("Unable to get current branch info " << repoPath));
+    std::string result = RunGit(repoPath, { "git", "show", "-s", "--format=%at", commit }, STR("Unable to get current branch info " << repoPath));
+    return BranchInfo(name, commit, std::stoi(result));
 }
 
 
 std::vector<Git::FileInfo> Git::GetFileInfo(std::string const & repoPath) {
-    std::string cmd = STR("git log --format=\"format:%at\" --name-only --diff-filter=A");
-    std::string files = execAndCapture(cmd, repoPath);
+    std::string files = RunGit(repoPath, { "git", "log", "--format=format:%at", "--name-only", "--diff-filter=A" });
     // now analyze the files and their dates
     std::vector<FileInfo> result;
     std::stringstream ss(files);
@@ -101,9 +199,7 @@ std::vector<Git::FileInfo> Git::GetFileInfo(std::string const & repoPath) {
 
 // todo only works when the file exists
 std::vector<Git::FileHistory> Git::GetFileHistory(std::string const & repoPath, FileInfo const & file) {
-    std::string cmd = STR("git log --format=\"format:%at %H\" -- \"" << file.filename << "\"");
-    //std::string cmd = STR("git log --format=\"format:%at %H\" " << filename);
-    std::string history = execAndCapture(cmd, repoPath);
+    std::string history = RunGit(repoPath, { "git", "log", "--format=format:%at %H", "--", file.filename });
     std::vector<FileHistory> result;
     std::size_t i = 0;
     while (i < history.size()) {
@@ -123,27 +219,51 @@ std::vector<Git::FileHistory> Git::GetFileHistory(std::string const & repoPath,
 }
 
 std::string Git::GetFileRevision(std::string const & repoPath, std::string const & relPath, std::string const & commit) {
-    std::string cmd = STR("git show " << commit << ":" << "\"" << relPath << "\"");
-    std::string result;
-    if (not execAndCapture(cmd, repoPath, result))
-        throw std::ios_base::failure(STR("Unable to get file contents for file " << relPath << " commit " << commit << " at " << relPath << ", git says: " << result));
-    return result;
+    if (Settings::Downloader::NativeGit) {
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        return repo->readBlob(repo->findPath(repo->readCommit(repo->resolve(commit)).tree, relPath));
+    }
+    Process::Result r = Process({ "git", "show", commit + ":" + relPath }, repoPath).run();
+    if (not r.success())
+        throw std::ios_base::failure(STR("Unable to get file contents for file " << relPath << " commit " << commit << " at " << relPath << ", git says: " << r.err));
+    return std::move(r.out);
 
 }
 
 void Git::Checkout(std::string const &repoPath, std::string const & commit) {
-    std::string cmd = STR("git checkout --force " << commit);
-    std::string result;
-    if (not execAndCapture(cmd, repoPath, result))
-        throw std::ios_base::failure(STR("Command " << cmd << " failed in " << repoPath << " with message: " << result));
+    RunGit(repoPath, { "git", "checkout", "--force", commit });
 }
 
 
 std::vector<Git::Commit> Git::GetCommits(std::string const & repoPath, std::string const & branch) {
-    std::string cmd = STR("git log --format=\"%H %at\" \"" << branch << "\"");
-    std::string result;
-    if (not execAndCapture(cmd, repoPath, result))
-        throw std::ios_base::failure(STR("Command " << cmd << " failed in " << repoPath << " with message: " << result));
+    if (Settings::Downloader::NativeGit) {
+        // walk the history the way git log does, i.e. newest commits first
+        struct Pending {
+            SHA1 hash;
+            int time;
+            bool operator < (Pending const & other) const {
+                return time < other.time;
+            }
+        };
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        std::vector<Commit> commits;
+        std::unordered_set<SHA1> seen;
+        std::priority_queue<Pending> q;
+        SHA1 tip = repo->resolve(branch);
+        q.push(Pending{tip, repo->readCommit(tip).commitTime});
+        seen.insert(tip);
+        while (not q.empty()) {
+            SHA1 h = q.top().hash;
+            q.pop();
+            GitRepository::CommitInfo c = repo->readCommit(h);
+            commits.push_back(Commit(STR(h), c.authorTime));
+            for (SHA1 const & p : c.parents)
+                if (seen.insert(p).second)
+                    q.push(Pending{p, repo->readCommit(p).commitTime});
+        }
+        return commits;
+    }
+    std::string result = RunGit(repoPath, { "git", "log", "--format=%H %at", branch });
     std::vector<Commit> commits;
     std::size_t i = 0;
     while (i < result.size()) {
@@ -159,10 +279,7 @@ std::vector<Git::Commit> Git::GetCommits(std::string const & repoPath, std::stri
 }
 
 std::vector<std::string> Git::GetChanges(std::string const & repoPath, std::string const & commit) {
-    std::string cmd = STR("git show --oneline --name-only " << commit);
-    std::string result;
-    if (not execAndCapture(cmd, repoPath, result))
-        throw std::ios_base::failure(STR("Command " << cmd << " failed in " << repoPath << " with message: " << result));
+    std::string result = RunGit(repoPath, { "git", "show", "--oneline", "--name-only", commit });
     std::vector<std::string> changes;
     std::size_t i = 0;
     while (i < result.size()) {
@@ -179,12 +296,24 @@ std::vector<std::string> Git::GetChanges(std::string const & repoPath, std::stri
 
 std::vector<Git::Object> Git::GetObjects(std::string const & repoPath, std::string const & commit, std::string const & parent) {
     std::vector<Object> objects;
+    if (Settings::Downloader::NativeGit) {
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        std::vector<GitRepository::Change> changes;
+        SHA1 tree = repo->readCommit(SHA1(commit)).tree;
+        if (parent.empty()) {
+            repo->diffTrees(nullptr, tree, changes);
+        } else {
+            SHA1 parentTree = repo->readCommit(SHA1(parent)).tree;
+            repo->diffTrees(& parentTree, tree, changes);
+        }
+        for (GitRepository::Change & c : changes)
+            objects.push_back(Object(STR(c.newHash), std::move(c.relPath), ObjectType(c.type), c.type == 'A' ? std::string() : STR(c.oldHash)));
+        return objects;
+    }
     std::string result;
     // this is a hack - first commit has no parent therefore diff will not help
     if (parent.empty()) {
-        std::string cmd = STR("git ls-tree -r " << commit);
-        if (not execAndCapture(cmd, repoPath, result))
-            throw std::ios_base::failure(STR("Command " << cmd << " failed in " << repoPath << " with message: " << result));
+        result = RunGit(repoPath, { "git", "ls-tree", "-r", commit });
         std::size_t i = 0;
         while (i < result.size()) {
             while (result[++i] != ' ') {} // permissions
@@ -200,12 +329,12 @@ std::vector<Git::Object> Git::GetObjects(std::string const & repoPath, std::stri
             ++i; // end of line
         }
     } else {
-        std::string cmd = STR("git diff-tree -r --no-renames " << parent << " " << commit);
-        if (not execAndCapture(cmd, repoPath, result))
-            throw std::ios_base::failure(STR("Command " << cmd << " failed in " << repoPath << " with message: " << result));
+        result = RunGit(repoPath, { "git", "diff-tree", "-r", "--no-renames", parent, commit });
         std::size_t i = 0;
         while (i < result.size()) {
-            i += 56; // colon and permissions and first hash
+            i += 15; // colon and permissions
+            std::string oldHash = result.substr(i, 40);
+            i += 41; // first hash
             std::string hash = result.substr(i, 40);
             i += 41; // second hash
             char c = result[i++];
@@ -218,26 +347,149 @@ std::vector<Git::Object> Git::GetObjects(std::string const & repoPath, std::stri
                 ++i;
             std::string relPath = result.substr(start, i - start);
             ++i; // new line
-            switch (c) {
-            case 'A':
-                objects.push_back(Object(std::move(hash), std::move(relPath), Object::Type::Added));
-                break;
-            case 'M':
-                objects.push_back(Object(std::move(hash), std::move(relPath), Object::Type::Modified));
-                break;
-            case 'D':
-                objects.push_back(Object(std::move(hash), std::move(relPath), Object::Type::Deleted));
-                break;
-            default:
-                objects.push_back(Object(std::move(hash), std::move(relPath), Object::Type::Unknown));
-                break;
-            }
+            if (c == 'A')
+                oldHash.clear();
+            objects.push_back(Object(std::move(hash), std::move(relPath), ObjectType(c), std::move(oldHash)));
         }
     }
     return objects;
 
 }
 
+void Git::WalkHistory(std::string const & repoPath, LogHandler const & handler, std::vector<std::string> const & exclude, std::unordered_map<std::string, std::string> * firstCommits) {
+    if (Settings::Downloader::NativeGit) {
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        // load the ancestry of all remote branches once, the walk stops at the excluded commits, which prunes most of the old history
+        std::vector<std::string> branches;
+        std::vector<SHA1> tips;
+        std::vector<SHA1> boundary;
+        for (std::string const & b : repo->remoteBranches()) {
+            branches.push_back(b);
+            tips.push_back(repo->resolve(b));
+        }
+        for (std::string const & x : exclude)
+            boundary.push_back(SHA1(x));
+        CommitGraph graph(*repo);
+        graph.load(tips, boundary);
+        LogEntry entry;
+        std::vector<GitRepository::Change> changes;
+        // root reached by the first parents of each node, parents precede their children in the order, boundary nodes have none
+        std::vector<uint32_t> roots(firstCommits == nullptr ? 0 : graph.size(), CommitGraph::None);
+        for (uint32_t i : graph.order()) {
+            CommitGraph::Node const & n = graph[i];
+            if (firstCommits != nullptr)
+                roots[i] = n.parentsCount == 0 ? i : roots[graph.parent(i)];
+            // the graph has no author times, which is what we report
+            entry.commit = Commit(STR(n.hash), repo->readCommit(n.hash).authorTime);
+            entry.parents.clear();
+            entry.objects.clear();
+            changes.clear();
+            for (uint32_t p = 0; p < n.parentsCount; ++p)
+                entry.parents.push_back(STR(graph[graph.parent(i, p)].hash));
+            if (n.parentsCount == 0)
+                repo->diffTrees(nullptr, n.tree, changes);
+            else
+                repo->diffTrees(& graph[graph.parent(i)].tree, n.tree, changes);
+            for (GitRepository::Change & ch : changes)
+                entry.objects.push_back(Object(STR(ch.newHash), std::move(ch.relPath), ObjectType(ch.type), ch.type == 'A' ? std::string() : STR(ch.oldHash)));
+            handler(entry);
+        }
+        if (firstCommits != nullptr) {
+            for (size_t i = 0; i < branches.size(); ++i) {
+                uint32_t tip = graph.find(tips[i]);
+                if (tip != CommitGraph::None and roots[tip] != CommitGraph::None)
+                    (*firstCommits)[branches[i]] = STR(graph[roots[tip]].hash);
+            }
+        }
+        return;
+    }
+    // merges are diffed against their first parents, root commits against empty tree
+    std::vector<std::string> args = { "git", "-c", "core.quotePath=false", "log", "--remotes", "--reverse", "--topo-order", "--no-renames", "--raw", "--no-abbrev", "--root", "--diff-merges=first-parent", "--format=commit %H %at %P" };
+    if (not exclude.empty()) {
+        args.push_back("--not");
+        args.insert(args.end(), exclude.begin(), exclude.end());
+    }
+    LogEntry entry;
+    bool pending = false;
+    // root reached by the first parents of each commit, the log has parents before their children
+    std::unordered_map<SHA1, SHA1> roots;
+    Process p(args, repoPath);
+    p.onOut = Process::Lines([&] (std::string const & line) {
+        if (line.compare(0, 7, "commit ") == 0) {
+            if (pending)
+                handler(entry);
+            // commit hash time parents
+            entry.commit = Commit(line.substr(7, 40), std::atoi(line.c_str() + 48));
+            entry.parents.clear();
+            entry.objects.clear();
+            std::size_t i = line.find(' ', 48);
+            while (i != std::string::npos and i + 41 <= line.size()) {
+                entry.parents.push_back(line.substr(i + 1, 40));
+                i = line.find(' ', i + 1);
+            }
+            if (firstCommits != nullptr) {
+                SHA1 h(entry.commit.hash);
+                if (entry.parents.empty()) {
+                    roots[h] = h;
+                } else {
+                    auto r = roots.find(SHA1(entry.parents.front()));
+                    if (r != roots.end())
+                        roots[h] = r->second;
+                }
+            }
+            pending = true;
+        } else if (line.size() > 99 and line[0] == ':') {
+            // :mode mode hash hash type\tpath, the path follows the first tab
+            std::size_t tab = line.find('\t', 97);
+            if (tab == std::string::npos)
+                return;
+            entry.objects.push_back(Object(line.substr(56, 40), line.substr(tab + 1), ObjectType(line[97]), line[97] == 'A' ? std::string() : line.substr(15, 40)));
+        }
+    });
+    Process::Result r = p.run();
+    if (not r.success())
+        throw std::ios_base::failure(STR("Command " << p.command() << " failed in " << repoPath << " with message: " << r.err));
+    if (pending)
+        handler(entry);
+    if (firstCommits != nullptr) {
+        // the tips of the remote branches, the names are those of git branch -r
+        std::string refs = RunGit(repoPath, { "git", "for-each-ref", "--format=%(objectname) %(refname:short)", "refs/remotes" });
+        std::size_t i = 0;
+        while (i + 41 < refs.size()) {
+            std::size_t nl = refs.find('\n', i);
+            if (nl == std::string::npos)
+                nl = refs.size();
+            auto r = roots.find(SHA1(refs.substr(i, 40)));
+            if (r != roots.end())
+                (*firstCommits)[refs.substr(i + 41, nl - i - 41)] = STR(r->second);
+            i = nl + 1;
+        }
+    }
+}
+
+std::string Git::GetFirstCommit(std::string const & repoPath, std::string const & branch) {
+    if (Settings::Downloader::NativeGit) {
+        std::shared_ptr<GitRepository> repo = GitRepository::Open(repoPath);
+        SHA1 h = repo->resolve(branch);
+        while (true) {
+            GitRepository::CommitInfo c = repo->readCommit(h);
+            if (c.parents.empty())
+                return STR(h);
+            h = c.parents.front();
+        }
+    }
+    std::string result = RunGit(repoPath, { "git", "rev-list", "--first-parent", "--max-parents=0", branch });
+    if (result.size() < 41)
+        throw std::ios_base::failure(STR("Branch " << branch << " has no root commit in " << repoPath));
+    return result.substr(result.size() - 41, 40);
+}
+
+std::string Git::GetBlob(std::string const & repoPath, std::string const & hash) {
+    if (Settings::Downloader::NativeGit)
+        return GitRepository::Open(repoPath)->readBlob(SHA1(hash));
+    return GitCatFile::Open(repoPath)->read(hash);
+}
+
 
 /*
 
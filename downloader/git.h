@@ -2,7 +2,13 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
+#include <functional>
 
+/** Access to git repositories.
+
+  When Settings::Downloader::NativeGit is set, the history related functions (GetBranches, GetCommits, GetObjects, GetFileRevision and GetBlob) read the repository in-process through GitRepository and never spawn git. Otherwise they execute the git command and parse its output.
+ */
 class Git {
 public:
 
@@ -42,9 +48,31 @@ public:
 
     /** Clones the given repository to specified path.
 
-      Returns true if successful. The destination path must not exist when calling the function.
+      Returns true if successful. The destination path must not exist when calling the function. If checkout is false, the working tree is not populated, which is all we need since the blobs are read from the object database. Blobless clones only download commits and trees, the blobs must then be fetched explicitly by FetchBlobs. If error is given, it receives the error output of git, which tells why a clone failed.
+     */
+    static bool Clone(std::string const & url, std::string const & into, bool checkout = true, bool blobless = false, std::string * error = nullptr);
+
+    /** Fetches the given blobs from origin into a blobless clone.
+
+      Blobs already present in the repository are skipped and the rest is fetched in as few git invocations as possible. The server must allow fetching objects by their hashes, which is the case for protocol v2 servers with uploadpack.allowFilter enabled (such as github).
+     */
+    static void FetchBlobs(std::string const & repoPath, std::vector<std::string> const & hashes);
+
+    /** Fetches new commits from origin into an existing repository, pruning branches deleted upstream.
+
+      Returns true if successful.
+     */
+    static bool Fetch(std::string const & repoPath);
+
+    /** Returns the commits all remote branches point to.
      */
-    static bool Clone(std::string const & url, std::string const & into);
+    static std::vector<std::string> GetRemoteTips(std::string const & repoPath);
+
+    /** Releases any readers or coprocesses kept open for the given repository.
+
+      Must be called before the repository is deleted or replaced.
+     */
+    static void Release(std::string const & repoPath);
 
     /** Returns list of all branches in the given repository.
      */
@@ -105,14 +133,38 @@ public:
         std::string hash;
         std::string relPath;
         Type type;
+        /** Hash of the object in the parent the commit was diffed against, empty if the object was added. */
+        std::string oldHash;
 
         Object(std::string && hash, std::string && relPath, Type type):
             hash(std::move(hash)),
             relPath(std::move(relPath)),
             type(type) {
         }
+
+        Object(std::string && hash, std::string && relPath, Type type, std::string && oldHash):
+            hash(std::move(hash)),
+            relPath(std::move(relPath)),
+            type(type),
+            oldHash(std::move(oldHash)) {
+        }
     };
 
+    /** Single commit of the history walk, with its parents and the objects it changed with respect to its first parent.
+     */
+    struct LogEntry {
+    public:
+        Commit commit;
+        std::vector<std::string> parents;
+        std::vector<Object> objects;
+
+        LogEntry():
+            commit("", 0) {
+        }
+    };
+
+    typedef std::function<void(LogEntry const &)> LogHandler;
+
     static void Checkout(std::string const &repo_, std::string const & commit);
 
     static std::vector<Commit> GetCommits(std::string const & repoPath, std::string const & branch);
@@ -121,6 +173,26 @@ public:
 
     static std::vector<Object> GetObjects(std::string const & repoPath, std::string const & commit, std::string const & parent);
 
+    /** Walks the history of all remote branches in a single pass, parents before their children, and calls the handler for every commit as soon as it is read.
+
+      Each commit is reported only once, with the objects it changed with respect to its first parent (root commits report all their files as added). The native reader first loads the ancestry of all branches into a CommitGraph, using git's commit-graph file if present. Without the native reader this streams a single git log, so only the current commit is ever kept in memory.
+
+      Commits reachable from the excluded commits are not reported, which allows resuming from the frontier of a previous analysis.
+
+      If firstCommits is given, it is filled with the first commit of each remote branch, see GetFirstCommit(), as the walk reaches the roots. Branches whose first parents lead to an excluded commit are left out.
+     */
+    static void WalkHistory(std::string const & repoPath, LogHandler const & handler, std::vector<std::string> const & exclude = std::vector<std::string>(), std::unordered_map<std::string, std::string> * firstCommits = nullptr);
+
+    /** Returns the root commit reached by following the first parents from the given branch.
+     */
+    static std::string GetFirstCommit(std::string const & repoPath, std::string const & branch);
+
+    /** Returns contents of the blob with given hash.
+
+      Without the native reader, the blobs are read by a git cat-file coprocess that is kept running for the repository until it is released.
+     */
+    static std::string GetBlob(std::string const & repoPath, std::string const & hash);
+
 
 
 
@@ -0,0 +1,647 @@
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "include/utils.h"
+#include "include/filesystem.h"
+
+#include "gitrepo.h"
+
+
+namespace {
+
+    /** Pack object types as stored in the pack entry headers.
+     */
+    enum PackType {
+        OBJ_COMMIT = 1,
+        OBJ_TREE = 2,
+        OBJ_BLOB = 3,
+        OBJ_TAG = 4,
+        OBJ_OFS_DELTA = 6,
+        OBJ_REF_DELTA = 7,
+    };
+
+    /** Max size of the delta bases cache per repository.
+     */
+    size_t const MaxDeltaBasesSize = 64 * 1024 * 1024;
+
+    uint32_t BigEndian32(unsigned char const * x) {
+        return (static_cast<uint32_t>(x[0]) << 24) | (static_cast<uint32_t>(x[1]) << 16) | (static_cast<uint32_t>(x[2]) << 8) | x[3];
+    }
+
+    uint64_t BigEndian64(unsigned char const * x) {
+        return (static_cast<uint64_t>(BigEndian32(x)) << 32) | BigEndian32(x + 4);
+    }
+
+    bool IsHex(std::string const & what) {
+        if (what.size() != 40)
+            return false;
+        for (char c : what)
+            if (not ((c >= '0' and c <= '9') or (c >= 'a' and c <= 'f')))
+                return false;
+        return true;
+    }
+
+    /** Inflates zlib stream of known uncompressed size.
+     */
+    void Inflate(unsigned char const * from, size_t available, size_t size, std::string & into) {
+        into.resize(size);
+        z_stream s;
+        s.zalloc = Z_NULL;
+        s.zfree = Z_NULL;
+        s.opaque = Z_NULL;
+        s.next_in = const_cast<unsigned char *>(from);
+        s.avail_in = available;
+        if (inflateInit(&s) != Z_OK)
+            throw std::runtime_error("Unable to initialize zlib");
+        // an empty output buffer is still a valid target for zlib
+        unsigned char dummy;
+        s.next_out = size == 0 ? &dummy : reinterpret_cast<unsigned char *>(&into[0]);
+        s.avail_out = size == 0 ? 1 : size;
+        int ret = inflate(&s, Z_FINISH);
+        size_t produced = s.total_out;
+        inflateEnd(&s);
+        if (ret != Z_STREAM_END or produced != size)
+            throw std::runtime_error("Corrupted zlib stream in git object");
+    }
+
+    /** Inflates zlib stream of unknown size, used for loose objects.
+     */
+    void InflateAll(std::string const & from, std::string & into) {
+        z_stream s;
+        s.zalloc = Z_NULL;
+        s.zfree = Z_NULL;
+        s.opaque = Z_NULL;
+        s.next_in = reinterpret_cast<unsigned char *>(const_cast<char *>(from.data()));
+        s.avail_in = from.size();
+        if (inflateInit(&s) != Z_OK)
+            throw std::runtime_error("Unable to initialize zlib");
+        into.resize(std::max<size_t>(from.size() * 4, 1024));
+        int ret;
+        do {
+            if (s.total_out == into.size())
+                into.resize(into.size() * 2);
+            s.next_out = reinterpret_cast<unsigned char *>(&into[s.total_out]);
+            s.avail_out = into.size() - s.total_out;
+            ret = inflate(&s, Z_NO_FLUSH);
+        } while (ret == Z_OK);
+        into.resize(s.total_out);
+        inflateEnd(&s);
+        if (ret != Z_STREAM_END)
+            throw std::runtime_error("Corrupted zlib stream in git object");
+    }
+
+    size_t DeltaSize(unsigned char const * & x, unsigned char const * end) {
+        size_t result = 0;
+        unsigned shift = 0;
+        while (x < end) {
+            unsigned char c = *x++;
+            result |= static_cast<size_t>(c & 0x7f) << shift;
+            shift += 7;
+            if ((c & 0x80) == 0)
+                break;
+        }
+        return result;
+    }
+
+    /** Applies git's delta to the given base object.
+     */
+    void ApplyDelta(std::string const & base, std::string const & delta, std::string & into) {
+        unsigned char const * x = reinterpret_cast<unsigned char const *>(delta.data());
+        unsigned char const * end = x + delta.size();
+        size_t baseSize = DeltaSize(x, end);
+        if (baseSize != base.size())
+            throw std::runtime_error("Delta base size mismatch");
+        into.clear();
+        into.reserve(DeltaSize(x, end));
+        while (x < end) {
+            unsigned char op = *x++;
+            if (op & 0x80) {
+                // copy from the base
+                size_t offset = 0;
+                size_t size = 0;
+                for (unsigned i = 0; i < 4; ++i)
+                    if (op & (1 << i))
+                        offset |= static_cast<size_t>(*x++) << (i * 8);
+                for (unsigned i = 0; i < 3; ++i)
+                    if (op & (0x10 << i))
+                        size |= static_cast<size_t>(*x++) << (i * 8);
+                if (size == 0)
+                    size = 0x10000;
+                if (offset + size > base.size())
+                    throw std::runtime_error("Delta copy out of bounds");
+                into.append(base, offset, size);
+            } else if (op != 0) {
+                // insert literal data
+                if (x + op > end)
+                    throw std::runtime_error("Delta insert out of bounds");
+                into.append(reinterpret_cast<char const *>(x), op);
+                x += op;
+            } else {
+                throw std::runtime_error("Invalid delta opcode");
+            }
+        }
+    }
+
+    GitRepository::ObjectType TypeFromName(std::string const & name) {
+        if (name == "commit")
+            return GitRepository::ObjectType::Commit;
+        if (name == "tree")
+            return GitRepository::ObjectType::Tree;
+        if (name == "blob")
+            return GitRepository::ObjectType::Blob;
+        if (name == "tag")
+            return GitRepository::ObjectType::Tag;
+        throw std::runtime_error(STR("Unknown git object type " << name));
+    }
+
+    int ParseTime(std::string const & line) {
+        // the line is name <email> time timezone
+        std::size_t end = line.rfind(' ');
+        std::size_t start = line.rfind(' ', end - 1);
+        if (end == std::string::npos or start == std::string::npos)
+            return 0;
+        return std::atoi(line.c_str() + start + 1);
+    }
+
+    /** Compares tree entry names the way git sorts them, i.e. as if trees had a trailing slash.
+     */
+    int CompareEntries(GitRepository::TreeEntry const & a, GitRepository::TreeEntry const & b) {
+        std::size_t len = std::min(a.name.size(), b.name.size());
+        int cmp = std::memcmp(a.name.data(), b.name.data(), len);
+        if (cmp != 0)
+            return cmp;
+        unsigned char ca = a.name.size() > len ? a.name[len] : (a.isTree() ? '/' : 0);
+        unsigned char cb = b.name.size() > len ? b.name[len] : (b.isTree() ? '/' : 0);
+        return static_cast<int>(ca) - static_cast<int>(cb);
+    }
+
+} // anonymous namespace
+
+
+
+std::mutex GitRepository::openGuard_;
+std::unordered_map<std::string, std::shared_ptr<GitRepository>> GitRepository::open_;
+
+std::shared_ptr<GitRepository> GitRepository::Open(std::string const & path) {
+    std::lock_guard<std::mutex> g(openGuard_);
+    auto i = open_.find(path);
+    if (i != open_.end())
+        return i->second;
+    std::shared_ptr<GitRepository> result(new GitRepository(path));
+    open_[path] = result;
+    return result;
+}
+
+void GitRepository::Release(std::string const & path) {
+    std::lock_guard<std::mutex> g(openGuard_);
+    open_.erase(path);
+}
+
+GitRepository::GitRepository(std::string const & path):
+    packedRefsLoaded_(false),
+    deltaBasesSize_(0) {
+    // working trees have the git directory in .git, which may also be a file pointing elsewhere, bare repositories are the git directory themselves
+    if (isDirectory(path + "/.git")) {
+        gitDir_ = path + "/.git";
+    } else if (isFile(path + "/.git")) {
+        std::string x = LoadEntireFile(path + "/.git");
+        if (x.compare(0, 8, "gitdir: ") != 0)
+            throw std::runtime_error(STR("Invalid .git file in " << path));
+        x = x.substr(8, x.find('\n') - 8);
+        gitDir_ = (x[0] == '/') ? x : path + "/" + x;
+    } else if (isDirectory(path + "/objects")) {
+        gitDir_ = path;
+    } else {
+        throw std::runtime_error(STR("No git repository found in " << path));
+    }
+    loadPacks();
+}
+
+std::unordered_set<std::string> GitRepository::remoteBranches() {
+    std::unordered_set<std::string> result;
+    loadPackedRefs();
+    for (auto const & i : packedRefs_)
+        if (i.first.compare(0, 13, "refs/remotes/") == 0)
+            result.insert(i.first.substr(13));
+    collectRemoteRefs(gitDir_ + "/refs/remotes", "", result);
+    return result;
+}
+
+SHA1 GitRepository::resolve(std::string const & name) {
+    SHA1 result;
+    if (not (readRef("refs/remotes/" + name, result) or
+             readRef("refs/heads/" + name, result) or
+             readRef("refs/tags/" + name, result) or
+             readRef(name, result))) {
+        if (not IsHex(name))
+            throw std::runtime_error(STR("Unable to resolve " << name << " in " << gitDir_));
+        result = SHA1(name);
+    }
+    // peel annotated tags
+    std::string tag;
+    while (read(result, tag) == ObjectType::Tag) {
+        if (tag.compare(0, 7, "object ") != 0)
+            throw std::runtime_error(STR("Invalid tag object " << result));
+        result = SHA1(tag.substr(7, 40));
+    }
+    return result;
+}
+
+GitRepository::ObjectType GitRepository::read(SHA1 const & hash, std::string & into) {
+    for (size_t i = 0, e = packs_.size(); i < e; ++i) {
+        uint64_t offset = packs_[i]->find(hash);
+        if (offset != 0)
+            return readPacked(i, offset, into);
+    }
+    ObjectType type;
+    if (readLoose(hash, type, into))
+        return type;
+    // the object might be in a pack that appeared after we have opened the repository
+    size_t known = packs_.size();
+    loadPacks();
+    for (size_t i = known, e = packs_.size(); i < e; ++i) {
+        uint64_t offset = packs_[i]->find(hash);
+        if (offset != 0)
+            return readPacked(i, offset, into);
+    }
+    throw std::runtime_error(STR("Object " << hash << " not found in " << gitDir_));
+}
+
+bool GitRepository::contains(SHA1 const & hash) {
+    for (auto const & p : packs_)
+        if (p->find(hash) != 0)
+            return true;
+    std::string hex = STR(hash);
+    if (isFile(STR(objectsPath() << "/" << hex.substr(0, 2) << "/" << hex.substr(2))))
+        return true;
+    size_t known = packs_.size();
+    loadPacks();
+    for (size_t i = known, e = packs_.size(); i < e; ++i)
+        if (packs_[i]->find(hash) != 0)
+            return true;
+    return false;
+}
+
+std::string GitRepository::readBlob(SHA1 const & hash) {
+    std::string result;
+    if (read(hash, result) != ObjectType::Blob)
+        throw std::runtime_error(STR("Object " << hash << " is not a blob"));
+    return result;
+}
+
+GitRepository::CommitInfo GitRepository::readCommit(SHA1 const & hash) {
+    std::string x;
+    if (read(hash, x) != ObjectType::Commit)
+        throw std::runtime_error(STR("Object " << hash << " is not a commit"));
+    CommitInfo result;
+    result.authorTime = 0;
+    result.commitTime = 0;
+    std::size_t i = 0;
+    // only parse the headers, the message starts after the first empty line
+    while (i < x.size() and x[i] != '\n') {
+        std::size_t eol = x.find('\n', i);
+        if (eol == std::string::npos)
+            eol = x.size();
+        if (x.compare(i, 5, "tree ") == 0)
+            result.tree = SHA1(x.substr(i + 5, 40));
+        else if (x.compare(i, 7, "parent ") == 0)
+            result.parents.push_back(SHA1(x.substr(i + 7, 40)));
+        else if (x.compare(i, 7, "author ") == 0)
+            result.authorTime = ParseTime(x.substr(i, eol - i));
+        else if (x.compare(i, 10, "committer ") == 0)
+            result.commitTime = ParseTime(x.substr(i, eol - i));
+        i = eol + 1;
+    }
+    return result;
+}
+
+std::vector<GitRepository::TreeEntry> GitRepository::readTree(SHA1 const & hash) {
+    std::string x;
+    if (read(hash, x) != ObjectType::Tree)
+        throw std::runtime_error(STR("Object " << hash << " is not a tree"));
+    std::vector<TreeEntry> result;
+    std::size_t i = 0;
+    while (i < x.size()) {
+        TreeEntry e;
+        e.mode = 0;
+        while (i < x.size() and x[i] != ' ')
+            e.mode = e.mode * 8 + (x[i++] - '0');
+        std::size_t start = ++i;
+        while (i < x.size() and x[i] != 0)
+            ++i;
+        if (i >= x.size())
+            throw std::runtime_error(STR("Truncated tree object " << hash));
+        e.name = x.substr(start, i - start);
+        ++i;
+        if (i + 20 > x.size())
+            throw std::runtime_error(STR("Truncated tree object " << hash));
+        e.hash = SHA1::FromBytes(x.data() + i);
+        i += 20;
+        result.push_back(std::move(e));
+    }
+    return result;
+}
+
+SHA1 GitRepository::findPath(SHA1 const & tree, std::string const & relPath) {
+    SHA1 current = tree;
+    std::size_t start = 0;
+    while (true) {
+        std::size_t end = relPath.find('/', start);
+        std::string name = relPath.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        bool found = false;
+        for (TreeEntry const & e : readTree(current)) {
+            if (e.name == name) {
+                current = e.hash;
+                found = true;
+                break;
+            }
+        }
+        if (not found)
+            throw std::runtime_error(STR("Path " << relPath << " not found in tree " << tree));
+        if (end == std::string::npos)
+            return current;
+        start = end + 1;
+    }
+}
+
+void GitRepository::diffTrees(SHA1 const * oldTree, SHA1 const & newTree, std::vector<Change> & into) {
+    std::vector<TreeEntry> oldEntries;
+    if (oldTree != nullptr) {
+        if (*oldTree == newTree)
+            return;
+        oldEntries = readTree(*oldTree);
+    }
+    diffTrees(oldEntries, readTree(newTree), "", into);
+}
+
+void GitRepository::diffTrees(std::vector<TreeEntry> const & oldEntries, std::vector<TreeEntry> const & newEntries, std::string const & prefix, std::vector<Change> & into) {
+    // both trees are sorted, so we can merge them
+    auto o = oldEntries.begin(), oe = oldEntries.end();
+    auto n = newEntries.begin(), ne = newEntries.end();
+    while (o != oe or n != ne) {
+        int cmp = (o == oe) ? 1 : ((n == ne) ? -1 : CompareEntries(*o, *n));
+        if (cmp < 0) {
+            if (o->isTree())
+                reportTree(o->hash, 'D', prefix + o->name + "/", into);
+            else
+                into.push_back(Change{'D', prefix + o->name, o->hash, SHA1()});
+            ++o;
+        } else if (cmp > 0) {
+            if (n->isTree())
+                reportTree(n->hash, 'A', prefix + n->name + "/", into);
+            else
+                into.push_back(Change{'A', prefix + n->name, SHA1(), n->hash});
+            ++n;
+        } else {
+            if (o->hash != n->hash or o->mode != n->mode) {
+                if (o->isTree())
+                    diffTrees(readTree(o->hash), readTree(n->hash), prefix + n->name + "/", into);
+                else
+                    // the file type is in the upper bits of the mode
+                    into.push_back(Change{(o->mode >> 12) == (n->mode >> 12) ? 'M' : 'T', prefix + n->name, o->hash, n->hash});
+            }
+            ++o;
+            ++n;
+        }
+    }
+}
+
+void GitRepository::reportTree(SHA1 const & tree, char type, std::string const & prefix, std::vector<Change> & into) {
+    for (TreeEntry const & e : readTree(tree)) {
+        if (e.isTree())
+            reportTree(e.hash, type, prefix + e.name + "/", into);
+        else if (type == 'A')
+            into.push_back(Change{type, prefix + e.name, SHA1(), e.hash});
+        else
+            into.push_back(Change{type, prefix + e.name, e.hash, SHA1()});
+    }
+}
+
+// Pack -------------------------------------------------------------------------------------------
+
+GitRepository::Pack::Pack(std::string const & idxPath, std::string const & packPath):
+    idx(idxPath),
+    pack(packPath) {
+    unsigned char const * x = idx.data();
+    if (idx.size() < 8 + 256 * 4 or BigEndian32(x) != 0xff744f63 or BigEndian32(x + 4) != 2)
+        throw std::runtime_error(STR("Unsupported pack index format " << idxPath));
+    fanout_ = x + 8;
+    count_ = BigEndian32(fanout_ + 255 * 4);
+    names_ = fanout_ + 256 * 4;
+    // the crc32 table follows the names
+    offsets_ = names_ + count_ * 20 + count_ * 4;
+    offsets64_ = offsets_ + count_ * 4;
+    if (pack.size() < 12 or std::memcmp(pack.data(), "PACK", 4) != 0)
+        throw std::runtime_error(STR("Invalid pack file " << packPath));
+}
+
+uint64_t GitRepository::Pack::find(SHA1 const & hash) const {
+    unsigned char first = hash.data()[0];
+    uint32_t lo = first == 0 ? 0 : BigEndian32(fanout_ + (first - 1) * 4);
+    uint32_t hi = BigEndian32(fanout_ + first * 4);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(names_ + mid * 20, hash.data(), 20);
+        if (cmp == 0) {
+            uint32_t offset = BigEndian32(offsets_ + mid * 4);
+            if (offset & 0x80000000)
+                return BigEndian64(offsets64_ + (offset & 0x7fffffff) * 8);
+            return offset;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+void GitRepository::loadPacks() {
+    std::string packDir = objectsPath() + "/pack";
+    std::vector<std::string> names = listDirectory(packDir);
+    std::sort(names.begin(), names.end());
+    for (std::string const & name : names) {
+        if (name.size() < 4 or name.compare(name.size() - 4, 4, ".idx") != 0)
+            continue;
+        std::string base = packDir + "/" + name.substr(0, name.size() - 4);
+        if (not isFile(base + ".pack") or loadedPacks_.find(base) != loadedPacks_.end())
+            continue;
+        packs_.push_back(std::unique_ptr<Pack>(new Pack(base + ".idx", base + ".pack")));
+        loadedPacks_.insert(base);
+    }
+}
+
+GitRepository::ObjectType GitRepository::readPacked(size_t packIndex, uint64_t offset, std::string & into) {
+    // delta chains are resolved iteratively, first walk down to the base, then apply the deltas in reverse order
+    Pack & p = * packs_[packIndex];
+    std::vector<std::string> deltas;
+    ObjectType type = ObjectType::None;
+    std::string base;
+    uint64_t firstOffset = offset;
+    while (true) {
+        uint64_t key = (static_cast<uint64_t>(packIndex) << 48) | offset;
+        auto cached = deltaBases_.find(key);
+        if (cached != deltaBases_.end()) {
+            type = cached->second.first;
+            base = cached->second.second;
+            break;
+        }
+        unsigned char const * x = p.pack.data() + offset;
+        unsigned char const * end = p.pack.data() + p.pack.size();
+        if (x >= end)
+            throw std::runtime_error(STR("Pack offset out of bounds in " << gitDir_));
+        unsigned char c = *x++;
+        int t = (c >> 4) & 7;
+        size_t size = c & 15;
+        unsigned shift = 4;
+        while (c & 0x80) {
+            if (x == end or shift > 57)
+                throw std::runtime_error(STR("Truncated pack object at offset " << offset << " in " << gitDir_));
+            c = *x++;
+            size |= static_cast<size_t>(c & 0x7f) << shift;
+            shift += 7;
+        }
+        if (t == OBJ_OFS_DELTA) {
+            if (x == end)
+                throw std::runtime_error(STR("Truncated pack object at offset " << offset << " in " << gitDir_));
+            c = *x++;
+            uint64_t rel = c & 0x7f;
+            while (c & 0x80) {
+                if (x == end or rel > (std::numeric_limits<uint64_t>::max() >> 8))
+                    throw std::runtime_error(STR("Truncated pack object at offset " << offset << " in " << gitDir_));
+                c = *x++;
+                rel = ((rel + 1) << 7) | (c & 0x7f);
+            }
+            if (rel == 0 or rel > offset)
+                throw std::runtime_error(STR("Invalid delta base offset at offset " << offset << " in " << gitDir_));
+            deltas.push_back(std::string());
+            Inflate(x, end - x, size, deltas.back());
+            offset = offset - rel;
+        } else if (t == OBJ_REF_DELTA) {
+            if (end - x < 20)
+                throw std::runtime_error(STR("Truncated pack object at offset " << offset << " in " << gitDir_));
+            SHA1 baseHash = SHA1::FromBytes(x);
+            x += 20;
+            deltas.push_back(std::string());
+            Inflate(x, end - x, size, deltas.back());
+            uint64_t baseOffset = p.find(baseHash);
+            if (baseOffset != 0) {
+                offset = baseOffset;
+            } else {
+                // thin packs may refer to objects stored elsewhere
+                type = read(baseHash, base);
+                break;
+            }
+        } else if (t >= OBJ_COMMIT and t <= OBJ_TAG) {
+            type = static_cast<ObjectType>(t);
+            Inflate(x, end - x, size, base);
+            if (not deltas.empty()) {
+                // remember the base of the chain
+                if (deltaBasesSize_ + base.size() > MaxDeltaBasesSize) {
+                    deltaBases_.clear();
+                    deltaBasesSize_ = 0;
+                }
+                deltaBases_[key] = std::make_pair(type, base);
+                deltaBasesSize_ += base.size();
+            }
+            break;
+        } else {
+            throw std::runtime_error(STR("Invalid pack object type " << t << " in " << gitDir_));
+        }
+    }
+    if (deltas.empty()) {
+        into = std::move(base);
+        return type;
+    }
+    std::string result;
+    for (auto i = deltas.rbegin(), e = deltas.rend(); i != e; ++i) {
+        ApplyDelta(base, *i, result);
+        std::swap(base, result);
+    }
+    // trees are often bases of further deltas
+    if (type == ObjectType::Tree and deltaBasesSize_ + base.size() <= MaxDeltaBasesSize) {
+        deltaBases_[(static_cast<uint64_t>(packIndex) << 48) | firstOffset] = std::make_pair(type, base);
+        deltaBasesSize_ += base.size();
+    }
+    into = std::move(base);
+    return type;
+}
+
+// Loose objects & refs ---------------------------------------------------------------------------
+
+bool GitRepository::readLoose(SHA1 const & hash, ObjectType & type, std::string & into) {
+    std::string hex = STR(hash);
+    std::string filename = STR(objectsPath() << "/" << hex.substr(0, 2) << "/" << hex.substr(2));
+    if (not isFile(filename))
+        return false;
+    std::string raw;
+    InflateAll(LoadEntireFile(filename), raw);
+    std::size_t space = raw.find(' ');
+    std::size_t zero = raw.find('\0');
+    if (space == std::string::npos or zero == std::string::npos or space > zero)
+        throw std::runtime_error(STR("Invalid loose object " << filename));
+    type = TypeFromName(raw.substr(0, space));
+    into = raw.substr(zero + 1);
+    return true;
+}
+
+void GitRepository::loadPackedRefs() {
+    if (packedRefsLoaded_)
+        return;
+    packedRefsLoaded_ = true;
+    std::string filename = gitDir_ + "/packed-refs";
+    if (not isFile(filename))
+        return;
+    std::string refs = LoadEntireFile(filename);
+    std::size_t i = 0;
+    while (i < refs.size()) {
+        std::size_t eol = refs.find('\n', i);
+        if (eol == std::string::npos)
+            eol = refs.size();
+        // skip comments and peeled tag lines
+        if (refs[i] != '#' and refs[i] != '^' and eol - i > 41)
+            packedRefs_[refs.substr(i + 41, eol - i - 41)] = SHA1(refs.substr(i, 40));
+        i = eol + 1;
+    }
+}
+
+bool GitRepository::readRef(std::string const & name, SHA1 & result, unsigned depth) {
+    if (depth > 10)
+        throw std::runtime_error(STR("Too many levels of symbolic refs for " << name));
+    std::string filename = gitDir_ + "/" + name;
+    if (isFile(filename)) {
+        std::string x = LoadEntireFile(filename);
+        if (x.compare(0, 5, "ref: ") == 0) {
+            std::size_t eol = x.find('\n');
+            return readRef(x.substr(5, eol == std::string::npos ? std::string::npos : eol - 5), result, depth + 1);
+        }
+        if (x.size() < 40)
+            throw std::runtime_error(STR("Invalid ref file " << filename));
+        result = SHA1(x.substr(0, 40));
+        return true;
+    }
+    loadPackedRefs();
+    auto i = packedRefs_.find(name);
+    if (i == packedRefs_.end())
+        return false;
+    result = i->second;
+    return true;
+}
+
+void GitRepository::collectRemoteRefs(std::string const & path, std::string const & prefix, std::unordered_set<std::string> & into) {
+    for (std::string const & name : listDirectory(path)) {
+        std::string full = path + "/" + name;
+        if (isDirectory(full)) {
+            collectRemoteRefs(full, prefix + name + "/", into);
+        } else {
+            // symbolic refs, such as origin/HEAD are not branches
+            std::string x = LoadEntireFile(full);
+            if (x.compare(0, 5, "ref: ") != 0)
+                into.insert(prefix + name);
+        }
+    }
+}
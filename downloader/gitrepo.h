@@ -0,0 +1,172 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "include/hash.h"
+#include "include/filesystem.h"
+
+/** Native, in-process reader of git repositories.
+
+  Reads loose objects, pack files (including OFS and REF delta chains), packed-refs and remote refs straight from the git directory so that the history of a project can be walked without spawning any git processes. Only the read-only subset of git the downloader needs is supported.
+
+  A repository object is not thread safe, but this is fine since each project is analyzed by a single thread.
+ */
+class GitRepository {
+public:
+
+    enum class ObjectType {
+        None = 0,
+        Commit = 1,
+        Tree = 2,
+        Blob = 3,
+        Tag = 4,
+    };
+
+    /** Parsed commit object, only the parts we are interested in.
+     */
+    struct CommitInfo {
+        SHA1 tree;
+        std::vector<SHA1> parents;
+        /** Author time, which is what git log's %at reports. */
+        int authorTime;
+        /** Committer time, which git log uses to order the commits. */
+        int commitTime;
+    };
+
+    /** Single entry of a tree object.
+     */
+    struct TreeEntry {
+        unsigned mode;
+        std::string name;
+        SHA1 hash;
+
+        bool isTree() const {
+            return mode == 040000;
+        }
+    };
+
+    /** Single change between two trees, in the same form as reported by git diff-tree -r --no-renames.
+     */
+    struct Change {
+        /** A for added, M for modified, D for deleted and T for type changes, such as file to symlink. */
+        char type;
+        std::string relPath;
+        SHA1 oldHash;
+        SHA1 newHash;
+    };
+
+    /** Returns the repository at given path, opening it if it has not been opened yet.
+     */
+    static std::shared_ptr<GitRepository> Open(std::string const & path);
+
+    /** Forgets the opened repository at given path.
+
+      Must be called whenever the repository is deleted, or changed by an external git process.
+     */
+    static void Release(std::string const & path);
+
+    GitRepository(std::string const & path);
+
+    GitRepository(GitRepository const &) = delete;
+    GitRepository & operator = (GitRepository const &) = delete;
+
+    /** Returns names of all remote branches in the same format as git branch -r, i.e. origin/master. Symbolic refs are ignored.
+     */
+    std::unordered_set<std::string> remoteBranches();
+
+    /** Resolves the given branch, ref name, or hex hash to a commit hash. Annotated tags are peeled.
+     */
+    SHA1 resolve(std::string const & name);
+
+    /** Returns true if the object is present in the repository.
+
+      Blobless clones only have the blobs they have explicitly fetched.
+     */
+    bool contains(SHA1 const & hash);
+
+    /** Reads the object of given hash into the provided string and returns its type.
+
+      Throws if the object does not exist.
+     */
+    ObjectType read(SHA1 const & hash, std::string & into);
+
+    std::string readBlob(SHA1 const & hash);
+
+    CommitInfo readCommit(SHA1 const & hash);
+
+    std::vector<TreeEntry> readTree(SHA1 const & hash);
+
+    /** Returns the hash of the object at given path in the tree, or throws if there is no such object.
+     */
+    SHA1 findPath(SHA1 const & tree, std::string const & relPath);
+
+    /** Recursively diffs the two trees and appends all changed non-tree entries to the given vector.
+
+      If the old tree is nullptr, the new tree is compared against empty tree, i.e. all its entries are reported as added. Unchanged subtrees are never read.
+     */
+    void diffTrees(SHA1 const * oldTree, SHA1 const & newTree, std::vector<Change> & into);
+
+    std::string objectsPath() const {
+        return gitDir_ + "/objects";
+    }
+
+private:
+
+    class Pack {
+    public:
+        Pack(std::string const & idxPath, std::string const & packPath);
+
+        /** Finds the given hash in the pack's index and returns its offset, or 0 if not present.
+         */
+        uint64_t find(SHA1 const & hash) const;
+
+        MappedFile idx;
+        MappedFile pack;
+
+    private:
+        uint32_t count_;
+        unsigned char const * fanout_;
+        unsigned char const * names_;
+        unsigned char const * offsets_;
+        unsigned char const * offsets64_;
+    };
+
+    void loadPacks();
+
+    void loadPackedRefs();
+
+    bool readRef(std::string const & name, SHA1 & result, unsigned depth = 0);
+
+    bool readLoose(SHA1 const & hash, ObjectType & type, std::string & into);
+
+    ObjectType readPacked(size_t packIndex, uint64_t offset, std::string & into);
+
+    void diffTrees(std::vector<TreeEntry> const & oldEntries, std::vector<TreeEntry> const & newEntries, std::string const & prefix, std::vector<Change> & into);
+
+    void reportTree(SHA1 const & tree, char type, std::string const & prefix, std::vector<Change> & into);
+
+    void collectRemoteRefs(std::string const & path, std::string const & prefix, std::unordered_set<std::string> & into);
+
+    std::string gitDir_;
+
+    std::vector<std::unique_ptr<Pack>> packs_;
+    std::unordered_set<std::string> loadedPacks_;
+
+    bool packedRefsLoaded_;
+    std::unordered_map<std::string, SHA1> packedRefs_;
+
+    /** Recently reconstructed delta bases, keyed by pack and offset.
+
+      Delta chains in packs usually share their bases so keeping them around avoids inflating the same base over and over. The key is the pack index in the top 16 bits and the offset in the rest.
+     */
+    std::unordered_map<uint64_t, std::pair<ObjectType, std::string>> deltaBases_;
+    size_t deltaBasesSize_;
+
+    static std::mutex openGuard_;
+    static std::unordered_map<std::string, std::shared_ptr<GitRepository>> open_;
+};
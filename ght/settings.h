@@ -1,6 +1,8 @@
 #pragma once
 
 #include <mutex>
+#include <string>
+#include <vector>
 #include "include/utils.h"
 
 
@@ -55,9 +57,65 @@ public:
         static std::vector<std::string> DenyContents;
 
         static bool CompressFileContents;
+        /** If true, file contents are appended to large segment files in the contents folder, see ContentStore, instead of being stored as a file per content in the files folder. */
+        static bool ContentSegments;
+        /** Size in bytes over which the active content segment is closed so that it can be sealed and compressed. */
+        static size_t SegmentSize;
+        /** Size in bytes of the blocks in which sealed content segments are compressed. Larger blocks compress better, but more has to be decompressed to read a single content. */
+        static unsigned SegmentBlockSize;
+        /** Maximal number of deltas between a content and the nearest full content. If not 0, a new version of a file in the content segments is stored as a delta against its previous version when that saves at least half of its size, until the chain reaches this length and the next version is stored in full. Longer chains store less, but reads must apply more deltas. */
+        static unsigned ContentDeltaDepth;
+        /** Size in bytes of the compression dictionaries trained for each suffix in AllowSuffix, 0 disables the dictionaries. Small contents in the content segments are then compressed one by one with the dictionary of their suffix instead of in blocks, so that reading them does not decompress a whole block. */
+        static size_t ContentDictionarySize;
+        /** Number of shard files of each of the global columnar tables of projects, branches, commits and snapshots in the tables folder, see Table. Projects are assigned to the shards by their ids. The tables are written in addition to the csv files of each project, 0 disables them. */
+        static unsigned TableShards;
+        /** Approximate number of bytes the analysis of a single project may keep for the whole project, i.e. its commits, paths and last snapshot ids, see Project::memory(). A project over the budget fails, 0 means no budget. The peak of each project is reported in its log. */
+        static size_t ProjectMemoryBudget;
+        /** If true, contents are compressed by a pool of MaxCompressorThreads threads, otherwise by the downloaders themselves. */
         static bool CompressInExtraThread;
         static int MaxCompressorThreads;
+        /** Number of compression jobs that may wait for the compressor threads, downloaders block when the queue is full. */
+        static size_t CompressionQueueSize;
         static bool KeepRepos;
+        /** If true, projects go through a pipeline of stages, i.e. clone, metadata, snapshots, write and delete, each with a pool of threads of its own, so that projects are cloned while earlier ones are analyzed. Otherwise each of NumThreads threads takes a project through all stages. */
+        static bool Pipeline;
+        /** Number of threads of the clone, metadata, write and delete stages of the pipeline, the snapshots stage has NumThreads threads. */
+        static unsigned CloneThreads;
+        static unsigned MetadataThreads;
+        static unsigned WriteThreads;
+        static unsigned DeleteThreads;
+        /** Number of projects that may wait for each stage of the pipeline after the clone. A stage handing a project over to a full stage blocks, so clones get at most this many projects ahead of the analysis. */
+        static size_t StageQueueSize;
+        /** If true and Refresh is set, the projects of an input file are downloaded most expensive first, by the times their previous runs took, so that a large project does not keep the run going at the end while the other threads are idle. Projects without a previous run are expected to take as long as the average project. Without Refresh only projects not downloaded yet are, whose costs are unknown, so they are downloaded in the order of the file. */
+        static bool CostOrder;
+        /** Seconds the clone, metadata and snapshots stages of a project may take, 0 for no limit. Once a stage runs out of time, the watchdog kills its git processes and the project fails with a timeout. */
+        static double CloneTimeout;
+        static double MetadataTimeout;
+        static double SnapshotsTimeout;
+        /** Number of times a project that ran out of time is downloaded again, after all other projects are done and with its time budgets multiplied by TimeoutBudgetFactor each time. */
+        static unsigned TimeoutRetries;
+        static double TimeoutBudgetFactor;
+        /** Number of times a project that failed for a transient reason, i.e. a network error, the rate limit of the API, or a corrupt download, is tried again in the same run. It waits RetryBackoff seconds, or RateLimitBackoff seconds when rate limited, doubled with each attempt. */
+        static unsigned RetryAttempts;
+        static double RetryBackoff;
+        static double RateLimitBackoff;
+        /** If true, projects in the dead_projects.csv file of the target directory are not downloaded. Projects that do not exist, or that failed DeadAfterAttempts times over all runs (0 for no limit), are added to the file, which is kept across runs, delete it to try them again. */
+        static bool SkipDeadProjects;
+        static unsigned DeadAfterAttempts;
+        /** If true, the git history is read in-process instead of by spawning git for each commit. */
+        static bool NativeGit;
+        /** If true, all branches are analyzed in a single history walk instead of per branch. */
+        static bool StreamingHistory;
+        /** If true, projects are cloned without blobs and only blobs of the files that pass the language filter are fetched. */
+        static bool BloblessClone;
+        /** If true, projects downloaded by previous runs are scheduled again and updated incrementally, which is cheapest with KeepRepos, when only new commits are fetched. */
+        static bool Refresh;
+        /** If true, git and other processes are started by a small fork server so that their launch does not get slower as our heap grows. Only needed where posix_spawn falls back to fork, glibc's posix_spawn does not copy the address space, see Benchmark::ProcessLaunch. */
+        static bool ForkServer;
+        /** Size of the bloom filter in front of the content hashes index in bits, 0 disables the filter. About 10 bits per expected unique file keep the false positives around 1%. */
+        static size_t ContentBloomFilterBits;
+        /** Number of new content hashes after which the content index file is rewritten to include them, so that a restart only has to parse the content hashes written since. The index is always rewritten at the end of the run, 0 disables the periodic rewrites. */
+        static size_t ContentIndexCompaction;
 
     };
 
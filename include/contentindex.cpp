@@ -0,0 +1,384 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "utils.h"
+#include "contentindex.h"
+
+
+namespace {
+
+    /** Number of bits set in the bloom filter for each hash.
+     */
+    unsigned const BloomProbes = 3;
+
+    uint64_t Load64(unsigned char const * x) {
+        uint64_t result;
+        std::memcpy(&result, x, sizeof(result));
+        return result;
+    }
+
+    /** Header of the index file, followed by the fanout and the entries.
+     */
+    struct FileHeader {
+        char magic[8];
+        uint64_t count;
+        uint64_t covered;
+        uint64_t nextId;
+    };
+
+    char const FileMagic[8] = { 'G', 'H', 'T', 'C', 'I', 'D', 'X', '1' };
+
+    unsigned const FanoutSize = 65536;
+
+    unsigned Prefix(unsigned char const * hash) {
+        return (hash[0] << 8) | hash[1];
+    }
+
+} // anonymous namespace
+
+
+uint32_t const ContentIndex::Empty;
+
+// ContentIndex::Base -----------------------------------------------------------------------------
+
+ContentIndex::Base::Base(std::string const & filename):
+    file_(filename) {
+    FileHeader const * h = reinterpret_cast<FileHeader const *>(file_.data());
+    if (file_.size() < sizeof(FileHeader) + FanoutSize * 4 or std::memcmp(h->magic, FileMagic, 8) != 0)
+        throw std::ios_base::failure(STR("Invalid content index file " << filename));
+    count_ = h->count;
+    covered_ = h->covered;
+    nextId_ = h->nextId;
+    fanout_ = reinterpret_cast<uint32_t const *>(file_.data() + sizeof(FileHeader));
+    entries_ = reinterpret_cast<Entry const *>(fanout_ + FanoutSize);
+    if (file_.size() != sizeof(FileHeader) + FanoutSize * 4 + count_ * sizeof(Entry))
+        throw std::ios_base::failure(STR("Truncated content index file " << filename));
+}
+
+long ContentIndex::Base::find(SHA1 const & hash) const {
+    unsigned p = Prefix(hash.data());
+    uint32_t lo = p == 0 ? 0 : fanout_[p - 1];
+    uint32_t hi = fanout_[p];
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(entries_[mid].hash, hash.data(), 20);
+        if (cmp == 0)
+            return entries_[mid].id;
+        else if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+// ContentIndex -----------------------------------------------------------------------------------
+
+ContentIndex::ContentIndex(unsigned shards):
+    shardShift_(63),
+    nextId_(0),
+    size_(0),
+    added_(0),
+    bloomMask_(0),
+    bloomEpoch_(0) {
+    // at least two shards, shifting by 64 is undefined
+    unsigned n = 2;
+    while (n < shards) {
+        n *= 2;
+        --shardShift_;
+    }
+    numShards_ = n;
+    shards_.reset(new Shard[n]);
+}
+
+void ContentIndex::enableBloomFilter(size_t bits) {
+    if (bits == 0) {
+        bloom_.reset();
+        bloomMask_ = 0;
+        return;
+    }
+    size_t words = 1;
+    while (words * 64 < bits)
+        words *= 2;
+    bloom_.reset(new std::atomic<uint64_t>[words]);
+    for (size_t i = 0; i < words; ++i)
+        bloom_[i] = 0;
+    bloomMask_ = words * 64 - 1;
+}
+
+uint64_t ContentIndex::Mix(SHA1 const & hash) {
+    // murmur3's 64bit finalizer
+    uint64_t x = Load64(hash.data());
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t ContentIndex::open(std::string const & filename) {
+    if (not isFile(filename))
+        return 0;
+    std::shared_ptr<Base> b(new Base(filename));
+    std::atomic_store(&base_, b);
+    size_ = b->size();
+    long next = b->nextId();
+    if (next > nextId_)
+        nextId_ = next;
+    return b->covered();
+}
+
+void ContentIndex::compact(std::string const & filename, uint64_t covered) {
+    std::lock_guard<std::mutex> c(compactionGuard_);
+    // only the snapshot of the entries is taken under the shard locks, the file is written while the index is used as usual
+    std::vector<Entry> added;
+    long nextId;
+    {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (unsigned i = 0; i < numShards_; ++i)
+            locks.push_back(std::unique_lock<std::mutex>(shards_[i].guard));
+        added.reserve(added_);
+        for (unsigned i = 0; i < numShards_; ++i)
+            for (Entry const & e : shards_[i].entries)
+                if (e.id != Empty and shards_[i].pending.count(e.id) == 0)
+                    added.push_back(e);
+        nextId = nextId_;
+    }
+    auto less = [] (Entry const & a, Entry const & b) {
+        return std::memcmp(a.hash, b.hash, 20) < 0;
+    };
+    std::sort(added.begin(), added.end(), less);
+    // only compact replaces the base and compactions are serialized, so the base stays the same
+    std::shared_ptr<Base> old = base();
+    Entry const * oldBegin = old == nullptr ? nullptr : old->begin();
+    Entry const * oldEnd = old == nullptr ? nullptr : old->end();
+    FileHeader h;
+    std::memcpy(h.magic, FileMagic, 8);
+    h.count = (oldEnd - oldBegin) + added.size();
+    h.covered = covered;
+    h.nextId = nextId;
+    std::vector<uint32_t> fanout(FanoutSize, 0);
+    for (Entry const * e = oldBegin; e != oldEnd; ++e)
+        ++fanout[Prefix(e->hash)];
+    for (Entry const & e : added)
+        ++fanout[Prefix(e.hash)];
+    for (unsigned i = 1; i < FanoutSize; ++i)
+        fanout[i] += fanout[i - 1];
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream f = CheckedOpen(tmp);
+        f.write(reinterpret_cast<char const *>(&h), sizeof(h));
+        f.write(reinterpret_cast<char const *>(fanout.data()), FanoutSize * 4);
+        // both are sorted, merge them in chunks
+        std::vector<Entry> buffer;
+        buffer.reserve(65536);
+        auto i = added.begin();
+        while (oldBegin != oldEnd or i != added.end()) {
+            if (i == added.end() or (oldBegin != oldEnd and less(*oldBegin, *i)))
+                buffer.push_back(*oldBegin++);
+            else
+                buffer.push_back(*i++);
+            if (buffer.size() == buffer.capacity()) {
+                f.write(reinterpret_cast<char const *>(buffer.data()), buffer.size() * sizeof(Entry));
+                buffer.clear();
+            }
+        }
+        f.write(reinterpret_cast<char const *>(buffer.data()), buffer.size() * sizeof(Entry));
+        if (not f.good())
+            throw std::ios_base::failure(STR("Unable to write content index file " << tmp));
+    }
+    added.clear();
+    added.shrink_to_fit();
+    if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+        throw std::ios_base::failure(STR("Unable to replace content index file " << filename));
+    std::shared_ptr<Base> current(new Base(filename));
+    // while the entries are in both the base and the shards, they are found in the base, which is always checked first
+    std::atomic_store(&base_, current);
+    // the filter is rebuilt from the entries left in the shards, lookups that overlap the rebuild do not trust it, see find()
+    if (bloom_ != nullptr) {
+        ++bloomEpoch_;
+        for (uint64_t i = 0, e = (bloomMask_ + 1) / 64; i < e; ++i)
+            bloom_[i] = 0;
+    }
+    // the shards are locked one by one to drop the merged entries, so that only a single shard is blocked at a time
+    for (unsigned i = 0; i < numShards_; ++i) {
+        Shard & s = shards_[i];
+        std::lock_guard<std::mutex> g(s.guard);
+        std::vector<Entry> left;
+        for (Entry const & e : s.entries)
+            if (e.id != Empty and current->find(SHA1::FromBytes(e.hash)) == -1)
+                left.push_back(e);
+        added_ -= s.used - left.size();
+        std::unordered_set<uint32_t> pending;
+        pending.swap(s.pending);
+        s.clear();
+        for (Entry const & e : left) {
+            SHA1 h = SHA1::FromBytes(e.hash);
+            s.slot(h, Mix(h)) = e;
+            if (pending.count(e.id) != 0)
+                s.pending.insert(e.id);
+            if (++s.used * 10 > s.entries.size() * 7)
+                s.grow();
+            if (bloom_ != nullptr)
+                bloomAdd(h);
+        }
+        // entries assigned after the filter was cleared have their bits already
+    }
+    if (bloom_ != nullptr)
+        ++bloomEpoch_;
+}
+
+long ContentIndex::find(SHA1 const & hash) const {
+    std::shared_ptr<Base> b = base();
+    if (b != nullptr) {
+        long result = b->find(hash);
+        if (result != -1)
+            return result;
+    }
+    if (bloom_ != nullptr) {
+        // a miss proves nothing if compact was rebuilding the filter meanwhile, i.e. the epoch is odd or has changed
+        uint64_t epoch = bloomEpoch_.load(std::memory_order_acquire);
+        if (epoch % 2 == 0 and not bloomContains(hash) and bloomEpoch_.load(std::memory_order_acquire) == epoch) {
+            // compact may have moved the hash to a new base since the base was checked
+            std::shared_ptr<Base> current = base();
+            if (current != b)
+                return current->find(hash);
+            return -1;
+        }
+    }
+    uint64_t mixed = Mix(hash);
+    Shard & s = shard(mixed);
+    std::lock_guard<std::mutex> g(s.guard);
+    Entry const & e = s.slot(hash, mixed);
+    if (e.id != Empty)
+        return e.id;
+    // the hash may have just been moved to a new base by compact
+    std::shared_ptr<Base> current = base();
+    if (current != b)
+        return current->find(hash);
+    return -1;
+}
+
+long ContentIndex::assign(SHA1 const & hash, bool & created) {
+    created = false;
+    // hits in the base need no locking at all, entries are never removed from it
+    std::shared_ptr<Base> b = base();
+    if (b != nullptr) {
+        long result = b->find(hash);
+        if (result != -1)
+            return result;
+    }
+    uint64_t mixed = Mix(hash);
+    Shard & s = shard(mixed);
+    std::lock_guard<std::mutex> g(s.guard);
+    Entry & e = s.slot(hash, mixed);
+    if (e.id != Empty)
+        return e.id;
+    std::shared_ptr<Base> current = base();
+    if (current != b) {
+        long result = current->find(hash);
+        if (result != -1)
+            return result;
+    }
+    created = true;
+    std::memcpy(e.hash, hash.data(), 20);
+    e.id = nextId_++;
+    s.pending.insert(e.id);
+    long result = e.id;
+    // the filter is updated while still holding the lock so that a find that misses in the filter can never miss an id returned by assign
+    if (bloom_ != nullptr)
+        bloomAdd(hash);
+    ++size_;
+    ++added_;
+    if (++s.used * 10 > s.entries.size() * 7)
+        s.grow();
+    return result;
+}
+
+void ContentIndex::insert(SHA1 const & hash, long id) {
+    std::shared_ptr<Base> b = base();
+    if (b != nullptr and b->find(hash) != -1)
+        return;
+    uint64_t mixed = Mix(hash);
+    Shard & s = shard(mixed);
+    std::lock_guard<std::mutex> g(s.guard);
+    Entry & e = s.slot(hash, mixed);
+    bool isNew = e.id == Empty;
+    std::memcpy(e.hash, hash.data(), 20);
+    e.id = id;
+    long next = nextId_;
+    while (next <= id and not nextId_.compare_exchange_weak(next, id + 1)) { }
+    if (not isNew)
+        return;
+    if (bloom_ != nullptr)
+        bloomAdd(hash);
+    ++size_;
+    ++added_;
+    if (++s.used * 10 > s.entries.size() * 7)
+        s.grow();
+}
+
+void ContentIndex::persisted(SHA1 const & hash) {
+    uint64_t mixed = Mix(hash);
+    Shard & s = shard(mixed);
+    std::lock_guard<std::mutex> g(s.guard);
+    Entry const & e = s.slot(hash, mixed);
+    if (e.id != Empty)
+        s.pending.erase(e.id);
+}
+
+ContentIndex::Entry & ContentIndex::Shard::slot(SHA1 const & hash, uint64_t mixed) {
+    size_t mask = entries.size() - 1;
+    size_t i = mixed & mask;
+    while (true) {
+        Entry & e = entries[i];
+        if (e.id == Empty or std::memcmp(e.hash, hash.data(), 20) == 0)
+            return e;
+        i = (i + 1) & mask;
+    }
+}
+
+void ContentIndex::Shard::grow() {
+    std::vector<Entry> old(entries.size() * 2);
+    std::swap(old, entries);
+    for (Entry & e : entries)
+        e.id = Empty;
+    for (Entry const & e : old) {
+        if (e.id == Empty)
+            continue;
+        SHA1 h = SHA1::FromBytes(e.hash);
+        slot(h, Mix(h)) = e;
+    }
+}
+
+void ContentIndex::Shard::clear() {
+    std::vector<Entry> empty(16);
+    std::swap(empty, entries);
+    for (Entry & e : entries)
+        e.id = Empty;
+    used = 0;
+    pending.clear();
+}
+
+bool ContentIndex::bloomContains(SHA1 const & hash) const {
+    uint64_t a = Load64(hash.data() + 8);
+    uint64_t b = Load64(hash.data() + 12) | 1;
+    for (unsigned i = 0; i < BloomProbes; ++i) {
+        uint64_t bit = (a + i * b) & bloomMask_;
+        // acquire pairs with compact clearing the filter only after storing the new base and changing the epoch
+        if ((bloom_[bit / 64].load(std::memory_order_acquire) & (1ULL << (bit % 64))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void ContentIndex::bloomAdd(SHA1 const & hash) {
+    uint64_t a = Load64(hash.data() + 8);
+    uint64_t b = Load64(hash.data() + 12) | 1;
+    for (unsigned i = 0; i < BloomProbes; ++i) {
+        uint64_t bit = (a + i * b) & bloomMask_;
+        bloom_[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+    }
+}
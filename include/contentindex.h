@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+
+#include "hash.h"
+#include "filesystem.h"
+
+/** Concurrent index of content hashes to content ids.
+
+  The index is split into shards by the top bits of the hash, each shard is an open addressing table guarded by its own lock, so that threads only contend when they hit the same shard. Entries are stored as the raw 20 bytes of the hash and a 32bit id, 24 bytes per entry. Since the keys are SHA1 hashes, which are already uniformly distributed, the hash of the key is just its first 8 bytes mixed by a 64bit finalizer.
+
+  Optionally the index has a bloom filter, which answers most lookups of hashes that are not in the index without taking any locks.
+
+  Content ids are allocated atomically in the order the hashes are assigned, continuing after the largest id inserted explicitly.
+
+  The index can be persisted in a compact file, which is later memory mapped read-only as the base of the index, so that opening the index takes no time regardless of its size. The shards then only hold the hashes added since, and are merged into a new base file by compact(). The file is a header, a 65536 entries fanout table of the first two bytes of the hashes and the entries sorted by their hashes, 24 bytes each.
+ */
+class ContentIndex {
+public:
+
+    /** Creates the index with given number of shards, which is rounded up to a power of two.
+     */
+    ContentIndex(unsigned shards = 256);
+
+    ContentIndex(ContentIndex const &) = delete;
+    ContentIndex & operator = (ContentIndex const &) = delete;
+
+    /** Enables the bloom filter of given size in bits (rounded up to a power of two), or disables it if the size is 0.
+
+      Must be called before the index is used. A good size is about 10 bits per expected entry.
+     */
+    void enableBloomFilter(size_t bits);
+
+    /** Maps the given index file, written by compact(), as the base of the index. Must be called before the index is used.
+
+      Returns the value of covered given to compact() when the file was written, or 0 if the file does not exist.
+     */
+    uint64_t open(std::string const & filename);
+
+    /** Merges the base and all hashes added since into a new index file, which then becomes the new base.
+
+      The file is written under a temporary name and renamed when complete, so it can replace the current base. The covered argument is stored in the file and returned by open(), which allows the caller to remember what part of its own log of hashes the file already contains. Hashes assigned by assign() that have not been marked persisted() yet are not written to the file and stay in memory. Other operations only wait while the hashes are collected, and while their shard is cleaned up after the new base is in place.
+     */
+    void compact(std::string const & filename, uint64_t covered);
+
+    /** Returns the id of the given hash, or -1 if the hash is not in the index.
+     */
+    long find(SHA1 const & hash) const;
+
+    /** Returns the id of the given hash, assigning it the next free id if it is not in the index yet. Created is set to true if the id was assigned by this call.
+     */
+    long assign(SHA1 const & hash, bool & created);
+
+    /** Inserts the hash with given id, such as one loaded from a previous run. Ids assigned later are larger than any inserted id.
+     */
+    void insert(SHA1 const & hash, long id);
+
+    /** Marks the hash created by assign() as persisted by the caller, such as written to its log of hashes, so that compact() may write it to the index file.
+     */
+    void persisted(SHA1 const & hash);
+
+    /** Returns the number of hashes in the index.
+     */
+    size_t size() const {
+        return size_;
+    }
+
+    /** Returns the number of hashes held in memory, i.e. not in the mapped base.
+     */
+    size_t added() const {
+        return added_;
+    }
+
+    /** Mixes the first 64 bits of the hash, see std::hash<Hash<BYTES>>.
+     */
+    static uint64_t Mix(SHA1 const & hash);
+
+private:
+
+    struct Entry {
+        unsigned char hash[20];
+        uint32_t id;
+    };
+
+    /** Read-only index file mapped to memory.
+     */
+    class Base {
+    public:
+        Base(std::string const & filename);
+
+        /** Returns the id of the given hash, or -1 if not present.
+         */
+        long find(SHA1 const & hash) const;
+
+        Entry const * begin() const {
+            return entries_;
+        }
+
+        Entry const * end() const {
+            return entries_ + count_;
+        }
+
+        uint64_t size() const {
+            return count_;
+        }
+
+        uint64_t covered() const {
+            return covered_;
+        }
+
+        uint64_t nextId() const {
+            return nextId_;
+        }
+
+    private:
+        MappedFile file_;
+        uint32_t const * fanout_;
+        Entry const * entries_;
+        uint64_t count_;
+        uint64_t covered_;
+        uint64_t nextId_;
+    };
+
+    struct Shard {
+        std::mutex guard;
+        std::vector<Entry> entries;
+        size_t used;
+        /** Ids created by assign() that are not persisted yet. */
+        std::unordered_set<uint32_t> pending;
+        /** Keeps the locks of neighboring shards in different cache lines. */
+        char padding[64];
+
+        Shard():
+            entries(16),
+            used(0) {
+            for (Entry & e : entries)
+                e.id = Empty;
+        }
+
+        /** Returns the slot of the given hash, or the empty slot where it should be inserted.
+         */
+        Entry & slot(SHA1 const & hash, uint64_t mixed);
+
+        Entry const & slot(SHA1 const & hash, uint64_t mixed) const {
+            return const_cast<Shard *>(this)->slot(hash, mixed);
+        }
+
+        void grow();
+
+        void clear();
+    };
+
+    static uint32_t const Empty = 0xffffffff;
+
+    Shard & shard(uint64_t mixed) const {
+        return shards_[mixed >> shardShift_];
+    }
+
+    /** The bloom filter uses bits of the hash other than those used by Mix, which are independent since SHA1 is uniformly distributed.
+     */
+    bool bloomContains(SHA1 const & hash) const;
+
+    void bloomAdd(SHA1 const & hash);
+
+    /** Returns the current base, which may be replaced by compact() at any time. Entries merged into a new base are removed from their shard only after it is in place.
+     */
+    std::shared_ptr<Base> base() const {
+        return std::atomic_load(&base_);
+    }
+
+    std::shared_ptr<Base> base_;
+
+    std::unique_ptr<Shard[]> shards_;
+    unsigned shardShift_;
+    unsigned numShards_;
+
+    std::atomic<long> nextId_;
+    std::atomic<size_t> size_;
+    std::atomic<size_t> added_;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> bloom_;
+    uint64_t bloomMask_;
+    /** Incremented by compact() before and after it rebuilds the filter, so that it is odd while the filter may miss hashes of the index. */
+    std::atomic<uint64_t> bloomEpoch_;
+
+    /** Serializes compact(), which is the only one to replace the base. */
+    std::mutex compactionGuard_;
+};
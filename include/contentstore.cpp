@@ -0,0 +1,751 @@
+#include <zlib.h>
+#include <lzma.h>
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#include "utils.h"
+#include "filesystem.h"
+#include "delta.h"
+#include "dictionary.h"
+#include "contentstore.h"
+
+
+namespace {
+
+    unsigned SegmentNumber(std::string const & name, char const * extension) {
+        size_t ext = std::strlen(extension);
+        if (name.size() <= 8 + ext or name.compare(0, 8, "segment_") != 0 or name.compare(name.size() - ext, ext, extension) != 0)
+            return -1;
+        return std::stoul(name.substr(8, name.size() - 8 - ext));
+    }
+
+    /** The LZMA2 window for a content compressed with a dictionary must hold both, the decoder computes the same window from the sizes it knows.
+     */
+    uint32_t DictionaryWindow(size_t dictionary, size_t size) {
+        uint32_t result = LZMA_DICT_SIZE_MIN;
+        while (result < dictionary + size)
+            result *= 2;
+        return result;
+    }
+
+} // anonymous namespace
+
+uint8_t const ContentStore::UnknownDepth;
+size_t const ContentStore::SmallContent;
+
+ContentStore::ContentStore():
+    segmentSize_(0),
+    blockSize_(0),
+    nextSegment_(0),
+    active_(-1),
+    rawSize_(0),
+    maxDeltaDepth_(0),
+    dictionarySize_(0),
+    dictionaries_(1, std::make_shared<std::string const>()),
+    currentDictionaries_(256, 0),
+    samples_(256),
+    sampleSizes_(256, 0),
+    trained_(256, false),
+    cacheSize_(0),
+    cacheLimit_(64 * 1024 * 1024) {
+    static_assert(sizeof(Entry) == 32, "Content store index entries must be 32 bytes");
+}
+
+ContentStore::~ContentStore() {
+    close();
+}
+
+std::string ContentStore::segmentFile(unsigned segment, char const * extension) const {
+    return STR(path_ << "/segment_" << segment << extension);
+}
+
+std::vector<unsigned> ContentStore::open(std::string const & path, uint64_t segmentSize, uint32_t blockSize) {
+    path_ = path;
+    segmentSize_ = segmentSize;
+    blockSize_ = blockSize;
+    createPathIfMissing(path_);
+    std::vector<unsigned> unsealed;
+    for (std::string const & name : listDirectory(path_)) {
+        unsigned n = SegmentNumber(name, ".idx");
+        if (n == static_cast<unsigned>(-1))
+            continue;
+        if (n >= nextSegment_)
+            nextSegment_ = n + 1;
+        if (not isFile(segmentFile(n, ".raw")))
+            continue;
+        // the raw file is only deleted after the sealed index is in place
+        std::ifstream f(segmentFile(n, ".idx"), std::ios::binary);
+        Entry e;
+        if (f.read(reinterpret_cast<char *>(&e), sizeof(e)) and e.codec != Codec::None)
+            std::remove(segmentFile(n, ".raw").c_str());
+        else
+            unsealed.push_back(n);
+    }
+    for (std::string const & name : listDirectory(path_)) {
+        unsigned number;
+        unsigned category;
+        if (name.size() <= 16 or name.compare(0, 11, "dictionary_") != 0 or name.compare(name.size() - 5, 5, ".dict") != 0)
+            continue;
+        if (std::sscanf(name.c_str(), "dictionary_%u_%u", & number, & category) != 2 or number == 0 or number > 255 or category > 255)
+            continue;
+        if (dictionaries_.size() <= number)
+            dictionaries_.resize(number + 1);
+        dictionaries_[number].reset(new std::string(LoadEntireFile(STR(path_ << "/" << name))));
+        if (number > currentDictionaries_[category])
+            currentDictionaries_[category] = number;
+    }
+    return unsealed;
+}
+
+long ContentStore::append(long id, std::string const & contents, uint8_t category) {
+    sample(contents, category);
+    return appendEntry(id, contents, 0, category);
+}
+
+long ContentStore::append(long id, std::string const & contents, uint8_t category, long baseId, std::function<std::string()> const & baseLoader) {
+    sample(contents, category);
+    if (maxDeltaDepth_ == 0 or baseId < 0)
+        return appendEntry(id, contents, 0, category);
+    unsigned depth = UnknownDepth;
+    {
+        std::lock_guard<std::mutex> g(guard_);
+        if (static_cast<size_t>(baseId) < depths_.size() and depths_[baseId] != UnknownDepth)
+            depth = depths_[baseId] + 1;
+    }
+    if (depth > maxDeltaDepth_)
+        return appendEntry(id, contents, 0, category);
+    std::string delta;
+    Delta::WriteVarint(delta, baseId);
+    delta += Delta::Encode(baseLoader(), contents);
+    // deltas that do not save much are not worth the slower reads
+    if (delta.size() > contents.size() / 2)
+        return appendEntry(id, contents, 0, category);
+    return appendEntry(id, delta, depth, category);
+}
+
+void ContentStore::setMaxDeltaDepth(unsigned depth) {
+    maxDeltaDepth_ = std::min(depth, static_cast<unsigned>(UnknownDepth - 1));
+}
+
+void ContentStore::setDictionarySize(size_t bytes) {
+    dictionarySize_ = bytes;
+}
+
+long ContentStore::appendEntry(long id, std::string const & contents, uint8_t depth, uint8_t category) {
+    std::lock_guard<std::mutex> g(guard_);
+    if (active_ == -1) {
+        active_ = nextSegment_++;
+        raw_ = std::ofstream(segmentFile(active_, ".raw"), std::ios::binary | std::ios::out);
+        index_ = std::ofstream(segmentFile(active_, ".idx"), std::ios::binary | std::ios::out);
+        if (not raw_.good() or not index_.good())
+            throw std::ios_base::failure(STR("Unable to create segment " << active_ << " in " << path_));
+        rawSize_ = 0;
+    }
+    Entry e;
+    std::memset(&e, 0, sizeof(e));
+    e.id = id;
+    e.length = contents.size();
+    e.offset = rawSize_;
+    e.compressedLength = contents.size();
+    e.blockLength = contents.size();
+    e.codec = Codec::None;
+    e.depth = depth;
+    e.category = category;
+    raw_.write(contents.data(), contents.size());
+    index_.write(reinterpret_cast<char const *>(&e), sizeof(e));
+    if (not raw_.good() or not index_.good())
+        throw std::ios_base::failure(STR("Unable to append to segment " << active_ << " in " << path_));
+    rawSize_ += contents.size();
+    if (maxDeltaDepth_ > 0) {
+        if (depths_.size() <= static_cast<size_t>(id))
+            depths_.resize(std::max(static_cast<size_t>(id) + 1, depths_.size() * 2), UnknownDepth);
+        depths_[id] = depth;
+    }
+    if (rawSize_ < segmentSize_)
+        return -1;
+    long result = active_;
+    raw_.close();
+    index_.close();
+    active_ = -1;
+    return result;
+}
+
+void ContentStore::sample(std::string const & contents, uint8_t category) {
+    if (dictionarySize_ == 0 or category == 0 or contents.size() > SmallContent)
+        return;
+    std::vector<std::string> samples;
+    {
+        std::lock_guard<std::mutex> g(guard_);
+        // dictionary numbers are stored in a byte
+        if (trained_[category] or dictionaries_.size() > 255)
+            return;
+        samples_[category].push_back(contents);
+        sampleSizes_[category] += contents.size();
+        // the trainer needs samples of about a hundred times the size of the dictionary
+        if (sampleSizes_[category] < dictionarySize_ * 100)
+            return;
+        trained_[category] = true;
+        samples.swap(samples_[category]);
+        sampleSizes_[category] = 0;
+    }
+    std::shared_ptr<std::string const> d(new std::string(Dictionary::Train(samples, dictionarySize_)));
+    if (d->empty())
+        return;
+    std::lock_guard<std::mutex> g(guard_);
+    if (dictionaries_.size() > 255)
+        return;
+    unsigned number = dictionaries_.size();
+    // the dictionary must be complete on disk before any sealed index refers to it
+    std::string filename = STR(path_ << "/dictionary_" << number << "_" << static_cast<unsigned>(category) << ".dict");
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream f = CheckedOpen(tmp);
+        f.write(d->data(), d->size());
+        if (not f.good())
+            throw std::ios_base::failure(STR("Unable to write dictionary " << number << " in " << path_));
+    }
+    if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+        throw std::ios_base::failure(STR("Unable to write dictionary " << number << " in " << path_));
+    dictionaries_.push_back(d);
+    currentDictionaries_[category] = number;
+}
+
+void ContentStore::flush() {
+    std::lock_guard<std::mutex> g(guard_);
+    if (active_ == -1)
+        return;
+    // contents first so that the index never points past the end of the raw file
+    raw_.flush();
+    index_.flush();
+}
+
+long ContentStore::close() {
+    std::lock_guard<std::mutex> g(guard_);
+    long result = active_;
+    if (active_ != -1) {
+        raw_.close();
+        index_.close();
+        active_ = -1;
+    }
+    return result;
+}
+
+uint64_t ContentStore::seal(unsigned segment, Codec codec) {
+    std::string rawFile = segmentFile(segment, ".raw");
+    std::string indexFile = segmentFile(segment, ".idx");
+    std::vector<Entry> entries;
+    {
+        MappedFile index(indexFile);
+        Entry const * e = reinterpret_cast<Entry const *>(index.data());
+        entries.assign(e, e + index.size() / sizeof(Entry));
+    }
+    MappedFile raw(rawFile);
+    // entries of contents that did not make it to the disk before a crash are dropped
+    while (not entries.empty() and entries.back().offset + entries.back().length > raw.size())
+        entries.pop_back();
+    std::vector<uint8_t> current;
+    std::vector<std::shared_ptr<std::string const>> dictionaries;
+    {
+        std::lock_guard<std::mutex> g(guard_);
+        current = currentDictionaries_;
+        dictionaries = dictionaries_;
+    }
+    char const * contents = reinterpret_cast<char const *>(raw.data());
+    std::ofstream data = CheckedOpen(segmentFile(segment, ".dat"));
+    uint64_t offset = 0;
+    uint64_t bytes = 0;
+    std::string block;
+    std::vector<size_t> members;
+    auto writeBlock = [&] () {
+        if (members.empty())
+            return;
+        std::string compressed = Compress(block.data(), block.size(), codec);
+        data.write(compressed.data(), compressed.size());
+        for (size_t j : members) {
+            entries[j].offset = offset;
+            entries[j].compressedLength = compressed.size();
+            entries[j].blockLength = block.size();
+            entries[j].codec = codec;
+        }
+        offset += compressed.size();
+        bytes += block.size();
+        block.clear();
+        members.clear();
+    };
+    for (size_t i = 0; i < entries.size(); ++i) {
+        Entry & e = entries[i];
+        // small contents with a dictionary form a block of their own
+        uint8_t d = (codec != Codec::None and e.length <= SmallContent) ? current[e.category] : 0;
+        if (d != 0) {
+            std::string compressed = Compress(contents + e.offset, e.length, Codec::XzDictionary, *dictionaries[d]);
+            data.write(compressed.data(), compressed.size());
+            e.offset = offset;
+            e.compressedLength = compressed.size();
+            e.blockLength = e.length;
+            e.blockOffset = 0;
+            e.codec = Codec::XzDictionary;
+            e.dictionary = d;
+            offset += compressed.size();
+            bytes += e.length;
+            continue;
+        }
+        if (not members.empty() and block.size() + e.length > blockSize_)
+            writeBlock();
+        e.blockOffset = block.size();
+        block.append(contents + e.offset, e.length);
+        members.push_back(i);
+    }
+    writeBlock();
+    data.close();
+    if (not data)
+        throw std::ios_base::failure(STR("Unable to write sealed segment " << segment << " in " << path_));
+    // blocks stay in the order of the raw file, but the index is sorted by ids for reading
+    std::sort(entries.begin(), entries.end(), [] (Entry const & a, Entry const & b) {
+        return a.id < b.id;
+    });
+    std::string tmp = indexFile + ".tmp";
+    {
+        std::ofstream f = CheckedOpen(tmp);
+        f.write(reinterpret_cast<char const *>(entries.data()), entries.size() * sizeof(Entry));
+        if (not f.good())
+            throw std::ios_base::failure(STR("Unable to write index of sealed segment " << segment << " in " << path_));
+    }
+    if (std::rename(tmp.c_str(), indexFile.c_str()) != 0)
+        throw std::ios_base::failure(STR("Unable to replace index of segment " << segment << " in " << path_));
+    std::remove(rawFile.c_str());
+    return bytes;
+}
+
+std::string ContentStore::read(long id) {
+    load();
+    Segment const * s;
+    Entry const * e = find(id, s);
+    if (e == nullptr)
+        throw std::runtime_error(STR("Content id " << id << " not found in " << path_));
+    return resolve(*e, extract(*s, *e));
+}
+
+std::vector<std::string> ContentStore::read(std::vector<long> const & ids) {
+    load();
+    std::vector<std::pair<Segment const *, Entry const *>> entries;
+    entries.reserve(ids.size());
+    for (long id : ids) {
+        Segment const * s;
+        Entry const * e = find(id, s);
+        if (e == nullptr)
+            throw std::runtime_error(STR("Content id " << id << " not found in " << path_));
+        entries.push_back(std::make_pair(s, e));
+    }
+    // reading in the order of the blocks needs each block only once, while it is the most recently used one
+    std::vector<size_t> order(ids.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+        return BlockKey(*entries[a].first, *entries[a].second) < BlockKey(*entries[b].first, *entries[b].second);
+    });
+    std::vector<std::string> result(ids.size());
+    // the current block is kept here too, so that it is decompressed once even if the cache is too small
+    uint64_t lastKey = 0;
+    std::shared_ptr<std::string const> last;
+    for (size_t i : order) {
+        Segment const & s = *entries[i].first;
+        Entry const & e = *entries[i].second;
+        if (e.codec == Codec::None) {
+            result[i] = resolve(e, extract(s, e));
+            continue;
+        }
+        if (last == nullptr or BlockKey(s, e) != lastKey) {
+            last = block(s, e);
+            lastKey = BlockKey(s, e);
+        }
+        result[i] = resolve(e, last->substr(e.blockOffset, e.length));
+    }
+    return result;
+}
+
+bool ContentStore::contains(long id) {
+    load();
+    Segment const * s;
+    return find(id, s) != nullptr;
+}
+
+void ContentStore::setCacheSize(size_t bytes) {
+    std::lock_guard<std::mutex> g(cacheGuard_);
+    cacheLimit_ = bytes;
+    while (cacheSize_ > cacheLimit_ and not cache_.empty()) {
+        cacheSize_ -= cache_.back().second->size();
+        cacheIndex_.erase(cache_.back().first);
+        cache_.pop_back();
+    }
+}
+
+void ContentStore::scan(Reader const & reader, unsigned threads) {
+    if (threads <= 1) {
+        Iterator i(*this);
+        while (i.next())
+            reader(i.id(), i.contents());
+        return;
+    }
+    load();
+    // blocks in the order of their smallest ids, which is the order in which the merge of the segments by ids needs them
+    struct Block {
+        Segment const * segment;
+        Entry const * entry;
+        uint32_t firstId;
+        /** Number of contents of the block the reader has not seen yet. */
+        size_t remaining;
+        std::shared_ptr<std::string const> data;
+    };
+    std::vector<Block> blocks;
+    std::unordered_map<uint64_t, size_t> positions;
+    for (auto const & s : readSegments_) {
+        for (Entry const & e : s->entries) {
+            // uncompressed contents are read straight from the mapped raw file
+            if (e.codec == Codec::None)
+                continue;
+            auto i = positions.find(BlockKey(*s, e));
+            if (i == positions.end()) {
+                positions.insert(std::make_pair(BlockKey(*s, e), blocks.size()));
+                blocks.push_back(Block{s.get(), & e, e.id, 1, nullptr});
+            } else {
+                ++blocks[i->second].remaining;
+            }
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(), [] (Block const & a, Block const & b) {
+        return a.firstId < b.firstId;
+    });
+    for (size_t i = 0; i < blocks.size(); ++i)
+        positions[BlockKey(*blocks[i].segment, *blocks[i].entry)] = i;
+    std::mutex m;
+    std::condition_variable cv;
+    // blocks before released have been fully read, the decompressors stay within a window after them, unless the reader needs a block further away
+    size_t const window = threads * 4;
+    size_t released = 0;
+    size_t needed = 0;
+    size_t next = 0;
+    bool stop = false;
+    std::exception_ptr error;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&] () {
+            while (true) {
+                size_t p;
+                {
+                    std::unique_lock<std::mutex> g(m);
+                    while (not stop and next < blocks.size() and next >= released + window and next > needed)
+                        cv.wait(g);
+                    if (stop or next == blocks.size())
+                        return;
+                    p = next++;
+                }
+                try {
+                    Block const & b = blocks[p];
+                    std::shared_ptr<std::string const> data(new std::string(decompress(*b.segment, *b.entry)));
+                    std::lock_guard<std::mutex> g(m);
+                    blocks[p].data = data;
+                } catch (...) {
+                    std::lock_guard<std::mutex> g(m);
+                    if (error == nullptr)
+                        error = std::current_exception();
+                    stop = true;
+                }
+                cv.notify_all();
+            }
+        }));
+    }
+    auto finish = [&] () {
+        {
+            std::lock_guard<std::mutex> g(m);
+            stop = true;
+        }
+        cv.notify_all();
+        for (std::thread & t : workers)
+            t.join();
+    };
+    try {
+        Iterator merge(*this);
+        while (true) {
+            // the iterator reads uncompressed contents itself, but must not touch the blocks, so it is only used for the order
+            Segment const * s;
+            Entry const * e;
+            if (not merge.nextEntry(s, e))
+                break;
+            if (e->codec == Codec::None) {
+                reader(e->id, resolve(*e, std::string(reinterpret_cast<char const *>(s->data->data()) + e->offset, e->length)));
+                continue;
+            }
+            size_t p = positions[BlockKey(*s, *e)];
+            std::shared_ptr<std::string const> data;
+            {
+                std::unique_lock<std::mutex> g(m);
+                needed = p;
+                cv.notify_all();
+                while (blocks[p].data == nullptr and error == nullptr)
+                    cv.wait(g);
+                if (error != nullptr)
+                    std::rethrow_exception(error);
+                data = blocks[p].data;
+            }
+            // bases of deltas are read through the cache, which keeps the blocks of the bases of recent deltas
+            reader(e->id, resolve(*e, data->substr(e->blockOffset, e->length)));
+            std::lock_guard<std::mutex> g(m);
+            if (--blocks[p].remaining == 0) {
+                blocks[p].data.reset();
+                while (released < blocks.size() and blocks[released].remaining == 0)
+                    ++released;
+                cv.notify_all();
+            }
+        }
+    } catch (...) {
+        finish();
+        throw;
+    }
+    finish();
+}
+
+void ContentStore::load() {
+    std::call_once(loaded_, [this] () {
+        for (std::string const & name : listDirectory(path_)) {
+            unsigned n = SegmentNumber(name, ".idx");
+            if (n == static_cast<unsigned>(-1))
+                continue;
+            std::unique_ptr<Segment> s(new Segment());
+            s->number = n;
+            {
+                MappedFile index(segmentFile(n, ".idx"));
+                Entry const * e = reinterpret_cast<Entry const *>(index.data());
+                s->entries.assign(e, e + index.size() / sizeof(Entry));
+            }
+            if (s->entries.empty())
+                continue;
+            // the raw file is deleted only after the sealed index is in place, so the index says which one to read
+            bool sealed = s->entries.front().codec != Codec::None;
+            s->data.reset(new MappedFile(segmentFile(n, sealed ? ".dat" : ".raw")));
+            if (not sealed) {
+                while (not s->entries.empty() and s->entries.back().offset + s->entries.back().length > s->data->size())
+                    s->entries.pop_back();
+                // none of the contents made it to the raw file, sorting the segments and find() need the first entry
+                if (s->entries.empty())
+                    continue;
+                std::sort(s->entries.begin(), s->entries.end(), [] (Entry const & a, Entry const & b) {
+                    return a.id < b.id;
+                });
+            }
+            readSegments_.push_back(std::move(s));
+        }
+        std::sort(readSegments_.begin(), readSegments_.end(), [] (std::unique_ptr<Segment> const & a, std::unique_ptr<Segment> const & b) {
+            return a->entries.front().id < b->entries.front().id;
+        });
+    });
+}
+
+ContentStore::Entry const * ContentStore::find(long id, Segment const * & segment) {
+    auto byFirstId = [] (long id, std::unique_ptr<Segment> const & s) {
+        return id < s->entries.front().id;
+    };
+    auto byId = [] (Entry const & e, long id) {
+        return e.id < id;
+    };
+    // the id ranges of segments written at the same time overlap, so all segments starting before the id are candidates, the last one almost always has it
+    auto i = std::upper_bound(readSegments_.begin(), readSegments_.end(), id, byFirstId);
+    while (i != readSegments_.begin()) {
+        --i;
+        std::vector<Entry> const & entries = (*i)->entries;
+        if (entries.back().id < id)
+            continue;
+        auto e = std::lower_bound(entries.begin(), entries.end(), id, byId);
+        if (e != entries.end() and e->id == id) {
+            segment = i->get();
+            return & *e;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<std::string const> ContentStore::block(Segment const & segment, Entry const & e) {
+    uint64_t key = BlockKey(segment, e);
+    {
+        std::lock_guard<std::mutex> g(cacheGuard_);
+        auto i = cacheIndex_.find(key);
+        if (i != cacheIndex_.end()) {
+            cache_.splice(cache_.begin(), cache_, i->second);
+            return i->second->second;
+        }
+    }
+    // decompressed without holding the lock, two threads may rarely decompress the same block, which is harmless
+    std::shared_ptr<std::string const> result(new std::string(decompress(segment, e)));
+    std::lock_guard<std::mutex> g(cacheGuard_);
+    if (cacheIndex_.find(key) == cacheIndex_.end() and result->size() <= cacheLimit_) {
+        cache_.push_front(std::make_pair(key, result));
+        cacheIndex_.insert(std::make_pair(key, cache_.begin()));
+        cacheSize_ += result->size();
+        while (cacheSize_ > cacheLimit_) {
+            cacheSize_ -= cache_.back().second->size();
+            cacheIndex_.erase(cache_.back().first);
+            cache_.pop_back();
+        }
+    }
+    return result;
+}
+
+std::string ContentStore::extract(Segment const & segment, Entry const & e) {
+    if (e.codec == Codec::None)
+        return std::string(reinterpret_cast<char const *>(segment.data->data()) + e.offset, e.length);
+    return block(segment, e)->substr(e.blockOffset, e.length);
+}
+
+std::shared_ptr<std::string const> ContentStore::dictionary(uint8_t number) {
+    std::lock_guard<std::mutex> g(guard_);
+    if (number >= dictionaries_.size() or dictionaries_[number] == nullptr)
+        throw std::runtime_error(STR("Dictionary " << static_cast<unsigned>(number) << " not found in " << path_));
+    return dictionaries_[number];
+}
+
+std::string ContentStore::decompress(Segment const & segment, Entry const & e) {
+    char const * data = reinterpret_cast<char const *>(segment.data->data()) + e.offset;
+    if (e.dictionary == 0)
+        return Decompress(data, e.compressedLength, e.blockLength, e.codec);
+    return Decompress(data, e.compressedLength, e.blockLength, e.codec, *dictionary(e.dictionary));
+}
+
+std::string ContentStore::resolve(Entry const & e, std::string const & stored) {
+    if (e.depth == 0)
+        return stored;
+    size_t pos = 0;
+    long baseId = Delta::ReadVarint(stored.data(), stored.size(), pos);
+    return Delta::Apply(read(baseId), stored.data() + pos, stored.size() - pos);
+}
+
+// ContentStore::Iterator -------------------------------------------------------------------------
+
+ContentStore::Iterator::Iterator(ContentStore & store):
+    store_(store),
+    id_(-1) {
+    store_.load();
+    positions_.resize(store_.readSegments_.size(), 0);
+    for (size_t i = 0; i < positions_.size(); ++i)
+        heap_.push(std::make_pair(store_.readSegments_[i]->entries.front().id, i));
+}
+
+bool ContentStore::Iterator::next() {
+    Segment const * s;
+    Entry const * e;
+    if (not nextEntry(s, e))
+        return false;
+    id_ = e->id;
+    contents_ = store_.resolve(*e, store_.extract(*s, *e));
+    return true;
+}
+
+bool ContentStore::Iterator::nextEntry(Segment const * & segment, Entry const * & entry) {
+    if (heap_.empty())
+        return false;
+    size_t i = heap_.top().second;
+    heap_.pop();
+    segment = store_.readSegments_[i].get();
+    entry = & segment->entries[positions_[i]++];
+    if (positions_[i] < segment->entries.size())
+        heap_.push(std::make_pair(segment->entries[positions_[i]].id, i));
+    return true;
+}
+
+std::string ContentStore::Compress(char const * data, size_t size, Codec codec, std::string const & dictionary) {
+    switch (codec) {
+        case Codec::None:
+            return std::string(data, size);
+        case Codec::Deflate: {
+            uLongf length = compressBound(size);
+            std::string result(length, '\0');
+            if (compress2(reinterpret_cast<Bytef *>(& result[0]), & length, reinterpret_cast<Bytef const *>(data), size, Z_DEFAULT_COMPRESSION) != Z_OK)
+                throw std::runtime_error("Unable to deflate content block");
+            result.resize(length);
+            return result;
+        }
+        case Codec::Xz: {
+            // the default preset, but with the dictionary no larger than the block, which keeps the encoder's memory small for small blocks
+            lzma_options_lzma options;
+            lzma_lzma_preset(& options, LZMA_PRESET_DEFAULT);
+            uint32_t dictSize = LZMA_DICT_SIZE_MIN;
+            while (dictSize < size and dictSize < options.dict_size)
+                dictSize *= 2;
+            options.dict_size = dictSize;
+            lzma_filter filters[] = { { LZMA_FILTER_LZMA2, & options }, { LZMA_VLI_UNKNOWN, nullptr } };
+            std::string result(lzma_stream_buffer_bound(size), '\0');
+            size_t length = 0;
+            if (lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, nullptr, reinterpret_cast<uint8_t const *>(data), size, reinterpret_cast<uint8_t *>(& result[0]), & length, result.size()) != LZMA_OK)
+                throw std::runtime_error("Unable to xz content block");
+            result.resize(length);
+            return result;
+        }
+        case Codec::XzDictionary: {
+            // raw LZMA2, since the xz format does not support preset dictionaries, the decoder knows the sizes anyway
+            lzma_options_lzma options;
+            lzma_lzma_preset(& options, LZMA_PRESET_DEFAULT);
+            options.dict_size = DictionaryWindow(dictionary.size(), size);
+            options.preset_dict = dictionary.empty() ? nullptr : reinterpret_cast<uint8_t const *>(dictionary.data());
+            options.preset_dict_size = dictionary.size();
+            lzma_filter filters[] = { { LZMA_FILTER_LZMA2, & options }, { LZMA_VLI_UNKNOWN, nullptr } };
+            std::string result(lzma_stream_buffer_bound(size), '\0');
+            size_t length = 0;
+            if (lzma_raw_buffer_encode(filters, nullptr, reinterpret_cast<uint8_t const *>(data), size, reinterpret_cast<uint8_t *>(& result[0]), & length, result.size()) != LZMA_OK)
+                throw std::runtime_error("Unable to xz content");
+            result.resize(length);
+            return result;
+        }
+        default:
+            throw std::runtime_error(STR("Unknown content codec " << static_cast<int>(codec)));
+    }
+}
+
+std::string ContentStore::Decompress(char const * data, size_t size, size_t decompressedSize, Codec codec, std::string const & dictionary) {
+    switch (codec) {
+        case Codec::None:
+            return std::string(data, size);
+        case Codec::Deflate: {
+            std::string result(decompressedSize, '\0');
+            uLongf length = decompressedSize;
+            // an empty block still needs a valid output buffer
+            Bytef empty;
+            Bytef * out = decompressedSize == 0 ? & empty : reinterpret_cast<Bytef *>(& result[0]);
+            if (uncompress(out, & length, reinterpret_cast<Bytef const *>(data), size) != Z_OK or length != decompressedSize)
+                throw std::runtime_error("Corrupted content block");
+            return result;
+        }
+        case Codec::Xz: {
+            std::string result(decompressedSize, '\0');
+            uint64_t memLimit = UINT64_MAX;
+            size_t inPos = 0;
+            size_t outPos = 0;
+            uint8_t empty;
+            uint8_t * out = decompressedSize == 0 ? & empty : reinterpret_cast<uint8_t *>(& result[0]);
+            if (lzma_stream_buffer_decode(& memLimit, 0, nullptr, reinterpret_cast<uint8_t const *>(data), & inPos, size, out, & outPos, decompressedSize) != LZMA_OK or outPos != decompressedSize)
+                throw std::runtime_error("Corrupted content block");
+            return result;
+        }
+        case Codec::XzDictionary: {
+            lzma_options_lzma options;
+            lzma_lzma_preset(& options, LZMA_PRESET_DEFAULT);
+            options.dict_size = DictionaryWindow(dictionary.size(), decompressedSize);
+            options.preset_dict = dictionary.empty() ? nullptr : reinterpret_cast<uint8_t const *>(dictionary.data());
+            options.preset_dict_size = dictionary.size();
+            lzma_filter filters[] = { { LZMA_FILTER_LZMA2, & options }, { LZMA_VLI_UNKNOWN, nullptr } };
+            std::string result(decompressedSize, '\0');
+            size_t inPos = 0;
+            size_t outPos = 0;
+            uint8_t empty;
+            uint8_t * out = decompressedSize == 0 ? & empty : reinterpret_cast<uint8_t *>(& result[0]);
+            if (lzma_raw_buffer_decode(filters, nullptr, reinterpret_cast<uint8_t const *>(data), & inPos, size, out, & outPos, decompressedSize) != LZMA_OK or outPos != decompressedSize)
+                throw std::runtime_error("Corrupted content");
+            return result;
+        }
+        default:
+            throw std::runtime_error(STR("Unknown content codec " << static_cast<int>(codec)));
+    }
+}
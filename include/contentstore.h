@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "filesystem.h"
+
+/** Append-only store of file contents keyed by their content ids.
+
+  Instead of a file per content, the contents are appended to large segment files, so that the store has only a few files per segment regardless of how many contents it holds. Each segment has an index file (segment_N.idx) with a 32 byte entry per content, which gives its id, where it is stored, its length and the codec.
+
+  New contents are appended uncompressed to the active segment (segment_N.raw). When the active segment grows over the segment size, a new active segment is started and the full one can be sealed: its contents are grouped into blocks of roughly the block size and each block is compressed on its own, so that a single content can later be read by decompressing only its block. The blocks are written to segment_N.dat, the index is replaced by one pointing to the blocks and the raw file is deleted.
+
+  Segments are never appended to by another run, any segments left unsealed by a previous run are reported by open() so that they can be sealed.
+
+  Optionally a content can be stored as a delta against the content it is a new version of, see Delta. The stored bytes are then the id of the base as a varint followed by the delta, and the entry has the depth of the delta chain, i.e. the number of deltas that must be applied to the nearest full content. The chains are bounded by the maximal delta depth, a content whose base is already at the maximal depth is stored in full as a keyframe. Deltas are only made against bases appended by the same store object, whose depths it knows, so each run starts with full contents.
+
+  Small contents can further be compressed one by one with a dictionary, so that they can be read without decompressing a whole block, yet compress almost as well. Contents are appended with a category, such as the language filter of their file, and the store trains a dictionary for each category from the first contents of the category it sees, see Dictionary. When sealed, small contents of a category with a dictionary are compressed on their own with the dictionary as its preset. Dictionaries are written to the store directory as dictionary_N_C.dict, where N is the number of the dictionary recorded in the entries and C is the category. A new dictionary is trained in every run, but the old ones are never changed, so that old segments stay readable.
+
+  Contents are read by their ids, from any number of threads. The sealed index is sorted by ids, so a read is a binary search in the index of the segment whose range of ids contains the id, followed by decompressing its block. The most recently used decompressed blocks are kept in a cache. Reading sees the segments that existed when the store was first read, and is meant for stores that are no longer written to.
+ */
+class ContentStore {
+public:
+
+    enum class Codec : uint8_t {
+        None = 0,
+        Deflate = 1,
+        Xz = 2,
+        /** Raw LZMA2 of a single content with the dictionary given by the entry as its preset. */
+        XzDictionary = 3,
+    };
+
+    /** Index entry of a single content.
+
+      Uncompressed contents form a block of their own, i.e. their block offset is 0 and all lengths are the same.
+     */
+    struct Entry {
+        uint32_t id;
+        /** Length of the content. */
+        uint32_t length;
+        /** Offset of the block with the content in the segment's data file. */
+        uint64_t offset;
+        /** Length of the block as stored. */
+        uint32_t compressedLength;
+        /** Length of the block when decompressed. */
+        uint32_t blockLength;
+        /** Offset of the content in the decompressed block. */
+        uint32_t blockOffset;
+        Codec codec;
+        /** Number of deltas between the content and the nearest full content, 0 if the content is stored in full. */
+        uint8_t depth;
+        /** Category given when the content was appended, 0 if none. */
+        uint8_t category;
+        /** Number of the dictionary the content was compressed with, 0 if none. */
+        uint8_t dictionary;
+    };
+
+    ContentStore();
+
+    ~ContentStore();
+
+    ContentStore(ContentStore const &) = delete;
+    ContentStore & operator = (ContentStore const &) = delete;
+
+    /** Opens the store in given directory, creating the directory if it does not exist.
+
+      Returns the numbers of segments that were left unsealed by a previous run. The segment and block sizes only matter when appending.
+     */
+    std::vector<unsigned> open(std::string const & path, uint64_t segmentSize, uint32_t blockSize);
+
+    /** Appends the contents with given id to the active segment, starting a new one if there is none. Thread safe.
+
+      If the active segment is full after the append, it is closed and its number is returned so that the caller can seal it, otherwise returns -1.
+     */
+    long append(long id, std::string const & contents, uint8_t category = 0);
+
+    /** Appends the contents with given id as a delta against the base contents of given id, if the base was appended by this store and its chain is not too long already, and if the delta is less than half of the contents. Otherwise the contents are stored in full. The base contents are obtained from the loader only if a delta is attempted. Thread safe.
+
+      Returns the same as append() above.
+     */
+    long append(long id, std::string const & contents, uint8_t category, long baseId, std::function<std::string()> const & baseLoader);
+
+    /** Sets the maximal length of delta chains, 0 (the default) stores all contents in full.
+     */
+    void setMaxDeltaDepth(unsigned depth);
+
+    /** Sets the size of the dictionaries trained for the categories of contents, 0 (the default) disables training new dictionaries. Must be called before appending.
+     */
+    void setDictionarySize(size_t bytes);
+
+    /** Flushes the active segment so that all contents appended so far are on disk.
+     */
+    void flush();
+
+    /** Closes the active segment. Returns its number so that it can be sealed, or -1 if there is no active segment.
+     */
+    long close();
+
+    /** Compresses given segment with given codec. The segment must not be active. Safe to call from multiple threads for different segments.
+
+      Returns the number of bytes of contents in the segment.
+     */
+    uint64_t seal(unsigned segment, Codec codec = Codec::Xz);
+
+    /** Returns the contents of given id. Throws if the store does not have the id.
+     */
+    std::string read(long id);
+
+    /** Returns the contents of all given ids, in the same order. Each block is decompressed only once, no matter the order of the ids.
+     */
+    std::vector<std::string> read(std::vector<long> const & ids);
+
+    /** Returns true if the store has contents of given id.
+     */
+    bool contains(long id);
+
+    /** Sets the maximal total size of the decompressed blocks kept in the cache.
+     */
+    void setCacheSize(size_t bytes);
+
+    typedef std::function<void(long id, std::string const & contents)> Reader;
+
+    /** Calls the reader for all contents in the store in the order of their ids.
+
+      The blocks are decompressed by given number of threads ahead of the reader, which runs in the calling thread. Only a window of blocks is kept decompressed at any time, so the whole store can be scanned at the speed of the disk, or of the decompression.
+     */
+    void scan(Reader const & reader, unsigned threads = 1);
+
+private:
+    struct Segment;
+
+public:
+
+    /** Streams all contents of the store in the order of their ids, reading the blocks through the cache.
+     */
+    class Iterator {
+    public:
+        Iterator(ContentStore & store);
+
+        /** Moves to the next content. Returns false when there are no more contents.
+         */
+        bool next();
+
+        long id() const {
+            return id_;
+        }
+
+        std::string const & contents() const {
+            return contents_;
+        }
+
+    private:
+        friend class ContentStore;
+
+        /** Moves to the next entry without reading its contents.
+         */
+        bool nextEntry(Segment const * & segment, Entry const * & entry);
+
+        ContentStore & store_;
+        long id_;
+        std::string contents_;
+        /** Position of the next entry in each segment. */
+        std::vector<size_t> positions_;
+        /** Id of the next entry and its segment for all segments that have entries left. */
+        std::priority_queue<std::pair<uint64_t, size_t>, std::vector<std::pair<uint64_t, size_t>>, std::greater<std::pair<uint64_t, size_t>>> heap_;
+    };
+
+    /** Returns the number of segments created so far, sealed or not.
+     */
+    unsigned segments() const {
+        return nextSegment_;
+    }
+
+    std::string const & path() const {
+        return path_;
+    }
+
+    /** Compresses the given data with given codec. The dictionary is only used by the XzDictionary codec.
+     */
+    static std::string Compress(char const * data, size_t size, Codec codec, std::string const & dictionary = std::string());
+
+    /** Decompresses the given data, whose decompressed size must be known, with the dictionary it was compressed with.
+     */
+    static std::string Decompress(char const * data, size_t size, size_t decompressedSize, Codec codec, std::string const & dictionary = std::string());
+
+    /** Contents up to this size are compressed with the dictionary of their category, if there is one. Larger contents compress well enough on their own. */
+    static size_t const SmallContent = 32 * 1024;
+
+private:
+
+    /** A segment loaded for reading, with its entries sorted by ids.
+     */
+    struct Segment {
+        unsigned number;
+        std::vector<Entry> entries;
+        std::unique_ptr<MappedFile> data;
+    };
+
+    typedef std::pair<uint64_t, std::shared_ptr<std::string const>> CachedBlock;
+
+    static uint8_t const UnknownDepth = 0xff;
+
+    std::string segmentFile(unsigned segment, char const * extension) const;
+
+    /** Appends the stored bytes of given id with given delta depth and category to the active segment.
+     */
+    long appendEntry(long id, std::string const & data, uint8_t depth, uint8_t category);
+
+    /** Adds the contents to the samples of its category if the category has no dictionary trained in this run yet, and trains the dictionary when there are enough samples.
+     */
+    void sample(std::string const & contents, uint8_t category);
+
+    /** Returns the dictionary of given number, throws if the store does not have it.
+     */
+    std::shared_ptr<std::string const> dictionary(uint8_t number);
+
+    /** Decompresses the block of given entry.
+     */
+    std::string decompress(Segment const & segment, Entry const & e);
+
+    /** Loads the indices of all segments and maps their data for reading, unless already loaded.
+     */
+    void load();
+
+    /** Finds the entry of given id, or returns nullptr if there is none.
+     */
+    Entry const * find(long id, Segment const * & segment);
+
+    /** Returns the decompressed block of given entry, from the cache if possible.
+     */
+    std::shared_ptr<std::string const> block(Segment const & segment, Entry const & e);
+
+    /** Returns the stored bytes of given entry.
+     */
+    std::string extract(Segment const & segment, Entry const & e);
+
+    /** Returns the contents of given entry from its stored bytes, applying the delta to its base if the entry is a delta.
+     */
+    std::string resolve(Entry const & e, std::string const & stored);
+
+    static uint64_t BlockKey(Segment const & segment, Entry const & e) {
+        return (static_cast<uint64_t>(segment.number) << 40) | e.offset;
+    }
+
+    std::string path_;
+    uint64_t segmentSize_;
+    uint32_t blockSize_;
+
+    std::mutex guard_;
+    unsigned nextSegment_;
+
+    /** Number of the active segment, -1 if there is none. */
+    long active_;
+    std::ofstream raw_;
+    std::ofstream index_;
+    uint64_t rawSize_;
+
+    unsigned maxDeltaDepth_;
+    /** Delta depths of the contents appended so far indexed by their ids, UnknownDepth for ids not appended by this store. Only kept when deltas are enabled. */
+    std::vector<uint8_t> depths_;
+
+    size_t dictionarySize_;
+    /** Dictionaries indexed by their numbers, the first one is always empty. */
+    std::vector<std::shared_ptr<std::string const>> dictionaries_;
+    /** Number of the newest dictionary of each category. */
+    std::vector<uint8_t> currentDictionaries_;
+    /** Samples collected for each category, until its dictionary is trained. */
+    std::vector<std::vector<std::string>> samples_;
+    std::vector<size_t> sampleSizes_;
+    /** Categories whose dictionary has been trained in this run, or is being trained. */
+    std::vector<bool> trained_;
+
+    std::once_flag loaded_;
+    /** Segments loaded for reading, ordered by their smallest ids. */
+    std::vector<std::unique_ptr<Segment>> readSegments_;
+
+    std::mutex cacheGuard_;
+    std::list<CachedBlock> cache_;
+    std::unordered_map<uint64_t, std::list<CachedBlock>::iterator> cacheIndex_;
+    size_t cacheSize_;
+    size_t cacheLimit_;
+};
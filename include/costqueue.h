@@ -0,0 +1,131 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+
+/** Queue of tasks handing out the most expensive tasks first, so that no long task is left to keep a single thread busy at the end of a run while the others are idle (longest processing time first).
+
+  Tasks pushed with an estimated cost, such as the time they took in a previous run, are handed out by their estimates. Tasks without an estimate keep their order and are handed out when the mean measured cost of such tasks, or the mean estimate until one is measured, is at least the estimate of the next task with one. As the tasks finish, measured() corrects the estimates by the ratio of the measured and estimated costs, so the order adapts to the real durations of the run.
+
+  Only one thread pops the tasks, any thread may report the measured costs.
+ */
+template<typename T>
+class CostQueue {
+public:
+
+    CostQueue():
+        sorted_(true),
+        next_(0),
+        estimatedSum_(0),
+        estimatedCount_(0),
+        measuredEstimatedSum_(0),
+        measuredSum_(0),
+        unknownMeasuredSum_(0),
+        unknownMeasured_(0) {
+    }
+
+    /** Adds a task with given estimated cost, NAN if the cost is unknown.
+     */
+    void push(T task, double estimate) {
+        if (std::isnan(estimate)) {
+            unknown_.push_back(std::move(task));
+        } else {
+            estimated_.push_back(Entry{std::move(task), estimate});
+            estimatedSum_ += estimate;
+            ++estimatedCount_;
+            sorted_ = false;
+        }
+    }
+
+    bool empty() const {
+        return next_ == estimated_.size() and unknown_.empty();
+    }
+
+    size_t size() const {
+        return estimated_.size() - next_ + unknown_.size();
+    }
+
+    /** Removes and returns the task to run next. The queue must not be empty.
+     */
+    T pop() {
+        if (not sorted_) {
+            std::stable_sort(estimated_.begin() + next_, estimated_.end(), [](Entry const & a, Entry const & b) {
+                return a.estimate > b.estimate;
+            });
+            sorted_ = true;
+        }
+        if (next_ == estimated_.size() or (not unknown_.empty() and unknownEstimate() >= correctedEstimate(estimated_[next_].estimate))) {
+            T result = std::move(unknown_.front());
+            unknown_.pop_front();
+            return result;
+        }
+        T result = std::move(estimated_[next_].task);
+        // release the entries handed out every now and then
+        if (++next_ == 1024) {
+            estimated_.erase(estimated_.begin(), estimated_.begin() + next_);
+            next_ = 0;
+        }
+        return result;
+    }
+
+    /** Reports the measured cost of a finished task that was pushed with given estimate, NAN if it had none.
+     */
+    void measured(double estimate, double cost) {
+        std::lock_guard<std::mutex> g(m_);
+        if (std::isnan(estimate)) {
+            unknownMeasuredSum_ += cost;
+            ++unknownMeasured_;
+        } else {
+            measuredEstimatedSum_ += estimate;
+            measuredSum_ += cost;
+        }
+    }
+
+private:
+
+    struct Entry {
+        T task;
+        double estimate;
+    };
+
+    /** Returns the estimate corrected by the ratio of measured and estimated costs seen so far.
+     */
+    double correctedEstimate(double estimate) {
+        std::lock_guard<std::mutex> g(m_);
+        if (measuredEstimatedSum_ > 0)
+            return estimate * measuredSum_ / measuredEstimatedSum_;
+        return estimate;
+    }
+
+    /** Returns the expected cost of a task without an estimate.
+     */
+    double unknownEstimate() {
+        {
+            std::lock_guard<std::mutex> g(m_);
+            if (unknownMeasured_ > 0)
+                return unknownMeasuredSum_ / unknownMeasured_;
+        }
+        if (estimatedCount_ == 0)
+            return 0;
+        return correctedEstimate(estimatedSum_ / estimatedCount_);
+    }
+
+    std::vector<Entry> estimated_;
+    std::deque<T> unknown_;
+    bool sorted_;
+    /** Index of the next estimated task to hand out. */
+    size_t next_;
+
+    /** Sum and number of all estimates pushed, for the mean estimate. */
+    double estimatedSum_;
+    size_t estimatedCount_;
+
+    /** Guards the measured costs below. */
+    std::mutex m_;
+    double measuredEstimatedSum_;
+    double measuredSum_;
+    double unknownMeasuredSum_;
+    size_t unknownMeasured_;
+};
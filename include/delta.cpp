@@ -0,0 +1,135 @@
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "delta.h"
+
+namespace {
+
+    uint32_t const Multiplier = 0x01000193;
+
+    uint32_t const Empty = 0xffffffff;
+
+    uint32_t BlockHash(unsigned char const * data, uint32_t size) {
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            result = result * Multiplier + data[i];
+        return result;
+    }
+
+    void AddLiteral(std::string & into, std::string const & target, size_t from, size_t to) {
+        if (to == from)
+            return;
+        Delta::WriteVarint(into, (to - from) << 1);
+        into.append(target, from, to - from);
+    }
+
+} // anonymous namespace
+
+std::string Delta::Encode(std::string const & base, std::string const & target) {
+    std::string result;
+    WriteVarint(result, base.size());
+    WriteVarint(result, target.size());
+    size_t blocks = base.size() / BlockSize;
+    if (blocks == 0 or target.size() < BlockSize) {
+        AddLiteral(result, target, 0, target.size());
+        return result;
+    }
+    unsigned char const * b = reinterpret_cast<unsigned char const *>(base.data());
+    unsigned char const * t = reinterpret_cast<unsigned char const *>(target.data());
+    // the table has at least twice as many slots as there are blocks, the first block wins if several share a slot
+    unsigned bits = 1;
+    while ((size_t(1) << bits) < blocks * 2)
+        ++bits;
+    std::vector<uint32_t> table(size_t(1) << bits, Empty);
+    auto slot = [bits] (uint32_t hash) {
+        return (hash * 2654435761u) >> (32 - bits);
+    };
+    for (size_t i = blocks; i-- > 0; )
+        table[slot(BlockHash(b + i * BlockSize, BlockSize))] = i * BlockSize;
+    uint32_t power = 1;
+    for (uint32_t i = 1; i < BlockSize; ++i)
+        power *= Multiplier;
+    // target bytes from pending on have not been emitted yet
+    size_t pending = 0;
+    size_t pos = 0;
+    uint32_t hash = BlockHash(t, BlockSize);
+    while (pos + BlockSize <= target.size()) {
+        uint32_t candidate = table[slot(hash)];
+        if (candidate != Empty and std::memcmp(b + candidate, t + pos, BlockSize) == 0) {
+            size_t start = pos;
+            size_t from = candidate;
+            while (start > pending and from > 0 and b[from - 1] == t[start - 1]) {
+                --start;
+                --from;
+            }
+            size_t end = pos + BlockSize;
+            size_t baseEnd = candidate + BlockSize;
+            while (end < target.size() and baseEnd < base.size() and b[baseEnd] == t[end]) {
+                ++end;
+                ++baseEnd;
+            }
+            AddLiteral(result, target, pending, start);
+            WriteVarint(result, ((end - start) << 1) | 1);
+            WriteVarint(result, from);
+            pending = end;
+            pos = end;
+            if (pos + BlockSize <= target.size())
+                hash = BlockHash(t + pos, BlockSize);
+            continue;
+        }
+        if (pos + BlockSize < target.size())
+            hash = (hash - t[pos] * power) * Multiplier + t[pos + BlockSize];
+        ++pos;
+    }
+    AddLiteral(result, target, pending, target.size());
+    return result;
+}
+
+std::string Delta::Apply(std::string const & base, char const * delta, size_t size) {
+    size_t pos = 0;
+    if (ReadVarint(delta, size, pos) != base.size())
+        throw std::runtime_error("Delta does not match its base");
+    uint64_t length = ReadVarint(delta, size, pos);
+    std::string result;
+    result.reserve(length);
+    while (pos < size) {
+        uint64_t x = ReadVarint(delta, size, pos);
+        uint64_t n = x >> 1;
+        if (x & 1) {
+            uint64_t offset = ReadVarint(delta, size, pos);
+            if (offset > base.size() or n > base.size() - offset)
+                throw std::runtime_error("Corrupted delta");
+            result.append(base, offset, n);
+        } else {
+            if (n > size - pos)
+                throw std::runtime_error("Corrupted delta");
+            result.append(delta + pos, n);
+            pos += n;
+        }
+    }
+    if (result.size() != length)
+        throw std::runtime_error("Corrupted delta");
+    return result;
+}
+
+void Delta::WriteVarint(std::string & into, uint64_t value) {
+    while (value >= 0x80) {
+        into.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    into.push_back(static_cast<char>(value));
+}
+
+uint64_t Delta::ReadVarint(char const * data, size_t size, size_t & pos) {
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos == size)
+            throw std::runtime_error("Corrupted delta");
+        unsigned char c = data[pos++];
+        result |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+            return result;
+    }
+    throw std::runtime_error("Corrupted delta");
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/** Binary delta of a content against a base content, in the spirit of VCDIFF.
+
+  A delta is the length of the base and of the target, followed by instructions to rebuild the target, each either a copy of a range of the base, or literal bytes added. All numbers are varints. Each instruction starts with its length shifted left by one, with the lowest bit set for copies, which continue by the offset in the base, while additions continue by the bytes themselves.
+
+  Matches are found by indexing the base in blocks of 16 bytes by a rolling hash, which is then rolled over the target. A match is extended in both directions as far as the contents agree, so that the small edits typical for successive versions of a file yield a few copies of large ranges of the base.
+ */
+class Delta {
+public:
+
+    /** Returns the delta rebuilding the target from the base.
+     */
+    static std::string Encode(std::string const & base, std::string const & target);
+
+    /** Rebuilds the target from the base and the delta. Throws if the delta does not match the base or is corrupted.
+     */
+    static std::string Apply(std::string const & base, char const * delta, size_t size);
+
+    static void WriteVarint(std::string & into, uint64_t value);
+
+    /** Reads the varint at given position, advancing it. Throws if the varint is not complete.
+     */
+    static uint64_t ReadVarint(char const * data, size_t size, size_t & pos);
+
+private:
+
+    static uint32_t const BlockSize = 16;
+
+};
@@ -0,0 +1,79 @@
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <tuple>
+
+#include "dictionary.h"
+
+size_t const Dictionary::K;
+size_t const Dictionary::SegmentLength;
+unsigned const Dictionary::TableBits;
+
+std::string Dictionary::Train(std::vector<std::string> const & samples, size_t size) {
+    auto hash = [] (char const * data) {
+        uint64_t x;
+        std::memcpy(& x, data, K);
+        return static_cast<size_t>((x * 0x9e3779b97f4a7c15ULL) >> (64 - TableBits));
+    };
+    // the number of samples each sequence occurs in, sequences sharing a hash are counted together, which is good enough
+    std::vector<uint32_t> frequency(size_t(1) << TableBits, 0);
+    std::vector<uint32_t> stamp(size_t(1) << TableBits, 0);
+    uint32_t currentStamp = 0;
+    for (std::string const & s : samples) {
+        ++currentStamp;
+        for (size_t i = 0; i + K <= s.size(); ++i) {
+            size_t h = hash(s.data() + i);
+            if (stamp[h] != currentStamp) {
+                stamp[h] = currentStamp;
+                ++frequency[h];
+            }
+        }
+    }
+    // each distinct sequence of a segment that occurs in more than one sample adds the number of samples it occurs in
+    auto score = [&] (std::string const & s, size_t offset) {
+        ++currentStamp;
+        uint64_t result = 0;
+        size_t end = std::min(offset + SegmentLength, s.size());
+        for (size_t i = offset; i + K <= end; ++i) {
+            size_t h = hash(s.data() + i);
+            if (stamp[h] != currentStamp) {
+                stamp[h] = currentStamp;
+                if (frequency[h] > 1)
+                    result += frequency[h];
+            }
+        }
+        return result;
+    };
+    // candidates are (score, sample, offset), the scores only go down as segments are picked, so a candidate whose recomputed score is still the best can be picked right away
+    typedef std::tuple<uint64_t, size_t, size_t> Candidate;
+    std::priority_queue<Candidate> candidates;
+    for (size_t i = 0; i < samples.size(); ++i)
+        for (size_t offset = 0; offset + K <= samples[i].size(); offset += SegmentLength)
+            candidates.push(Candidate(score(samples[i], offset), i, offset));
+    std::vector<std::string> picked;
+    size_t total = 0;
+    while (total < size and not candidates.empty()) {
+        Candidate c = candidates.top();
+        candidates.pop();
+        std::string const & s = samples[std::get<1>(c)];
+        size_t offset = std::get<2>(c);
+        uint64_t current = score(s, offset);
+        if (current == 0)
+            continue;
+        if (not candidates.empty() and current < std::get<0>(candidates.top())) {
+            candidates.push(Candidate(current, std::get<1>(c), offset));
+            continue;
+        }
+        size_t end = std::min(offset + SegmentLength, s.size());
+        for (size_t i = offset; i + K <= end; ++i)
+            frequency[hash(s.data() + i)] = 0;
+        picked.push_back(s.substr(offset, std::min(end - offset, size - total)));
+        total += picked.back().size();
+    }
+    std::string result;
+    result.reserve(total);
+    for (auto i = picked.rbegin(), e = picked.rend(); i != e; ++i)
+        result += *i;
+    return result;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/** Trains compression dictionaries for small contents.
+
+  A dictionary is just a string of bytes that the compressor sees before each content, so that even a small content finds matches in it. The dictionary is built from segments of the samples which contain the byte sequences that occur in most samples, in the spirit of the cover algorithm of zstd: the samples are split into segments, each segment is scored by the number of samples its 8 byte sequences occur in, and the best segments are picked greedily, each pick discounting the sequences it already covers from the others. The best segments end up at the end of the dictionary, closest to the compressed content.
+ */
+class Dictionary {
+public:
+
+    /** Returns a dictionary of at most given size trained on the samples. The dictionary is empty if the samples have nothing in common.
+     */
+    static std::string Train(std::vector<std::string> const & samples, size_t size);
+
+private:
+
+    /** Length of the byte sequences whose occurrences are counted. */
+    static size_t const K = 8;
+
+    /** Length of the segments the dictionary is made of. */
+    static size_t const SegmentLength = 256;
+
+    /** Number of bits of the table counting the occurrences of the byte sequences by their hashes. */
+    static unsigned const TableBits = 20;
+
+};
@@ -1,7 +1,43 @@
+#include <spawn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
 #include <memory>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
 
 #include "utils.h"
 #include "exec.h"
+#include "forkserver.h"
+#include "watchdog.h"
+
+extern char ** environ;
+
+namespace {
+
+    /** Size of the chunks the output of processes is read in.
+     */
+    size_t const ChunkSize = 64 * 1024;
+
+    /** Creates a pipe whose ends are not inherited by other processes, the child's end is duplicated to its standard descriptor by the spawn.
+     */
+    void Pipe(int fds[2]) {
+        if (pipe2(fds, O_CLOEXEC) != 0)
+            throw std::ios_base::failure(STR("Unable to create pipe: " << std::strerror(errno)));
+    }
+
+    void CloseIfOpen(int & fd) {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+} // anonymous namespace
 
 
 #include <iostream>
@@ -50,3 +86,248 @@ bool execAndCapture(std::string const & cmd, std::string const & path, std::stri
     }
 }
 
+
+// Process ----------------------------------------------------------------------------------------
+
+Process::Process(std::vector<std::string> const & args, std::string const & path):
+    timeout(0),
+    args_(args),
+    path_(path) {
+}
+
+std::string Process::command() const {
+    std::string result;
+    for (std::string const & a : args_) {
+        if (not result.empty())
+            result += " ";
+        result += a;
+    }
+    return result;
+}
+
+Process::ChunkHandler Process::Lines(LineHandler const & handler) {
+    // the incomplete last line of a chunk waits for the rest in the next one
+    std::shared_ptr<std::string> pending(new std::string());
+    return [handler, pending] (char const * data, size_t size) {
+        if (size == 0) {
+            if (not pending->empty())
+                handler(*pending);
+            pending->clear();
+            return;
+        }
+        char const * end = data + size;
+        while (data != end) {
+            char const * nl = static_cast<char const *>(std::memchr(data, '\n', end - data));
+            if (nl == nullptr) {
+                pending->append(data, end);
+                return;
+            }
+            if (pending->empty()) {
+                handler(std::string(data, nl));
+            } else {
+                pending->append(data, nl);
+                handler(*pending);
+                pending->clear();
+            }
+            data = nl + 1;
+        }
+    };
+}
+
+pid_t Process::Spawn(std::vector<std::string> const & args, std::string const & path, std::vector<std::string> const & env, int in, int out, int err) {
+    if (ForkServer::IsRunning())
+        return ForkServer::Spawn(args, path, env, in, out, err);
+    return SpawnDirect(args, path, env, in, out, err);
+}
+
+pid_t Process::SpawnDirect(std::vector<std::string> const & args, std::string const & path, std::vector<std::string> const & env, int in, int out, int err) {
+    std::vector<char *> argv;
+    for (std::string const & a : args)
+        argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+    // the extra variables override the inherited ones with the same name
+    std::vector<char *> envp;
+    for (char ** e = environ; *e != nullptr; ++e) {
+        bool overridden = false;
+        for (std::string const & x : env) {
+            size_t eq = x.find('=');
+            if (std::strncmp(*e, x.c_str(), eq + 1) == 0) {
+                overridden = true;
+                break;
+            }
+        }
+        if (not overridden)
+            envp.push_back(*e);
+    }
+    for (std::string const & x : env)
+        envp.push_back(const_cast<char *>(x.c_str()));
+    envp.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err, STDERR_FILENO);
+    if (not path.empty())
+        posix_spawn_file_actions_addchdir_np(&actions, path.c_str());
+    // we ignore SIGPIPE, but the processes we start should get the default behavior
+    posix_spawnattr_t attrs;
+    posix_spawnattr_init(&attrs);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attrs, &defaults);
+    // each process leads a group of its own, so that it can be killed together with the processes it starts
+    posix_spawnattr_setpgroup(&attrs, 0);
+    posix_spawnattr_setflags(&attrs, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], &actions, &attrs, argv.data(), envp.data());
+    posix_spawnattr_destroy(&attrs);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0)
+        throw std::ios_base::failure(STR("Unable to execute command " << args[0] << " in " << path << ": " << std::strerror(error)));
+    return pid;
+}
+
+void Process::Wait(pid_t pid, Result & result) {
+    int status;
+    bool forked = ForkServer::Wait(pid, status);
+    if (not forked and not WaitTerminated(pid, status)) {
+        Watchdog::Unregister(pid);
+        result.exitCode = -1;
+        result.signal = 0;
+        return;
+    }
+    // the pid and the process group stay taken until the zombie is reaped
+    Watchdog::Unregister(pid);
+    if (forked) {
+        ForkServer::Reap(pid);
+    } else {
+        int reaped;
+        while (waitpid(pid, &reaped, 0) == -1 and errno == EINTR) { }
+    }
+    if (WIFEXITED(status)) {
+        result.exitCode = WEXITSTATUS(status);
+        result.signal = 0;
+    } else {
+        result.exitCode = -1;
+        result.signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    }
+}
+
+bool Process::WaitTerminated(pid_t pid, int & status) {
+    siginfo_t info;
+    info.si_pid = 0;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1)
+        if (errno != EINTR)
+            return false;
+    // the same encoding as the status of waitpid
+    if (info.si_code == CLD_EXITED)
+        status = (info.si_status & 0xff) << 8;
+    else
+        status = info.si_status & 0x7f;
+    return true;
+}
+
+Process::Result Process::run() const {
+    Result result;
+    result.exitCode = -1;
+    result.signal = 0;
+    result.timedOut = false;
+    int in[2] = { -1, -1 };
+    int out[2] = { -1, -1 };
+    int err[2] = { -1, -1 };
+    pid_t pid;
+    try {
+        if (input.empty()) {
+            in[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (in[0] == -1)
+                throw std::ios_base::failure("Unable to open /dev/null");
+        } else {
+            Pipe(in);
+        }
+        Pipe(out);
+        Pipe(err);
+        pid = Spawn(args_, path_, env, in[0], out[1], err[1]);
+        Watchdog::Register(pid);
+    } catch (...) {
+        for (int * fd : { in, out, err }) {
+            CloseIfOpen(fd[0]);
+            CloseIfOpen(fd[1]);
+        }
+        throw;
+    }
+    CloseIfOpen(in[0]);
+    CloseIfOpen(out[1]);
+    CloseIfOpen(err[1]);
+    for (int fd : { in[1], out[0], err[0] })
+        if (fd != -1)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    std::unique_ptr<char[]> buffer(new char[ChunkSize]);
+    size_t written = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<long>(timeout * 1000));
+    try {
+        while (out[0] != -1 or err[0] != -1 or in[1] != -1) {
+            pollfd fds[3];
+            nfds_t n = 0;
+            if (out[0] != -1)
+                fds[n++] = pollfd{out[0], POLLIN, 0};
+            if (err[0] != -1)
+                fds[n++] = pollfd{err[0], POLLIN, 0};
+            if (in[1] != -1)
+                fds[n++] = pollfd{in[1], POLLOUT, 0};
+            int wait = -1;
+            if (timeout > 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                wait = left > 0 ? static_cast<int>(left) : 0;
+            }
+            int ready = poll(fds, n, wait);
+            if (ready == -1 and errno == EINTR)
+                continue;
+            if (ready == 0) {
+                // out of time, whatever the process (or its children still holding the pipes) does is no longer interesting
+                kill(-pid, SIGKILL);
+                result.timedOut = true;
+                break;
+            }
+            for (nfds_t i = 0; i < n; ++i) {
+                if (fds[i].revents == 0)
+                    continue;
+                if (fds[i].fd == in[1]) {
+                    ssize_t x = write(in[1], input.data() + written, input.size() - written);
+                    if (x > 0)
+                        written += x;
+                    // a process that closes its input before reading all of it simply does not get the rest
+                    if (written == input.size() or (x == -1 and errno != EAGAIN and errno != EINTR))
+                        CloseIfOpen(in[1]);
+                    continue;
+                }
+                bool isOut = fds[i].fd == out[0];
+                ssize_t x = read(fds[i].fd, buffer.get(), ChunkSize);
+                if (x == -1 and (errno == EAGAIN or errno == EINTR))
+                    continue;
+                ChunkHandler const & handler = isOut ? onOut : onErr;
+                if (x <= 0) {
+                    CloseIfOpen(isOut ? out[0] : err[0]);
+                    if (handler)
+                        handler(nullptr, 0);
+                } else if (handler) {
+                    handler(buffer.get(), x);
+                } else {
+                    (isOut ? result.out : result.err).append(buffer.get(), x);
+                }
+            }
+        }
+    } catch (...) {
+        kill(-pid, SIGKILL);
+        for (int fd : { in[1], out[0], err[0] })
+            if (fd != -1)
+                close(fd);
+        Wait(pid, result);
+        throw;
+    }
+    CloseIfOpen(in[1]);
+    CloseIfOpen(out[0]);
+    CloseIfOpen(err[0]);
+    Wait(pid, result);
+    return result;
+}
@@ -1,8 +1,107 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <functional>
+
+#include <sys/types.h>
 
 bool exec(std::string const & what, std::string const & path);
 std::string execAndCapture(std::string const & cmd, std::string const & path);
 bool execAndCapture(std::string const & cmd, std::string const & path, std::string & output);
 
+/** Process executed directly by posix_spawn, without a shell.
+
+  The arguments are passed to the process as they are, so nothing has to be quoted, and the working directory is set by the spawn itself. Standard output and error are kept separate and are read in large chunks. Each of them is either captured in the result, or passed to a handler as soon as it arrives.
+
+  The options are set on the object before calling run(), which can be called multiple times.
+ */
+class Process {
+public:
+
+    /** Receives chunks of the output as they are read. Once the stream is closed, the handler is called one last time with an empty chunk.
+     */
+    typedef std::function<void(char const *, size_t)> ChunkHandler;
+
+    typedef std::function<void(std::string const &)> LineHandler;
+
+    struct Result {
+        /** Exit code of the process, -1 if it was killed by a signal. */
+        int exitCode;
+        /** Signal that killed the process, 0 if it exited normally. */
+        int signal;
+        /** True if the process was killed because it ran out of its time. */
+        bool timedOut;
+        /** Captured standard output, empty if it was passed to a handler. */
+        std::string out;
+        /** Captured standard error, empty if it was passed to a handler. */
+        std::string err;
+
+        bool success() const {
+            return exitCode == 0 and not timedOut;
+        }
+    };
+
+    /** Creates the process, the first argument is the program to run, which is searched for in PATH. If path is not empty, the process is started there.
+     */
+    Process(std::vector<std::string> const & args, std::string const & path = "");
+
+    /** Runs the process and waits for it to terminate.
+
+      Throws if the process cannot be started, a process that fails is reported in the result.
+     */
+    Result run() const;
+
+    /** Returns the arguments joined by spaces, for error messages.
+     */
+    std::string command() const;
+
+    /** Variables in NAME=value form that are added to, or override, the environment of the process.
+     */
+    std::vector<std::string> env;
+
+    /** Written to the standard input of the process, which otherwise reads /dev/null.
+     */
+    std::string input;
+
+    /** Seconds after which the process is killed, 0 for no limit.
+     */
+    double timeout;
+
+    /** If set, the standard output is passed to the handler instead of being captured.
+     */
+    ChunkHandler onOut;
+
+    /** If set, the standard error is passed to the handler instead of being captured.
+     */
+    ChunkHandler onErr;
+
+    /** Wraps a line handler so that it can receive output chunks. The lines are passed without their trailing new lines, a last line with no new line is passed when the stream is closed.
+     */
+    static ChunkHandler Lines(LineHandler const & handler);
+
+    /** Starts the given process with the given descriptors as its standard input, output and error and returns its pid.
+
+      This is the only place processes are spawned, coprocesses that run() is not suitable for use it directly. If the ForkServer is running, the process is started by it. Throws if the process cannot be started.
+     */
+    static pid_t Spawn(std::vector<std::string> const & args, std::string const & path, std::vector<std::string> const & env, int in, int out, int err);
+
+    /** Like Spawn, but always starts the process from the calling process.
+     */
+    static pid_t SpawnDirect(std::vector<std::string> const & args, std::string const & path, std::vector<std::string> const & env, int in, int out, int err);
+
+    /** Waits for the given process, started by Spawn, to terminate and stores its exit code and signal in the result.
+
+      The process is unregistered from the Watchdog while it is still a zombie, so that the watchdog never kills a process or group that has reused its pid.
+     */
+    static void Wait(pid_t pid, Result & result);
+
+    /** Waits for the given child of the calling process to terminate without reaping it and stores its wait status. Returns false if the process cannot be waited for.
+     */
+    static bool WaitTerminated(pid_t pid, int & status);
+
+private:
+    std::vector<std::string> args_;
+    std::string path_;
+};
+
@@ -1,9 +1,15 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "utils.h"
 #include "filesystem.h"
 
+#include <cstring>
+
 bool isDirectory(std::string const & path) {
     struct stat s;
     if (lstat(path.c_str(),&s) == 0)
@@ -18,6 +24,13 @@ bool isFile(std::string const & path) {
     return false;
 }
 
+uint64_t fileSize(std::string const & path) {
+    struct stat s;
+    if (stat(path.c_str(),&s) == 0)
+        return s.st_size;
+    return 0;
+}
+
 void createPath(std::string const & path) {
     if (system(STR("mkdir -p " << path).c_str()) != EXIT_SUCCESS)
         throw std::ios_base::failure(STR("Unable to create path " << path));
@@ -33,3 +46,46 @@ void deletePath(std::string const & path) {
     if (system(STR("rm -rf " << path).c_str()) != EXIT_SUCCESS)
        throw std::ios_base::failure(STR("Unable to delete path " << path));
 }
+
+std::vector<std::string> listDirectory(std::string const & path) {
+    std::vector<std::string> result;
+    DIR * d = opendir(path.c_str());
+    if (d == nullptr)
+        return result;
+    while (struct dirent * e = readdir(d)) {
+        if (std::strcmp(e->d_name, ".") == 0 or std::strcmp(e->d_name, "..") == 0)
+            continue;
+        result.push_back(e->d_name);
+    }
+    closedir(d);
+    return result;
+}
+
+MappedFile::MappedFile(std::string const & filename):
+    data_(nullptr),
+    size_(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::ios_base::failure(STR("Unable to open file " << filename));
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        close(fd);
+        throw std::ios_base::failure(STR("Unable to stat file " << filename));
+    }
+    size_ = s.st_size;
+    if (size_ > 0) {
+        void * m = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            close(fd);
+            throw std::ios_base::failure(STR("Unable to map file " << filename));
+        }
+        data_ = static_cast<unsigned char const *>(m);
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr)
+        munmap(const_cast<unsigned char *>(data_), size_);
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -36,6 +37,10 @@ bool isDirectory(std::string const & path);
 
 bool isFile(std::string const & path);
 
+/** Returns the size of the given file in bytes, or 0 if the file does not exist.
+ */
+uint64_t fileSize(std::string const & path);
+
 void createPath(std::string const & path);
 
 
@@ -46,3 +51,36 @@ void createPathIfMissing(std::string const & path);
  */
 void deletePath(std::string const & path);
 
+/** Returns names of all entries in given directory, excluding . and .. entries.
+
+  Returns empty vector if the directory does not exist.
+ */
+std::vector<std::string> listDirectory(std::string const & path);
+
+
+/** Read-only memory mapping of an entire file.
+
+  The mapping is valid for the lifetime of the object. Empty files are supported and have no data.
+ */
+class MappedFile {
+public:
+    MappedFile(std::string const & filename);
+
+    ~MappedFile();
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile & operator = (MappedFile const &) = delete;
+
+    unsigned char const * data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    unsigned char const * data_;
+    size_t size_;
+};
+
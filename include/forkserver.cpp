@@ -0,0 +1,262 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <ios>
+
+#include "utils.h"
+#include "exec.h"
+#include "forkserver.h"
+
+
+namespace {
+
+    /** Max size of a single spawn request, i.e. all arguments, path and environment variables together.
+     */
+    size_t const MaxRequestSize = 1024 * 1024;
+
+    /** Descriptors passed with each request: stdin, stdout and stderr of the process, the write end of the status pipe and the read end of the release pipe.
+     */
+    unsigned const RequestFds = 5;
+
+    void AppendString(std::string & into, std::string const & what) {
+        into.append(what);
+        into.push_back('\0');
+    }
+
+    void AppendStrings(std::string & into, std::vector<std::string> const & what) {
+        AppendString(into, STR(what.size()));
+        for (std::string const & x : what)
+            AppendString(into, x);
+    }
+
+    char const * ReadString(char const * & from, char const * end) {
+        char const * result = from;
+        while (from != end and *from != '\0')
+            ++from;
+        if (from == end)
+            throw std::ios_base::failure("Malformed spawn request");
+        ++from;
+        return result;
+    }
+
+    std::vector<std::string> ReadStrings(char const * & from, char const * end) {
+        std::vector<std::string> result;
+        size_t n = std::strtoul(ReadString(from, end), nullptr, 10);
+        for (size_t i = 0; i < n; ++i)
+            result.push_back(ReadString(from, end));
+        return result;
+    }
+
+    bool WriteInt(int fd, int value) {
+        return write(fd, &value, sizeof(int)) == sizeof(int);
+    }
+
+    bool ReadInt(int fd, int & value) {
+        ssize_t x;
+        do {
+            x = read(fd, &value, sizeof(int));
+        } while (x == -1 and errno == EINTR);
+        return x == sizeof(int);
+    }
+
+} // anonymous namespace
+
+
+int ForkServer::socket_ = -1;
+pid_t ForkServer::pid_ = -1;
+std::unordered_map<pid_t, ForkServer::Waiter> ForkServer::waiters_;
+std::mutex ForkServer::waitersGuard_;
+
+void ForkServer::Start() {
+    if (IsRunning())
+        return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+        throw std::ios_base::failure(STR("Unable to create fork server socket: " << std::strerror(errno)));
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        throw std::ios_base::failure(STR("Unable to start fork server: " << std::strerror(errno)));
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        Serve(sv[1]);
+        _exit(EXIT_SUCCESS);
+    }
+    close(sv[1]);
+    socket_ = sv[0];
+    pid_ = pid;
+}
+
+void ForkServer::Stop() {
+    if (not IsRunning())
+        return;
+    // closing the socket terminates the server's loop
+    close(socket_);
+    socket_ = -1;
+    int status;
+    waitpid(pid_, &status, 0);
+    pid_ = -1;
+}
+
+pid_t ForkServer::Spawn(std::vector<std::string> const & args, std::string const & path, std::vector<std::string> const & env, int in, int out, int err) {
+    std::string request;
+    AppendStrings(request, args);
+    AppendString(request, path);
+    AppendStrings(request, env);
+    if (request.size() > MaxRequestSize)
+        throw std::ios_base::failure(STR("Spawn request for " << args[0] << " too large"));
+    int status[2];
+    if (pipe2(status, O_CLOEXEC) != 0)
+        throw std::ios_base::failure(STR("Unable to create pipe: " << std::strerror(errno)));
+    int release[2];
+    if (pipe2(release, O_CLOEXEC) != 0) {
+        close(status[0]);
+        close(status[1]);
+        throw std::ios_base::failure(STR("Unable to create pipe: " << std::strerror(errno)));
+    }
+    int fds[RequestFds] = { in, out, err, status[1], release[0] };
+    iovec iov;
+    iov.iov_base = const_cast<char *>(request.data());
+    iov.iov_len = request.size();
+    char control[CMSG_SPACE(sizeof(fds))];
+    std::memset(control, 0, sizeof(control));
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr * c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket_, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 and errno == EINTR);
+    // the server has its own copy of the write end, so that we see the end of file when the waiter is done
+    close(status[1]);
+    close(release[0]);
+    int pid;
+    if (sent == -1 or not ReadInt(status[0], pid)) {
+        close(status[0]);
+        close(release[1]);
+        throw std::ios_base::failure(STR("Fork server unable to execute command " << args[0]));
+    }
+    if (pid < 0) {
+        close(status[0]);
+        close(release[1]);
+        throw std::ios_base::failure(STR("Unable to execute command " << args[0] << " in " << path << ": " << std::strerror(-pid)));
+    }
+    std::lock_guard<std::mutex> g(waitersGuard_);
+    waiters_[pid] = Waiter{status[0], release[1]};
+    return pid;
+}
+
+bool ForkServer::Wait(pid_t pid, int & status) {
+    int fd;
+    {
+        std::lock_guard<std::mutex> g(waitersGuard_);
+        auto i = waiters_.find(pid);
+        if (i == waiters_.end())
+            return false;
+        fd = i->second.status;
+    }
+    // a waiter that died without reporting is as good as a killed process
+    if (not ReadInt(fd, status))
+        status = SIGKILL;
+    return true;
+}
+
+void ForkServer::Reap(pid_t pid) {
+    Waiter w;
+    {
+        std::lock_guard<std::mutex> g(waitersGuard_);
+        auto i = waiters_.find(pid);
+        if (i == waiters_.end())
+            return;
+        w = i->second;
+        waiters_.erase(i);
+    }
+    close(w.status);
+    close(w.release);
+}
+
+void ForkServer::Serve(int socket) {
+    // the waiters are reaped automatically
+    signal(SIGCHLD, SIG_IGN);
+    // leave interrupting the whole process group to our parent, the server terminates when the socket closes
+    signal(SIGINT, SIG_IGN);
+    std::unique_ptr<char[]> buffer(new char[MaxRequestSize]);
+    while (true) {
+        int fds[RequestFds];
+        iovec iov;
+        iov.iov_base = buffer.get();
+        iov.iov_len = MaxRequestSize;
+        char control[CMSG_SPACE(sizeof(fds))];
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t size = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+        if (size == -1 and errno == EINTR)
+            continue;
+        if (size <= 0)
+            return;
+        cmsghdr * c = CMSG_FIRSTHDR(&msg);
+        if (c == nullptr or c->cmsg_type != SCM_RIGHTS or c->cmsg_len != CMSG_LEN(sizeof(fds)))
+            continue;
+        std::memcpy(fds, CMSG_DATA(c), sizeof(fds));
+        pid_t waiter = fork();
+        if (waiter == 0) {
+            close(socket);
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGINT, SIG_DFL);
+            int result;
+            try {
+                char const * x = buffer.get();
+                char const * end = x + size;
+                std::vector<std::string> args = ReadStrings(x, end);
+                std::string path = ReadString(x, end);
+                std::vector<std::string> env = ReadStrings(x, end);
+                result = Process::SpawnDirect(args, path, env, fds[0], fds[1], fds[2]);
+            } catch (...) {
+                result = -ENOENT;
+            }
+            // the process has its own copies now, ours would keep its output open
+            for (unsigned i = 0; i < 3; ++i)
+                close(fds[i]);
+            WriteInt(fds[3], result);
+            if (result > 0) {
+                int status;
+                if (not Process::WaitTerminated(result, status))
+                    status = SIGKILL;
+                WriteInt(fds[3], status);
+                // the zombie keeps the pid taken until the downloader closes the release pipe
+                char c;
+                ssize_t x;
+                do {
+                    x = read(fds[4], &c, 1);
+                } while (x > 0 or (x == -1 and errno == EINTR));
+                while (waitpid(result, &status, 0) == -1 and errno == EINTR) { }
+            }
+            _exit(EXIT_SUCCESS);
+        }
+        if (waiter == -1)
+            WriteInt(fds[3], -errno);
+        for (int fd : fds)
+            close(fd);
+    }
+}
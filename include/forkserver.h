@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+/** Small helper process that starts subprocesses on our behalf.
+
+  Starting a process from a process with a huge heap may have to copy its page tables, which gets slower the more memory the downloader uses and serializes the worker threads on the address space. The fork server is forked at the very beginning, while the heap is still small, and from then on receives spawn requests over a unix socket, together with the descriptors the new process should use for its standard input, output and error. The launch latency then does not depend on our size at all.
+
+  Each spawned process is watched by a tiny waiter forked from the server, which reports the pid of the process and, once it terminates, its exit status through a pipe. The waiter reaps the process only when the release pipe, whose write end we keep, is closed. Since the processes are not our children, they must be waited for by ForkServer::Wait and released by ForkServer::Reap, which Process::Wait does automatically.
+ */
+class ForkServer {
+public:
+
+    /** Starts the fork server.
+
+      Must be called before any threads are started and before any large data structures are loaded. Does nothing if the server is already running.
+     */
+    static void Start();
+
+    /** Stops the fork server. Processes already started keep running and can still be waited for.
+     */
+    static void Stop();
+
+    static bool IsRunning() {
+        return socket_ != -1;
+    }
+
+    /** Spawns the given process through the server, see Process::Spawn for the arguments.
+     */
+    static pid_t Spawn(std::vector<std::string> const & args, std::string const & path, std::vector<std::string> const & env, int in, int out, int err);
+
+    /** If the process was started by the fork server, waits for it to terminate, stores its wait status and returns true. Returns false for processes started otherwise.
+
+      The process is not reaped until Reap() is called, so its pid cannot be reused in the meantime.
+     */
+    static bool Wait(pid_t pid, int & status);
+
+    /** Lets the waiter of a process started by the fork server reap it, must be called once after Wait().
+     */
+    static void Reap(pid_t pid);
+
+private:
+
+    /** The main loop of the fork server process.
+     */
+    static void Serve(int socket);
+
+    static int socket_;
+    static pid_t pid_;
+
+    /** Pipes through which the waiters report the exit statuses of the spawned processes, and the pipes whose closing lets them reap the processes.
+     */
+    struct Waiter {
+        int status;
+        int release;
+    };
+
+    static std::unordered_map<pid_t, Waiter> waiters_;
+    static std::mutex waitersGuard_;
+};
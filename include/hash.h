@@ -4,6 +4,7 @@
 #include <string>
 #include <ostream>
 #include <cassert>
+#include <cstring>
 
 
 
@@ -20,6 +21,18 @@ struct Hash {
             data_[i] = FromHex(hex[i * 2]) * 16 + FromHex(hex[i * 2 + 1]);
     }
 
+    /** Creates the hash from its raw binary representation, as stored in git trees and pack indices.
+     */
+    static Hash<BYTES> FromBytes(void const * raw) {
+        Hash<BYTES> result;
+        std::memcpy(result.data_, raw, BYTES);
+        return result;
+    }
+
+    unsigned char const * data() const {
+        return data_;
+    }
+
     bool operator == (Hash<BYTES> const & other) const {
         for (unsigned i = 0; i < BYTES; ++i)
             if (data_[i] != other.data_[i])
@@ -60,12 +73,24 @@ namespace std {
     struct hash<::Hash<BYTES>> {
 
         std::size_t operator()(::Hash<BYTES> const & h) const {
-            std::size_t result = 0;
+            // std::hash of integers is identity, so the words are combined and the result mixed by murmur3's finalizer, otherwise the sum of the words would end up in the buckets unmixed
+            uint64_t result = 0;
             unsigned i = 0;
-            for (; i < BYTES - 8; i += 8)
-                result += std::hash<uint64_t>()(* reinterpret_cast<uint64_t const*>(h.data_+i));
-            for (; i < BYTES; ++i)
-                result += std::hash<char>()(h.data_[i]);
+            for (; i + 8 <= BYTES; i += 8) {
+                uint64_t x;
+                std::memcpy(&x, h.data_ + i, 8);
+                result = (result ^ x) * 0x9e3779b97f4a7c15ULL;
+            }
+            if (i < BYTES) {
+                uint32_t x;
+                std::memcpy(&x, h.data_ + i, 4);
+                result = (result ^ x) * 0x9e3779b97f4a7c15ULL;
+            }
+            result ^= result >> 33;
+            result *= 0xff51afd7ed558ccdULL;
+            result ^= result >> 33;
+            result *= 0xc4ceb9fe1a85ec53ULL;
+            result ^= result >> 33;
             return result;
         }
     };
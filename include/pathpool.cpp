@@ -0,0 +1,78 @@
+#include <algorithm>
+
+#include "pathpool.h"
+
+uint32_t const PathPool::NotFound;
+size_t const PathPool::BlockSize;
+
+PathPool::PathPool():
+    slots_(16, 0) {
+}
+
+uint32_t PathPool::intern(std::string const & path) {
+    uint32_t hash = Hash(path);
+    size_t i = slot(path, hash);
+    if (slots_[i] != 0)
+        return slots_[i] - 1;
+    entries_.push_back(store(path, hash));
+    slots_[i] = static_cast<uint32_t>(entries_.size());
+    // the table is kept at most three quarters full
+    if (entries_.size() * 4 > slots_.size() * 3)
+        grow();
+    return static_cast<uint32_t>(entries_.size() - 1);
+}
+
+uint32_t PathPool::find(std::string const & path) const {
+    // an empty slot holds 0, which gives NotFound
+    size_t i = slot(path, Hash(path));
+    return slots_[i] - 1;
+}
+
+size_t PathPool::memory() const {
+    size_t result = 0;
+    for (std::string const & block : blocks_)
+        result += block.capacity();
+    return result + entries_.capacity() * sizeof(Entry) + slots_.capacity() * sizeof(uint32_t);
+}
+
+uint32_t PathPool::Hash(std::string const & path) {
+    // FNV-1a
+    uint32_t result = 2166136261u;
+    for (char c : path)
+        result = (result ^ static_cast<unsigned char>(c)) * 16777619u;
+    return result;
+}
+
+size_t PathPool::slot(std::string const & path, uint32_t hash) const {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (slots_[i] == 0)
+            return i;
+        Entry const & e = entries_[slots_[i] - 1];
+        if (e.hash == hash and e.size == path.size() and blocks_[e.block].compare(e.offset, e.size, path) == 0)
+            return i;
+    }
+}
+
+PathPool::Entry PathPool::store(std::string const & path, uint32_t hash) {
+    if (blocks_.empty() or blocks_.back().size() + path.size() > BlockSize) {
+        blocks_.push_back(std::string());
+        blocks_.back().reserve(std::max(BlockSize, path.size()));
+    }
+    std::string & block = blocks_.back();
+    Entry result{ static_cast<uint32_t>(blocks_.size() - 1), static_cast<uint32_t>(block.size()), static_cast<uint32_t>(path.size()), hash };
+    block += path;
+    return result;
+}
+
+void PathPool::grow() {
+    std::vector<uint32_t> slots(slots_.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (uint32_t id = 0; id < entries_.size(); ++id) {
+        size_t i = entries_[id].hash & mask;
+        while (slots[i] != 0)
+            i = (i + 1) & mask;
+        slots[i] = id + 1;
+    }
+    slots_.swap(slots);
+}
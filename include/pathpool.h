@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** Interns paths, giving each distinct path a dense 32bit id in the order the paths were first seen.
+
+  The characters of the paths are stored one after another in an arena of large blocks, so that each distinct path is allocated once and a path occurring in many commits costs nothing but its id. Paths are looked up by an open addressing table of their ids with linear probing. Each entry remembers the hash of its path, so that neither lookups nor growing the table compare or rehash the characters of other paths.
+
+  Entries refer to their characters by the block and offset, so that the pool can be copied. Not thread safe, each project has its own pool.
+ */
+class PathPool {
+public:
+
+    static uint32_t const NotFound = 0xffffffff;
+
+    PathPool();
+
+    /** Returns the id of given path, adding it to the pool if it is not there yet.
+     */
+    uint32_t intern(std::string const & path);
+
+    /** Returns the id of given path, or NotFound if the path is not in the pool.
+     */
+    uint32_t find(std::string const & path) const;
+
+    /** Returns the path of given id.
+     */
+    std::string path(uint32_t id) const {
+        Entry const & e = entries_[id];
+        return blocks_[e.block].substr(e.offset, e.size);
+    }
+
+    /** Number of distinct paths in the pool.
+     */
+    size_t size() const {
+        return entries_.size();
+    }
+
+    /** Bytes taken by the characters of the paths, the entries and the table.
+     */
+    size_t memory() const;
+
+private:
+
+    struct Entry {
+        uint32_t block;
+        uint32_t offset;
+        uint32_t size;
+        uint32_t hash;
+    };
+
+    static uint32_t Hash(std::string const & path);
+
+    /** Returns the slot of given path, which is either empty, or holds the path's id.
+     */
+    size_t slot(std::string const & path, uint32_t hash) const;
+
+    /** Copies the characters into the arena and returns the entry of the path.
+     */
+    Entry store(std::string const & path, uint32_t hash);
+
+    /** Doubles the table and reinserts all paths.
+     */
+    void grow();
+
+    /** Size of the arena blocks, longer paths get a block of their own. */
+    static size_t const BlockSize = 64 * 1024;
+
+    std::vector<std::string> blocks_;
+
+    std::vector<Entry> entries_;
+    /** Id of the path plus one for each slot, 0 for empty slots. The size is a power of two. */
+    std::vector<uint32_t> slots_;
+};
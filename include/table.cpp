@@ -0,0 +1,419 @@
+#include <unistd.h>
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "utils.h"
+#include "filesystem.h"
+#include "contentstore.h"
+#include "table.h"
+
+namespace {
+
+    char const Magic[] = "GHTTBL01";
+
+    template<typename T>
+    void Append(std::string & into, T value) {
+        into.append(reinterpret_cast<char const *>(& value), sizeof(T));
+    }
+
+    template<typename T>
+    T Read(unsigned char const * from) {
+        T result;
+        std::memcpy(& result, from, sizeof(T));
+        return result;
+    }
+
+    /** Size of the fixed width values of given type, 4 for the dictionary indices of strings.
+     */
+    size_t ValueSize(Table::Type type) {
+        switch (type) {
+            case Table::Type::Int32:
+            case Table::Type::String:
+                return 4;
+            case Table::Type::Int64:
+            case Table::Type::Double:
+                return 8;
+            case Table::Type::Hash:
+                return 20;
+            default:
+                throw std::runtime_error(STR("Unknown column type " << static_cast<int>(type)));
+        }
+    }
+
+} // anonymous namespace
+
+// Table::RowGroup --------------------------------------------------------------------------------
+
+Table::RowGroup::RowGroup(Schema const & schema):
+    schema_(schema),
+    columns_(schema.size()),
+    dictionaries_(schema.size()),
+    dictionaryData_(schema.size()),
+    column_(0),
+    rows_(0) {
+}
+
+Table::RowGroup & Table::RowGroup::operator << (int value) {
+    Append<int32_t>(columns_[next(Type::Int32)], value);
+    return *this;
+}
+
+Table::RowGroup & Table::RowGroup::operator << (long value) {
+    Append<int64_t>(columns_[next(Type::Int64)], value);
+    return *this;
+}
+
+Table::RowGroup & Table::RowGroup::operator << (double value) {
+    Append<double>(columns_[next(Type::Double)], value);
+    return *this;
+}
+
+Table::RowGroup & Table::RowGroup::operator << (SHA1 const & value) {
+    columns_[next(Type::Hash)].append(reinterpret_cast<char const *>(value.data()), 20);
+    return *this;
+}
+
+Table::RowGroup & Table::RowGroup::operator << (std::string const & value) {
+    size_t c = next(Type::String);
+    auto i = dictionaries_[c].find(value);
+    if (i == dictionaries_[c].end()) {
+        i = dictionaries_[c].insert(std::make_pair(value, static_cast<uint32_t>(dictionaries_[c].size()))).first;
+        Append<uint32_t>(dictionaryData_[c], value.size());
+        dictionaryData_[c] += value;
+    }
+    Append<uint32_t>(columns_[c], i->second);
+    return *this;
+}
+
+void Table::RowGroup::clear() {
+    for (size_t c = 0; c < schema_.size(); ++c) {
+        columns_[c].clear();
+        dictionaries_[c].clear();
+        dictionaryData_[c].clear();
+    }
+    column_ = 0;
+    rows_ = 0;
+}
+
+size_t Table::RowGroup::memory() const {
+    size_t result = 0;
+    for (size_t c = 0; c < schema_.size(); ++c) {
+        result += columns_[c].capacity() + dictionaryData_[c].capacity();
+        // each distinct string is also a key of a map node, with its bucket
+        for (auto const & i : dictionaries_[c])
+            result += i.first.capacity() + 64;
+    }
+    return result;
+}
+
+std::string Table::RowGroup::encode() const {
+    if (column_ != 0)
+        throw std::runtime_error("Row group ends with an incomplete row");
+    std::string columns;
+    for (size_t c = 0; c < schema_.size(); ++c) {
+        std::string raw;
+        if (schema_[c].type == Type::String) {
+            Append<uint32_t>(raw, dictionaries_[c].size());
+            raw += dictionaryData_[c];
+        }
+        raw += columns_[c];
+        ContentStore::Codec codec = ContentStore::Codec::Deflate;
+        std::string stored = ContentStore::Compress(raw.data(), raw.size(), codec);
+        // columns that do not compress, such as hashes, are stored as they are
+        if (stored.size() >= raw.size()) {
+            codec = ContentStore::Codec::None;
+            stored = raw;
+        }
+        Append<uint8_t>(columns, static_cast<uint8_t>(codec));
+        Append<uint32_t>(columns, raw.size());
+        Append<uint32_t>(columns, stored.size());
+        columns += stored;
+    }
+    std::string result;
+    Append<uint64_t>(result, sizeof(uint32_t) + columns.size());
+    Append<uint32_t>(result, rows_);
+    result += columns;
+    return result;
+}
+
+size_t Table::RowGroup::next(Type type) {
+    size_t result = column_;
+    if (schema_[result].type != type)
+        throw std::runtime_error(STR("Value of wrong type for column " << schema_[result].name));
+    if (++column_ == schema_.size()) {
+        column_ = 0;
+        ++rows_;
+    }
+    return result;
+}
+
+// Table::Chunk -----------------------------------------------------------------------------------
+
+int32_t Table::Chunk::int32(size_t row) const {
+    return Read<int32_t>(reinterpret_cast<unsigned char const *>(data_.data()) + row * 4);
+}
+
+int64_t Table::Chunk::int64(size_t row) const {
+    return Read<int64_t>(reinterpret_cast<unsigned char const *>(data_.data()) + row * 8);
+}
+
+double Table::Chunk::real(size_t row) const {
+    return Read<double>(reinterpret_cast<unsigned char const *>(data_.data()) + row * 8);
+}
+
+SHA1 Table::Chunk::hash(size_t row) const {
+    return SHA1::FromBytes(data_.data() + row * 20);
+}
+
+std::string const & Table::Chunk::string(size_t row) const {
+    return dictionary_[Read<uint32_t>(reinterpret_cast<unsigned char const *>(data_.data()) + row * 4)];
+}
+
+// Table::Writer ----------------------------------------------------------------------------------
+
+Table::Writer::Writer(std::string const & path, std::string const & name, Schema const & schema, unsigned shards):
+    path_(path),
+    name_(name),
+    schema_(schema),
+    numShards_(std::max(shards, 1u)),
+    shards_(new Shard[numShards_]) {
+    createPathIfMissing(path_);
+}
+
+void Table::Writer::write(unsigned shard, RowGroup const & rows) {
+    if (rows.empty())
+        return;
+    std::string data = rows.encode();
+    Shard & s = shards_[shard % numShards_];
+    std::lock_guard<std::mutex> g(s.guard);
+    if (not s.file.is_open())
+        open(shard % numShards_);
+    s.file.write(data.data(), data.size());
+    s.file.flush();
+    if (not s.file.good())
+        throw std::ios_base::failure(STR("Unable to write to table " << name_ << ", shard " << shard % numShards_));
+}
+
+void Table::Writer::append(unsigned shard, std::istream & encoded) {
+    Shard & s = shards_[shard % numShards_];
+    std::lock_guard<std::mutex> g(s.guard);
+    if (not s.file.is_open())
+        open(shard % numShards_);
+    std::vector<char> buffer(1024 * 1024);
+    while (encoded) {
+        encoded.read(buffer.data(), buffer.size());
+        s.file.write(buffer.data(), encoded.gcount());
+    }
+    s.file.flush();
+    if (not s.file.good())
+        throw std::ios_base::failure(STR("Unable to write to table " << name_ << ", shard " << shard % numShards_));
+}
+
+void Table::Writer::flush() {
+    for (unsigned i = 0; i < numShards_; ++i) {
+        std::lock_guard<std::mutex> g(shards_[i].guard);
+        if (shards_[i].file.is_open())
+            shards_[i].file.flush();
+    }
+}
+
+void Table::Writer::open(unsigned shard) {
+    std::string filename = STR(path_ << "/" << name_ << "_" << shard << ".tbl");
+    Shard & s = shards_[shard];
+    size_t size = fileSize(filename);
+    if (size == 0) {
+        s.file = CheckedOpen(filename);
+        std::string header = EncodeHeader(schema_);
+        s.file.write(header.data(), header.size());
+        return;
+    }
+    size_t valid;
+    {
+        MappedFile f(filename);
+        Schema schema;
+        size_t header = DecodeHeader(f.data(), f.size(), schema);
+        if (not (schema == schema_))
+            throw std::runtime_error(STR("Table " << filename << " has a different schema"));
+        valid = header + ValidLength(f.data() + header, f.size() - header);
+    }
+    if (valid < size and truncate(filename.c_str(), valid) != 0)
+        throw std::ios_base::failure(STR("Unable to drop incomplete row group of " << filename));
+    s.file = CheckedOpen(filename, true);
+}
+
+// Table::Reader ----------------------------------------------------------------------------------
+
+Table::Reader::Reader(std::string const & path, std::string const & name) {
+    std::vector<std::pair<unsigned, std::string>> shards;
+    std::string prefix = name + "_";
+    if (isDirectory(path)) {
+        for (std::string const & f : listDirectory(path)) {
+            if (f.size() <= prefix.size() + 4 or f.compare(0, prefix.size(), prefix) != 0 or f.compare(f.size() - 4, 4, ".tbl") != 0)
+                continue;
+            std::string number = f.substr(prefix.size(), f.size() - prefix.size() - 4);
+            if (number.find_first_not_of("0123456789") != std::string::npos)
+                continue;
+            shards.push_back(std::make_pair(std::stoul(number), STR(path << "/" << f)));
+        }
+    }
+    std::sort(shards.begin(), shards.end());
+    for (auto const & s : shards) {
+        MappedFile f(s.second);
+        Schema schema;
+        DecodeHeader(f.data(), f.size(), schema);
+        if (files_.empty())
+            schema_ = schema;
+        else if (not (schema == schema_))
+            throw std::runtime_error(STR("Table " << s.second << " has a different schema"));
+        files_.push_back(s.second);
+    }
+}
+
+void Table::Reader::scan(std::string const & column, std::function<void(Chunk const &)> const & reader) const {
+    size_t index = 0;
+    while (index < schema_.size() and schema_[index].name != column)
+        ++index;
+    if (index == schema_.size())
+        throw std::runtime_error(STR("Table has no column " << column));
+    forEachGroup([&] (unsigned char const * group, size_t) {
+        size_t rows = Read<uint32_t>(group);
+        unsigned char const * p = group + 4;
+        for (size_t c = 0; c < index; ++c)
+            p += ColumnLength(p);
+        reader(DecodeColumn(schema_[index].type, rows, p));
+    });
+}
+
+void Table::Reader::scan(std::function<void(std::vector<Chunk> const &)> const & reader) const {
+    forEachGroup([&] (unsigned char const * group, size_t) {
+        size_t rows = Read<uint32_t>(group);
+        unsigned char const * p = group + 4;
+        std::vector<Chunk> columns;
+        for (Column const & c : schema_) {
+            columns.push_back(DecodeColumn(c.type, rows, p));
+            p += ColumnLength(p);
+        }
+        reader(columns);
+    });
+}
+
+void Table::Reader::exportCsv(std::ostream & s) const {
+    scan([&] (std::vector<Chunk> const & columns) {
+        size_t rows = columns.empty() ? 0 : columns.front().size();
+        for (size_t row = 0; row < rows; ++row) {
+            for (size_t c = 0; c < columns.size(); ++c) {
+                if (c > 0)
+                    s << ",";
+                switch (columns[c].type()) {
+                    case Type::Int32:
+                        s << columns[c].int32(row);
+                        break;
+                    case Type::Int64:
+                        s << columns[c].int64(row);
+                        break;
+                    case Type::Double:
+                        s << columns[c].real(row);
+                        break;
+                    case Type::Hash:
+                        s << columns[c].hash(row);
+                        break;
+                    case Type::String:
+                        s << escape(columns[c].string(row));
+                        break;
+                }
+            }
+            s << "\n";
+        }
+    });
+    s.flush();
+}
+
+void Table::Reader::forEachGroup(std::function<void(unsigned char const *, size_t)> const & reader) const {
+    for (std::string const & filename : files_) {
+        MappedFile f(filename);
+        Schema schema;
+        size_t pos = DecodeHeader(f.data(), f.size(), schema);
+        // a row group being appended, or cut short by a crash, is not read
+        size_t end = pos + ValidLength(f.data() + pos, f.size() - pos);
+        while (pos < end) {
+            size_t length = Read<uint64_t>(f.data() + pos);
+            reader(f.data() + pos + 8, length);
+            pos += 8 + length;
+        }
+    }
+}
+
+// Table ------------------------------------------------------------------------------------------
+
+std::string Table::EncodeHeader(Schema const & schema) {
+    std::string result(Magic, 8);
+    Append<uint32_t>(result, schema.size());
+    for (Column const & c : schema) {
+        Append<uint8_t>(result, static_cast<uint8_t>(c.type));
+        Append<uint32_t>(result, c.name.size());
+        result += c.name;
+    }
+    return result;
+}
+
+size_t Table::DecodeHeader(unsigned char const * data, size_t size, Schema & schema) {
+    if (size < 12 or std::memcmp(data, Magic, 8) != 0)
+        throw std::runtime_error("Not a table file");
+    size_t columns = Read<uint32_t>(data + 8);
+    size_t pos = 12;
+    schema.clear();
+    for (size_t i = 0; i < columns; ++i) {
+        if (pos + 5 > size)
+            throw std::runtime_error("Corrupted table header");
+        Type type = static_cast<Type>(data[pos]);
+        size_t length = Read<uint32_t>(data + pos + 1);
+        pos += 5;
+        if (pos + length > size)
+            throw std::runtime_error("Corrupted table header");
+        schema.push_back(Column{std::string(reinterpret_cast<char const *>(data) + pos, length), type});
+        pos += length;
+    }
+    return pos;
+}
+
+size_t Table::ValidLength(unsigned char const * data, size_t size) {
+    size_t pos = 0;
+    while (pos + 8 <= size) {
+        uint64_t length = Read<uint64_t>(data + pos);
+        if (length > size - pos - 8)
+            break;
+        pos += 8 + length;
+    }
+    return pos;
+}
+
+Table::Chunk Table::DecodeColumn(Type type, size_t rows, unsigned char const * column) {
+    ContentStore::Codec codec = static_cast<ContentStore::Codec>(column[0]);
+    size_t rawSize = Read<uint32_t>(column + 1);
+    size_t storedSize = Read<uint32_t>(column + 5);
+    Chunk result;
+    result.type_ = type;
+    result.rows_ = rows;
+    result.data_ = ContentStore::Decompress(reinterpret_cast<char const *>(column) + 9, storedSize, rawSize, codec);
+    if (type == Type::String) {
+        unsigned char const * p = reinterpret_cast<unsigned char const *>(result.data_.data());
+        size_t count = Read<uint32_t>(p);
+        size_t pos = 4;
+        result.dictionary_.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            size_t length = Read<uint32_t>(p + pos);
+            result.dictionary_.push_back(result.data_.substr(pos + 4, length));
+            pos += 4 + length;
+        }
+        result.data_.erase(0, pos);
+    }
+    if (result.data_.size() != rows * ValueSize(type))
+        throw std::runtime_error("Corrupted table column");
+    return result;
+}
+
+size_t Table::ColumnLength(unsigned char const * column) {
+    return 9 + Read<uint32_t>(column + 5);
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+
+/** Columnar binary tables.
+
+  A table is stored in a few shard files, each of which is a header with the schema of the table followed by row groups appended one after another. A row group holds the values of each column together, so that a column can be read without touching the others. Integers and doubles are stored with fixed width, hashes as their 20 raw bytes and strings are dictionary encoded, i.e. each distinct string of the row group is stored once and the rows refer to it by a 32bit index. Each column of a row group is compressed on its own.
+
+  The header is the magic "GHTTBL01", the number of columns and for each column its type and its name as a 32bit length and the characters. Each row group is its length as a 64bit number, the number of rows and for each column its codec, its size before and after compression as 32bit numbers and the compressed data. Row groups are appended whole, and a row group cut short by a crash is dropped when the shard is next opened for writing.
+ */
+class Table {
+public:
+
+    enum class Type : uint8_t {
+        Int32 = 1,
+        Int64 = 2,
+        Double = 3,
+        Hash = 4,
+        String = 5,
+    };
+
+    struct Column {
+        std::string name;
+        Type type;
+
+        bool operator == (Column const & other) const {
+            return name == other.name and type == other.type;
+        }
+    };
+
+    typedef std::vector<Column> Schema;
+
+    /** Rows to be written to a table as a single row group.
+
+      Values are added in the order of the columns, row after row, and must have the type of their column.
+     */
+    class RowGroup {
+    public:
+        RowGroup(Schema const & schema);
+
+        RowGroup & operator << (int value);
+        RowGroup & operator << (long value);
+        RowGroup & operator << (double value);
+        RowGroup & operator << (SHA1 const & value);
+        RowGroup & operator << (std::string const & value);
+
+        size_t rows() const {
+            return rows_;
+        }
+
+        bool empty() const {
+            return rows_ == 0 and column_ == 0;
+        }
+
+        void clear();
+
+        /** Approximate number of bytes taken by the values and dictionaries of the rows.
+         */
+        size_t memory() const;
+
+        /** Returns the row group as stored in the table files.
+         */
+        std::string encode() const;
+
+    private:
+
+        /** Returns the index of the column of the next value, which must be of given type, and moves to the column after it.
+         */
+        size_t next(Type type);
+
+        Schema schema_;
+        std::vector<std::string> columns_;
+        /** Index of each distinct string of a string column. */
+        std::vector<std::unordered_map<std::string, uint32_t>> dictionaries_;
+        /** Distinct strings of each string column in the order of their indices, as their lengths and characters. */
+        std::vector<std::string> dictionaryData_;
+        size_t column_;
+        size_t rows_;
+    };
+
+    /** Values of a single column of a row group.
+     */
+    class Chunk {
+    public:
+        Type type() const {
+            return type_;
+        }
+
+        size_t size() const {
+            return rows_;
+        }
+
+        int32_t int32(size_t row) const;
+        int64_t int64(size_t row) const;
+        double real(size_t row) const;
+        SHA1 hash(size_t row) const;
+        std::string const & string(size_t row) const;
+
+    private:
+        friend class Table;
+
+        Type type_;
+        size_t rows_;
+        /** Fixed width values, or the dictionary indices of strings. */
+        std::string data_;
+        std::vector<std::string> dictionary_;
+    };
+
+    /** Appends row groups to the shards of a table. Thread safe.
+     */
+    class Writer {
+    public:
+        /** Creates the writer of the table of given name in given directory. The shard files are named name_N.tbl and are created when first written to.
+         */
+        Writer(std::string const & path, std::string const & name, Schema const & schema, unsigned shards);
+
+        /** Appends the rows to given shard, unless there are none. The row group is encoded and compressed before the shard is locked.
+         */
+        void write(unsigned shard, RowGroup const & rows);
+
+        /** Appends the row groups encoded by RowGroup::encode() read from given stream to given shard. The shard is locked only once, so that they are not interleaved with the row groups of other threads.
+         */
+        void append(unsigned shard, std::istream & encoded);
+
+        /** Flushes all shards.
+         */
+        void flush();
+
+        unsigned shards() const {
+            return numShards_;
+        }
+
+        std::string const & name() const {
+            return name_;
+        }
+
+    private:
+        struct Shard {
+            std::mutex guard;
+            std::ofstream file;
+        };
+
+        /** Opens the shard for appending, writing the header if the shard is new, or checking it and dropping any incomplete row group at its end if not.
+         */
+        void open(unsigned shard);
+
+        std::string path_;
+        std::string name_;
+        Schema schema_;
+        unsigned numShards_;
+        std::unique_ptr<Shard[]> shards_;
+    };
+
+    /** Reads all shards of a table.
+     */
+    class Reader {
+    public:
+        /** Opens all shards of the table of given name in given directory, which must have the same schema. A table without shards has an empty schema.
+         */
+        Reader(std::string const & path, std::string const & name);
+
+        Schema const & schema() const {
+            return schema_;
+        }
+
+        /** Calls the reader with the values of given column in each row group of all shards, decompressing no other columns.
+         */
+        void scan(std::string const & column, std::function<void(Chunk const &)> const & reader) const;
+
+        /** Calls the reader with all columns of each row group of all shards.
+         */
+        void scan(std::function<void(std::vector<Chunk> const &)> const & reader) const;
+
+        /** Writes all rows of the table as csv, in the format of the csv files written by the downloader.
+         */
+        void exportCsv(std::ostream & s) const;
+
+    private:
+
+        /** Calls the reader for each row group of each shard with the mapped data of the group and its size.
+         */
+        void forEachGroup(std::function<void(unsigned char const *, size_t)> const & reader) const;
+
+        std::vector<std::string> files_;
+        Schema schema_;
+    };
+
+    /** Returns the header of a table with given schema.
+     */
+    static std::string EncodeHeader(Schema const & schema);
+
+    /** Decodes the header at the beginning of given data into the schema and returns its length. Throws if the data does not start with a valid header.
+     */
+    static size_t DecodeHeader(unsigned char const * data, size_t size, Schema & schema);
+
+    /** Returns the length of the complete row groups at the beginning of given data, which follows the header.
+     */
+    static size_t ValidLength(unsigned char const * data, size_t size);
+
+    /** Decodes the given column of the row group.
+     */
+    static Chunk DecodeColumn(Type type, size_t rows, unsigned char const * column);
+
+    /** Returns the size of a column header and its compressed data.
+     */
+    static size_t ColumnLength(unsigned char const * column);
+
+};
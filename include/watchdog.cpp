@@ -0,0 +1,93 @@
+#include <signal.h>
+
+#include <algorithm>
+
+#include "watchdog.h"
+
+thread_local Watchdog::Budget * Watchdog::current_ = nullptr;
+std::mutex Watchdog::m_;
+std::condition_variable Watchdog::cv_;
+std::vector<Watchdog::Budget *> Watchdog::budgets_;
+bool Watchdog::running_ = false;
+std::thread Watchdog::thread_;
+
+Watchdog::Budget::Budget(double seconds, std::string const & what):
+    seconds_(seconds),
+    what_(what),
+    deadline_(std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<long>(seconds * 1000))),
+    expired_(false) {
+    if (seconds <= 0)
+        return;
+    current_ = this;
+    std::lock_guard<std::mutex> g(m_);
+    budgets_.push_back(this);
+}
+
+Watchdog::Budget::~Budget() {
+    if (seconds_ <= 0)
+        return;
+    current_ = nullptr;
+    std::lock_guard<std::mutex> g(m_);
+    budgets_.erase(std::find(budgets_.begin(), budgets_.end(), this));
+}
+
+void Watchdog::Start(double period) {
+    std::lock_guard<std::mutex> g(m_);
+    if (running_)
+        return;
+    running_ = true;
+    thread_ = std::thread(Run, period);
+}
+
+void Watchdog::Stop() {
+    {
+        std::lock_guard<std::mutex> g(m_);
+        if (not running_)
+            return;
+        running_ = false;
+        cv_.notify_all();
+    }
+    thread_.join();
+}
+
+void Watchdog::Check() {
+    if (current_ != nullptr and current_->expired_)
+        throw current_->error();
+}
+
+void Watchdog::Register(pid_t pid) {
+    if (current_ == nullptr)
+        return;
+    std::lock_guard<std::mutex> g(m_);
+    current_->groups_.push_back(pid);
+    if (current_->expired_)
+        kill(-pid, SIGKILL);
+}
+
+void Watchdog::Unregister(pid_t pid) {
+    // coprocesses may be terminated by other threads than the one that started them
+    std::lock_guard<std::mutex> g(m_);
+    for (Budget * b : budgets_) {
+        auto i = std::find(b->groups_.begin(), b->groups_.end(), pid);
+        if (i != b->groups_.end()) {
+            b->groups_.erase(i);
+            return;
+        }
+    }
+}
+
+void Watchdog::Run(double period) {
+    std::unique_lock<std::mutex> g(m_);
+    while (running_) {
+        cv_.wait_for(g, std::chrono::milliseconds(static_cast<long>(period * 1000)));
+        auto now = std::chrono::steady_clock::now();
+        for (Budget * b : budgets_) {
+            if (b->expired_ or now < b->deadline_)
+                continue;
+            b->expired_ = true;
+            // the whole group, i.e. git and the helpers it started, such as the remote transport
+            for (pid_t pid : b->groups_)
+                kill(-pid, SIGKILL);
+        }
+    }
+}
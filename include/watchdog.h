@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#include <sys/types.h>
+
+#include "utils.h"
+
+/** Enforces time budgets of the threads by killing the processes they wait for.
+
+  A thread gets a budget by creating a Watchdog::Budget, which lasts until the budget is destroyed. Processes started by the thread in the meantime are registered with the budget, each of them leads a process group of its own. When the budget runs out, the watchdog thread kills the process groups, so that whatever the thread waits for fails, and Check(), which long computations call now and then, throws Watchdog::Timeout. The thread is freed either way.
+ */
+class Watchdog {
+public:
+
+    /** Thrown when the budget of a thread runs out.
+     */
+    class Timeout : public std::runtime_error {
+    public:
+        Timeout(std::string const & what):
+            std::runtime_error(what) {
+        }
+    };
+
+    /** Time budget of the thread that creates it, the budgets of a thread may not overlap.
+     */
+    class Budget {
+    public:
+        /** Starts a budget of given seconds, 0 for no limit, what describes the task in the error messages.
+         */
+        Budget(double seconds, std::string const & what);
+
+        ~Budget();
+
+        Budget(Budget const &) = delete;
+        Budget & operator = (Budget const &) = delete;
+
+        /** Returns true once the watchdog found the budget exhausted.
+         */
+        bool expired() const {
+            return expired_;
+        }
+
+        /** Returns the timeout error of the budget.
+         */
+        Timeout error() const {
+            return Timeout(STR(what_ << " timed out after " << seconds_ << "s"));
+        }
+
+    private:
+        friend class Watchdog;
+
+        double seconds_;
+        std::string what_;
+        std::chrono::steady_clock::time_point deadline_;
+        std::atomic<bool> expired_;
+
+        /** Process groups started under the budget, guarded by the watchdog's mutex. */
+        std::vector<pid_t> groups_;
+    };
+
+    /** Starts the watchdog thread checking the budgets every given seconds. Does nothing if it is already running.
+     */
+    static void Start(double period = 1);
+
+    /** Stops the watchdog thread, budgets are no longer enforced.
+     */
+    static void Stop();
+
+    /** Throws Watchdog::Timeout if the budget of the calling thread has run out.
+     */
+    static void Check();
+
+    /** Registers the process group led by given process with the budget of the calling thread, if it has one. If the budget has already run out, the group is killed right away.
+     */
+    static void Register(pid_t pid);
+
+    /** Removes the process group from the budget it was registered with, once the process has terminated.
+     */
+    static void Unregister(pid_t pid);
+
+private:
+
+    static void Run(double period);
+
+    static thread_local Budget * current_;
+
+    /** Guards the budgets, their process groups and the running flag. */
+    static std::mutex m_;
+    static std::condition_variable cv_;
+    static std::vector<Budget *> budgets_;
+    static bool running_;
+    static std::thread thread_;
+};
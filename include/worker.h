@@ -2,7 +2,9 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <memory>
+#include <vector>
 #include <atomic>
 #include <cmath>
 
@@ -21,291 +23,523 @@ void Error(std::string what);
 void Log(std::string what);
 
 
+/** Thread of a pool processing tasks of given type.
+
+  Each thread creates its own instance of CRTP, whose run() method processes the tasks. The threads belong to a Pool, which owns the tasks and the threads. Pools are instances, so that several pools, even of the same worker type, can run side by side, for instance as stages of a pipeline, each scheduling its results to the pool of the next stage. The static methods of the worker act on its default pool, for the common case of a single pool per worker type.
+ */
 template<typename CRTP, typename TASK>
 class Worker {
 public:
 
-    static size_t BlockingTaskQueueSize;
+    /** Pool of threads processing tasks of the worker type.
 
+      Each thread has its own deque of tasks. Tasks scheduled by a thread of the pool go to its own deque, tasks scheduled from elsewhere are spread over the deques round robin. A thread takes tasks from the front of its deque and when it runs out, it steals half of the tasks from the back of the deque of another thread. The deques have their own locks, so threads only contend when they steal. Only threads going idle and producers waking them up, or blocking on a full pool, take the lock of the pool.
 
-    /** Schedules given task to be processed by the worker.
+      Tasks are moved in and out of the deques, never copied.
      */
-    static void Schedule(TASK const & task, bool blockIfFull = true) {
-        std::unique_lock<std::mutex> g(m_);
-        if (blockIfFull == true) {
-            while (tasks_.size() >= BlockingTaskQueueSize) {
-                // block unitil there is room in the queue
+    class Pool {
+    public:
+
+        /** Creates a pool without threads, scheduling blocks once given number of tasks is waiting.
+         */
+        Pool(size_t blockingTaskQueueSize = 1000):
+            blockingTaskQueueSize_(blockingTaskQueueSize),
+            queued_(0),
+            nextQueue_(0),
+            numThreads_(0),
+            runningThreads_(0),
+            idleThreads_(0),
+            running_(false),
+            stopped_(false),
+            completedTasks_(0),
+            errorTasks_(0),
+            totalTime_(NAN) {
+        }
+
+        Pool(Pool const &) = delete;
+        Pool & operator = (Pool const &) = delete;
+
+        /** Sets the number of waiting tasks at which scheduling blocks, if asked to. Must be called before the pool is used.
+         */
+        void setBlockingTaskQueueSize(size_t value) {
+            blockingTaskQueueSize_ = value;
+        }
+
+        /** Returns true if scheduling a task would not block.
+         */
+        bool hasRoom() const {
+            return queued_ < blockingTaskQueueSize_;
+        }
+
+        /** Schedules given task to be processed by the pool.
+         */
+        void schedule(TASK task, bool blockIfFull = true) {
+            if (blockIfFull)
+                waitForRoom();
+            {
+                Queue & q = targetQueue();
+                std::lock_guard<std::mutex> g(q.guard);
+                q.tasks.push_back(std::move(task));
+            }
+            scheduled(1);
+        }
+
+        /** Schedules all given tasks, locking each deque only once.
+
+          If blockIfFull is true, waits until the pool is not full, but then schedules all tasks, even if that takes the pool over its blocking size.
+         */
+        void scheduleMany(std::vector<TASK> tasks, bool blockIfFull = true) {
+            if (tasks.empty())
+                return;
+            if (queues_.empty())
+                throw std::runtime_error("Unable to schedule tasks, no threads spawned");
+            if (stopped_)
+                throw std::runtime_error("Unable to schedule tasks, the pool has stopped");
+            if (blockIfFull)
+                waitForRoom();
+            if (current_ != nullptr and current_->pool_ == this) {
+                // a thread of the pool keeps the tasks, others will steal them if idle
+                Queue & q = *queues_[current_->index_];
+                std::lock_guard<std::mutex> g(q.guard);
+                for (TASK & t : tasks)
+                    q.tasks.push_back(std::move(t));
+            } else {
+                size_t n = queues_.size();
+                size_t first = nextQueue_.fetch_add(1) % n;
+                for (size_t i = 0; i < n; ++i) {
+                    Queue & q = *queues_[(first + i) % n];
+                    std::lock_guard<std::mutex> g(q.guard);
+                    for (size_t j = i; j < tasks.size(); j += n)
+                        q.tasks.push_back(std::move(tasks[j]));
+                }
+            }
+            scheduled(tasks.size());
+        }
+
+        /** Creates numThreads threads, each of which will run a worker's instance.
+
+          When spawned, all threads immediately block, even if there are new tasks in the queue and wait blocked until the run() method is called.
+         */
+        void spawn(unsigned numThreads) {
+            if (running_)
+                throw std::runtime_error("Unable to Spawn threads, already running");
+            numThreads_ = numThreads;
+            threads_.resize(numThreads);
+            // tasks left in the deques of a stopped pool are gone with them
+            queues_.clear();
+            queued_ = 0;
+            stopped_ = false;
+            for (unsigned i = 0; i < numThreads; ++i)
+                queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+            for (unsigned i = 0; i < numThreads; ++i) {
+                std::thread t([this, i] () {
+                    // set thread id
+                    setThreadId(i);
+                    // create the worker
+                    CRTP worker;
+                    threads_[i] = &worker;
+                    // start the worker
+                    static_cast<Worker &>(worker).start(*this, i);
+                    Log("Done.");
+                    threads_[i] = nullptr;
+                    // wake up the blocked stop() if last thread finishes, under the lock so that the waiter cannot miss it
+                    std::lock_guard<std::mutex> g(m_);
+                    if (--numThreads_ == 0)
+                        cvStatus_.notify_all();
+                });
+                t.detach();
+            }
+        }
+
+        /** Runs the spawned threads.
+         */
+        void run() {
+            if (running_ == true)
+                return;
+            std::lock_guard<std::mutex> g(m_);
+            // flip to running
+            running_ = true;
+            start_ = std::chrono::high_resolution_clock::now();
+            // notify all threads
+            cvStatus_.notify_all();
+        }
+
+        /** Stops all threads, i.e. raises a stop flag and waits for all threads to stop, at which point it returns to caller.
+         */
+        void stop() {
+            std::unique_lock<std::mutex> g(m_); // first get the mutex
+            // set the stop flag
+            running_ = false;
+            stopped_ = true;
+            // notify all threads in case they are waiting on the empty queue
+            cvNotEmpty_.notify_all();
+            // wait until the last thread finishes
+            while (numThreads_ > 0)
+                cvStatus_.wait(g);
+            totalTime_ = timeSinceStart();
+        }
+
+        /** Waits for all tasks to become blocked on an empty queue. Then stops them and returns when done.
+         */
+        void wait() {
+            std::unique_lock<std::mutex> g(m_); // get the mutex
+            while (queued_ > 0 or runningThreads_ > 0) {
+                // wait for the status update, i.e. when a thread waits for
+                cvStatus_.wait(g);
+            }
+            // the queue is empty, all tasks are waiting, initiate stop
+            running_ = false;
+            stopped_ = true;
+            // wakeup all threads so that they can exit
+            cvNotEmpty_.notify_all();
+            // wait for the threads to exit
+            while (numThreads_ > 0)
+                cvStatus_.wait(g);
+            totalTime_ = timeSinceStart();
+        }
+
+        /** Returns true when all threads have finished their execution.
+         */
+        bool allDone() const {
+            return numThreads_ == 0;
+        }
+
+        /** Returns the number of tasks waiting in the queues of all threads.
+         */
+        size_t queueSize() const {
+            return queued_;
+        }
+
+        unsigned long completedTasks() const {
+            return completedTasks_;
+        }
+
+        unsigned long errorTasks() const {
+            return errorTasks_;
+        }
+
+        double totalTime() const {
+            if (not std::isnan(totalTime_))
+                return totalTime_;
+            return timeSinceStart();
+        }
+
+        /** Workers of the threads of the pool, nullptr for threads that have finished.
+         */
+        std::vector<CRTP *> const & threads() const {
+            return threads_;
+        }
+
+    private:
+        friend class Worker;
+
+        /** Deque of the tasks of a single thread.
+         */
+        struct Queue {
+            std::mutex guard;
+            std::deque<TASK> tasks;
+        };
+
+        double timeSinceStart() const {
+            auto now = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count() / 1000.0;
+        }
+
+        /** Returns the deque new tasks go to, the calling thread's own if it belongs to the pool.
+         */
+        Queue & targetQueue() {
+            if (queues_.empty())
+                throw std::runtime_error("Unable to schedule tasks, no threads spawned");
+            if (stopped_)
+                throw std::runtime_error("Unable to schedule tasks, the pool has stopped");
+            if (current_ != nullptr and current_->pool_ == this)
+                return *queues_[current_->index_];
+            return *queues_[nextQueue_.fetch_add(1) % queues_.size()];
+        }
+
+        /** Blocks until there is room in the pool.
+         */
+        void waitForRoom() {
+            if (queued_ < blockingTaskQueueSize_)
+                return;
+            std::unique_lock<std::mutex> g(m_);
+            while (queued_ >= blockingTaskQueueSize_)
                 cvFull_.wait(g);
+        }
+
+        /** Accounts for given number of tasks added to the deques and wakes up idle threads.
+
+          The count is increased after the tasks are in the deques, so that a thread which sees it can also find them. A thread going idle first registers as idle and only then checks the count, so at least one of them sees the other.
+         */
+        void scheduled(size_t count) {
+            queued_ += count;
+            if (idleThreads_ > 0) {
+                std::lock_guard<std::mutex> g(m_);
+                if (count == 1)
+                    cvNotEmpty_.notify_one();
+                else
+                    cvNotEmpty_.notify_all();
             }
         }
-        tasks_.push(task);
-        cvNotEmpty_.notify_one();
-    }
 
-    /** Creates numThreads threads, each of which will run a worker's instance.
+        size_t blockingTaskQueueSize_;
+
+        // CV's to signal
+
+        /** CV variable that is used to signal any event change, i.e. full queue, etc.
+         */
+        std::condition_variable cvNotEmpty_;
+
+        std::condition_variable cvFull_;
+
+        std::condition_variable cvStatus_;
+
+        /** Mutex of the pool, guards the thread counts and the waiting on the condition variables.
+         */
+        std::mutex m_;
+
+        /** Deques of the tasks of each thread.
+         */
+        std::vector<std::unique_ptr<Queue>> queues_;
 
-      When spawned, all threads immediately block, even if there are new tasks in the queue and wait blocked until the run() method is called.
+        std::vector<CRTP *> threads_;
+
+        /** Number of tasks in all deques.
+         */
+        std::atomic<size_t> queued_;
+
+        /** Deque the next task scheduled from outside of the pool goes to.
+         */
+        std::atomic<size_t> nextQueue_;
+
+        /** Number of existing threads.
+
+          Initialized to numThreads by the spawn() method, decreased by threads as they are stopped.
+         */
+        unsigned numThreads_;
+
+        /** Number of active threads (i.e. threads that are not blocking on empty task queue.
+         */
+        unsigned runningThreads_;
+
+        /** Number of threads blocked waiting for tasks.
+         */
+        std::atomic<unsigned> idleThreads_;
+
+        /** If true, the threads should be running. If false, they should stop if running, or wait for run if they has not started yet.
+         */
+        std::atomic<bool> running_;
+
+        /** Set once the pool is stopped, until threads are spawned again, tasks scheduled to a stopped pool would never run.
+         */
+        std::atomic<bool> stopped_;
+
+        /** Number of tasks completed (including error tasks)
+         */
+        std::atomic<uint64_t> completedTasks_;
+
+        /** Number of tasks which have failed.
+         */
+        std::atomic<uint64_t> errorTasks_;
+
+        /** Start of the execution.
+        */
+        std::chrono::high_resolution_clock::time_point start_;
+
+        /** Duration of the task.
+        */
+        double totalTime_;
+    };
+
+    /** The pool used by the static methods.
      */
-    static void Spawn(unsigned numThreads) {
-        if (running_)
-            throw std::runtime_error("Unable to Spawn threads, already running");
-        numThreads_ = numThreads;
-        threads_.resize(numThreads);
-        for (unsigned i = 0; i < numThreads; ++i) {
-            std::thread t([i] () {
-                // set thread id
-                setThreadId(i);
-                // create the worker
-                CRTP worker;
-                threads_[i] = &worker;
-                // start the worker
-                worker.start();
-                Log("Done.");
-                // wake up the blocked Stop() if last thread finishes
-                if (--numThreads_ == 0)
-                    cvStatus_.notify_all();
-                threads_[i] = nullptr;
-            });
-            t.detach();
-        }
+    static Pool & DefaultPool() {
+        static Pool pool;
+        return pool;
     }
 
-    /** Runs the spawned threads.
+    /** Schedules given task to be processed by the default pool.
      */
+    static void Schedule(TASK task, bool blockIfFull = true) {
+        DefaultPool().schedule(std::move(task), blockIfFull);
+    }
+
+    static void ScheduleMany(std::vector<TASK> tasks, bool blockIfFull = true) {
+        DefaultPool().scheduleMany(std::move(tasks), blockIfFull);
+    }
+
+    static void Spawn(unsigned numThreads) {
+        DefaultPool().spawn(numThreads);
+    }
+
     static void Run() {
-        if (running_ == true)
-            return;
-        // flip to running
-        running_ = true;
-        start_ = std::chrono::high_resolution_clock::now();
-        // notify all threads
-        cvStatus_.notify_all();
+        DefaultPool().run();
     }
 
-    /** Stops all threads, i.e. raises a stop flag and waits for all threads to stop, at which point it returns to caller.
-     */
     static void Stop() {
-        std::unique_lock<std::mutex> g(m_); // first get the mutex
-        // set the stop flag
-        running_ = false;
-        // notify all threads in case they are waiting on the empty queue
-        cvNotEmpty_.notify_all();
-        // wait until the last thread finishes
-        while (numThreads_ > 0)
-            cvStatus_.wait(g);
-        totalTime_ = TimeSinceStart();
+        DefaultPool().stop();
     }
 
-    /** Waits for all tasks to become blocked on an empty queue. Then stops them and returns when done.
-     */
     static void Wait() {
-        std::unique_lock<std::mutex> g(m_); // get the mutex
-        while (not tasks_.empty() or runningThreads_ > 0) {
-            // wait for the status update, i.e. when a thread waits for
-            cvStatus_.wait(g);
-        }
-        // the queue is empty, all tasks are waiting, initiate stop
-        running_ = false;
-        // wakeup all threads so that they can exit
-        cvNotEmpty_.notify_all();
-        // wait for the threads to exit
-        while (numThreads_ > 0)
-            cvStatus_.wait(g);
-        totalTime_ = TimeSinceStart();
+        DefaultPool().wait();
     }
 
-    /** Returns true when all threads have finished their execution. 
-     */
     static bool AllDone() {
-        return numThreads_ == 0;
+        return DefaultPool().allDone();
+    }
+
+    static size_t QueueSize() {
+        return DefaultPool().queueSize();
     }
 
     static unsigned long CompletedTasks() {
-        return completedTasks_;
+        return DefaultPool().completedTasks();
     }
 
     static unsigned long ErrorTasks() {
-        return errorTasks_;
+        return DefaultPool().errorTasks();
     }
 
     static double TotalTime() {
-        if (not std::isnan(totalTime_))
-            return totalTime_;
-        return TimeSinceStart();
+        return DefaultPool().totalTime();
     }
 
-
 protected:
-    static std::vector<CRTP *> threads_;
+
+    /** The pool the worker's thread belongs to.
+     */
+    Pool & pool() {
+        return *pool_;
+    }
 
 private:
 
     class WorkerTerminatedException {
     };
 
-    static double TimeSinceStart() {
-        auto now = std::chrono::high_resolution_clock::now();
-        return std::chrono::duration_cast<std::chrono::milliseconds>(now - start_).count() / 1000.0;
-    }
-
     /** This method must be overriden in children to process the given task.
      */
     virtual void run(TASK & task) = 0;
 
 
     TASK getNextTask() {
-        std::unique_lock<std::mutex> g(m_);
-        // if the job queue is empty, wait
-        while (tasks_.empty()) {
-            --runningThreads_;
-            // notify status change because the thread is going to sleep
-            cvStatus_.notify_one();
-            cvNotEmpty_.wait(g);
-            // when we wake up, check that we are still good to go
-            if (not running_)
+        typename Pool::Queue & own = *pool_->queues_[index_];
+        while (true) {
+            {
+                std::lock_guard<std::mutex> g(own.guard);
+                if (not own.tasks.empty()) {
+                    TASK task = std::move(own.tasks.front());
+                    own.tasks.pop_front();
+                    // if there is a room for new task, and there was none before, notify producers
+                    if (pool_->queued_-- == pool_->blockingTaskQueueSize_) {
+                        std::lock_guard<std::mutex> p(pool_->m_);
+                        pool_->cvFull_.notify_all();
+                    }
+                    return task;
+                }
+            }
+            if (not steal())
+                waitForTasks();
+        }
+    }
+
+    /** Moves half of the tasks of the first other thread that has any to the back of our own deque. Returns false if there were none.
+     */
+    bool steal() {
+        std::vector<TASK> stolen;
+        size_t n = pool_->queues_.size();
+        for (size_t i = 1; i < n and stolen.empty(); ++i) {
+            typename Pool::Queue & victim = *pool_->queues_[(index_ + i) % n];
+            std::lock_guard<std::mutex> g(victim.guard);
+            size_t count = (victim.tasks.size() + 1) / 2;
+            for (size_t j = 0; j < count; ++j) {
+                stolen.push_back(std::move(victim.tasks.back()));
+                victim.tasks.pop_back();
+            }
+        }
+        if (stolen.empty())
+            return false;
+        // the deques are never locked both at once, the tasks are still counted in queued_ while moved
+        typename Pool::Queue & own = *pool_->queues_[index_];
+        std::lock_guard<std::mutex> g(own.guard);
+        for (auto i = stolen.rbegin(), e = stolen.rend(); i != e; ++i)
+            own.tasks.push_back(std::move(*i));
+        return true;
+    }
+
+    /** Blocks while there are no tasks in the pool, throws WorkerTerminatedException when the pool stops.
+     */
+    void waitForTasks() {
+        Pool & p = *pool_;
+        std::unique_lock<std::mutex> g(p.m_);
+        --p.runningThreads_;
+        ++p.idleThreads_;
+        // notify status change because the thread is going to sleep, all waiters as threads waiting for run() wait on the same variable
+        p.cvStatus_.notify_all();
+        // another thread may take the task we were woken up for, in which case we keep waiting, still counted as not running
+        while (p.queued_ == 0) {
+            if (not p.running_) {
+                --p.idleThreads_;
                 throw WorkerTerminatedException();
-            if (not tasks_.empty()) {
-                // increase number of running threads and get the job
-                ++runningThreads_;
-                break;
             }
+            p.cvNotEmpty_.wait(g);
         }
-        TASK task = tasks_.front();
-        // if there is a room for new task, and there was none before, notify producers
-        if (tasks_.size() == BlockingTaskQueueSize)
-            cvFull_.notify_one();
-        tasks_.pop();
-        return task;
+        --p.idleThreads_;
+        ++p.runningThreads_;
     }
 
-    void start() {
+    void start(Pool & pool, unsigned index) {
         Log("Started.");
+        pool_ = & pool;
+        index_ = index;
+        current_ = this;
         // initially, wait for the running_ flag to be set to true
         {
-            std::unique_lock<std::mutex> g(m_);
-            while (not running_) {
-                cvStatus_.wait(g);
+            std::unique_lock<std::mutex> g(pool.m_);
+            while (not pool.running_) {
+                pool.cvStatus_.wait(g);
             }
             // increase number of running threads
-            ++runningThreads_;
+            ++pool.runningThreads_;
         }
         Log("Running.");
         // while we are in running state, get task to process and run on it.
-        while (running_ == true) {
+        while (pool.running_ == true) {
             try {
                 TASK task = getNextTask();
                 try {
                     // we got the task, run it
                     run(task);
                     // this cannot throw so is safe
-                    ++completedTasks_;
+                    ++pool.completedTasks_;
                 } catch (std::exception const & e) {
                     Error(STR(e.what() << " while executing task " << task));
-                    ++completedTasks_;
-                    ++errorTasks_;
+                    ++pool.completedTasks_;
+                    ++pool.errorTasks_;
                 }
             } catch (WorkerTerminatedException) {
+                current_ = nullptr;
                 return;
             }
         }
+        // stopped while running, the thread is no longer counted as running
+        std::lock_guard<std::mutex> g(pool.m_);
+        --pool.runningThreads_;
+        current_ = nullptr;
     }
 
-    // CV's to signal
-
-    /** CV variable that is used to signal any event change, i.e. full queue, etc.
-     */
-    static std::condition_variable cvNotEmpty_;
-
-
-    static std::condition_variable cvFull_;
-
-    static std::condition_variable cvStatus_;
-
-    /** Queue access mutex.
-     */
-    static std::mutex m_;
+    Pool * pool_ = nullptr;
 
-    /** Queue of available tasks.
+    /** Index of the thread, and its deque, in the pool.
      */
-    static std::queue<TASK> tasks_;
-
-    /** Number of existing threads.
+    unsigned index_ = 0;
 
-      Initialized to numThreads by the Spawn() method, decreased by threads as they are stopped.
+    /** Worker of the current thread, nullptr if the thread is not a worker of this type.
      */
-    static unsigned numThreads_;
-
-    /** Number of active threads (i.e. threads that are not blocking on empty task queue.
-     */
-    static unsigned runningThreads_;
-
-    /** If true, the threads should be running. If false, they should stop if running, or wait for run if they has not started yet.
-     */
-    static bool running_;
-
-    /** Number of tasks completed (including error tasks)
-     */
-    static std::atomic<uint64_t> completedTasks_;
-
-    /** Number of tasks which have failed.
-     */
-    static std::atomic<uint64_t> errorTasks_;
-
-    /** Start of the execution.
-    */
-    static std::chrono::high_resolution_clock::time_point start_;
-
-    /** Duration of the task.
-    */
-    static double totalTime_;
+    static thread_local Worker * current_;
 };
 
 
 
 template<typename CRTP, typename TASK>
-std::vector<CRTP *> Worker<CRTP, TASK>::threads_;
-
-template<typename CRTP, typename TASK>
-size_t Worker<CRTP, TASK>::BlockingTaskQueueSize = 1000;
-
-template<typename CRTP, typename TASK>
-std::condition_variable Worker<CRTP, TASK>::cvNotEmpty_;
-
-template<typename CRTP, typename TASK>
-std::condition_variable Worker<CRTP, TASK>::cvFull_;
-
-template<typename CRTP, typename TASK>
-std::condition_variable Worker<CRTP, TASK>::cvStatus_;
-
-template<typename CRTP, typename TASK>
-std::mutex Worker<CRTP, TASK>::m_;
-
-template<typename CRTP, typename TASK>
-std::queue<TASK> Worker<CRTP, TASK>::tasks_;
-
-template<typename CRTP, typename TASK>
-unsigned Worker<CRTP, TASK>::numThreads_ = 0;
-
-template<typename CRTP, typename TASK>
-unsigned Worker<CRTP, TASK>::runningThreads_ = 0;
-
-template<typename CRTP, typename TASK>
-bool Worker<CRTP, TASK>::running_ = false;
-
-template<typename CRTP, typename TASK>
-std::atomic<uint64_t> Worker<CRTP, TASK>::completedTasks_(0);
-
-template<typename CRTP, typename TASK>
-std::atomic<uint64_t> Worker<CRTP, TASK>::errorTasks_(0);
-
-template<typename CRTP, typename TASK>
-std::chrono::high_resolution_clock::time_point Worker<CRTP, TASK>::start_;
-
-template<typename CRTP, typename TASK>
-double Worker<CRTP, TASK>::totalTime_(NAN);
-
-
-
-
-
-
+thread_local Worker<CRTP, TASK> * Worker<CRTP, TASK>::current_ = nullptr;
@@ -17,6 +17,8 @@
 #include "stridemerger/stridemerger.h"
 #include "sccsorter/sccsorter.h"
 
+#include "benchmarks/benchmarks.h"
+
 
 std::string Settings::General::Target = "/data/ele/download";
 bool Settings::General::Incremental = true;
@@ -65,9 +67,41 @@ std::vector<std::string> Settings::Downloader::DenySuffix = {};
 std::vector<std::string> Settings::Downloader::DenyContents = {"/node_modules/"};
 
 bool Settings::Downloader::CompressFileContents = true;
+bool Settings::Downloader::ContentSegments = false;
+size_t Settings::Downloader::SegmentSize = 256 * 1024 * 1024;
+unsigned Settings::Downloader::SegmentBlockSize = 1024 * 1024;
+unsigned Settings::Downloader::ContentDeltaDepth = 0;
+size_t Settings::Downloader::ContentDictionarySize = 0;
+unsigned Settings::Downloader::TableShards = 16;
+size_t Settings::Downloader::ProjectMemoryBudget = 0;
 bool Settings::Downloader::CompressInExtraThread = true;
 int Settings::Downloader::MaxCompressorThreads = 4;
+size_t Settings::Downloader::CompressionQueueSize = 8;
 bool Settings::Downloader::KeepRepos = false;
+bool Settings::Downloader::Pipeline = false;
+unsigned Settings::Downloader::CloneThreads = 4;
+unsigned Settings::Downloader::MetadataThreads = 2;
+unsigned Settings::Downloader::WriteThreads = 1;
+unsigned Settings::Downloader::DeleteThreads = 1;
+size_t Settings::Downloader::StageQueueSize = 8;
+bool Settings::Downloader::CostOrder = true;
+double Settings::Downloader::CloneTimeout = 3600;
+double Settings::Downloader::MetadataTimeout = 300;
+double Settings::Downloader::SnapshotsTimeout = 4 * 3600;
+unsigned Settings::Downloader::TimeoutRetries = 1;
+double Settings::Downloader::TimeoutBudgetFactor = 4;
+unsigned Settings::Downloader::RetryAttempts = 3;
+double Settings::Downloader::RetryBackoff = 10;
+double Settings::Downloader::RateLimitBackoff = 60;
+bool Settings::Downloader::SkipDeadProjects = true;
+unsigned Settings::Downloader::DeadAfterAttempts = 10;
+bool Settings::Downloader::NativeGit = false;
+bool Settings::Downloader::StreamingHistory = true;
+bool Settings::Downloader::BloblessClone = false;
+bool Settings::Downloader::Refresh = false;
+bool Settings::Downloader::ForkServer = false;
+size_t Settings::Downloader::ContentBloomFilterBits = 0;
+size_t Settings::Downloader::ContentIndexCompaction = 10000000;
 
 
 //std::string Settings::StrideMerger::Folder = "/data/ecoop17/datasets/js_github_all";
@@ -95,11 +129,40 @@ void Download() {
     Downloader::Initialize();
     Downloader::LoadPreviousRun();
     Downloader::OpenOutputFiles();
-    Downloader::Spawn(Settings::General::NumThreads);
+    Downloader::Start();
     ProgressReporter::Start(Downloader::GetReporterFeeder());
-    Downloader::Run();
     Downloader::FeedFrom(Cleaner::OutputFilename());
-    Downloader::Wait();
+    Downloader::Finish();
+    Downloader::Finalize();
+}
+
+/** Cleans the inputs and downloads the projects at the same time, each project the cleaner finds is scheduled to the downloader right away instead of after the whole input.csv is written.
+ */
+void CleanAndDownload() {
+    Settings::General::LoadAPITokens(STR(Settings::General::Target << "/apitokens.csv"));
+    Downloader::Initialize();
+    Downloader::LoadPreviousRun();
+    Downloader::OpenOutputFiles();
+    Cleaner::LoadPreviousRun();
+    Downloader::Start();
+    Cleaner::Spawn(1);
+    ProgressReporter::Start([] (ProgressReporter & p, std::ostream & s) {
+        Cleaner::GetReporterFeeder()(p, s);
+        // only the downloader decides when all is done
+        p.allDone = false;
+        Downloader::GetReporterFeeder()(p, s);
+    });
+    // projects found by previous runs first, so that they keep their ids, the cleaner skips them
+    if (Settings::General::Incremental and isFile(Cleaner::OutputFilename()))
+        Downloader::FeedFrom(Cleaner::OutputFilename());
+    Cleaner::SetDownstream([] (std::string const & url) {
+        Downloader::Feed(Project(url));
+    });
+    Cleaner::Run();
+    Cleaner::FeedFrom(Settings::Cleaner::InputFiles);
+    Cleaner::Wait();
+    Cleaner::Finalize();
+    Downloader::Finish();
     Downloader::Finalize();
 }
 
@@ -128,8 +191,21 @@ int main(int argc, char * argv[]) {
         // Clean();
         //CleanAllLang();
         //Download();
+        //CleanAndDownload();
         //DownloadStackOverflow();
         //SccSorter::Verify("/home/peta/delete/tokenized_files_0.txt");
+        //Benchmark::GitReader("/tmp/ght-bench/git");
+        //Benchmark::PartialClone("/tmp/ght-bench/partial");
+        //Benchmark::ProcessLaunch();
+        //Benchmark::ContentHashes();
+        //Benchmark::ContentIngestion("/tmp/ght-bench/contents");
+        //Benchmark::ContentRead("/tmp/ght-bench/contents");
+        //Benchmark::ContentDeltas("/tmp/ght-bench/contents");
+        //Benchmark::ContentDictionaries("/tmp/ght-bench/contents", "/usr/lib/node_modules");
+        //Benchmark::Tables("/tmp/ght-bench/tables");
+        //Benchmark::ProjectMemory();
+        //Benchmark::Scheduler();
+        //Benchmark::CostOrder();
         //StrideMerger::Merge("0-1", "2", "0-2");
         // do the reporting
 